@@ -0,0 +1,329 @@
+#include "blockManager.h"
+#include "threadPool.h"
+#include "planCache.h"
+#include "profiler.h"
+#include "dct2d.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QImage>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+struct Config {
+    QSize size;
+    int blockSize;
+    int cutDimension;
+    int threads;
+    Precision precision;
+};
+
+struct Stats {
+    double minimum = 0;
+    double mean = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double maximum = 0;
+};
+
+struct Result {
+    Config config;
+    int workers;
+    double planningMs;
+    double coldMs;
+    Stats update;
+    Stats compress;
+    Stats total;
+    BlockCacheStats blockCache;
+};
+
+double millisecondsSince(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Nearest-rank percentile of sorted samples.
+double percentile(const std::vector<double> &sorted, double fraction) {
+    std::size_t rank = (std::size_t) std::ceil(fraction * sorted.size());
+    return sorted[std::min(std::max(rank, (std::size_t) 1), sorted.size()) - 1];
+}
+
+Stats summarize(std::vector<double> samples) {
+    Stats stats;
+    if (samples.empty()) {
+        return stats;
+    }
+    std::sort(samples.begin(), samples.end());
+    stats.minimum = samples.front();
+    stats.maximum = samples.back();
+    for (double sample : samples) {
+        stats.mean += sample / samples.size();
+    }
+    stats.p50 = percentile(samples, 0.5);
+    stats.p90 = percentile(samples, 0.9);
+    stats.p99 = percentile(samples, 0.99);
+    return stats;
+}
+
+// Smooth gradients with some texture, so that no block is trivially flat.
+QImage syntheticImage(const QSize &size) {
+    QImage image(size, QImage::Format_Grayscale8);
+    for (int y = 0; y < size.height(); ++y) {
+        uchar *line = image.scanLine(y);
+        for (int x = 0; x < size.width(); ++x) {
+            line[x] = (uchar) std::min(255.0, std::max(0.0, 128 + 90 * std::sin(x * 0.05) * std::cos(y * 0.07) + (x * 7 + y * 13) % 31));
+        }
+    }
+    return image;
+}
+
+// One configuration: the first construction and compress are timed as the
+// cold run (its plan creation separately, through the profiler), then
+// warmup untimed rounds, then repetitions timed rounds of updateImage()
+// (load + forward DCT) and compress() (cut + inverse DCT + pack). The
+// block cache counters cover the timed rounds.
+template<typename Sample>
+Result runConfig(const Config &config, const QImage &image, ThreadPool *pool, int warmup, int repetitions, std::size_t cacheBudget) {
+    Result result;
+    result.config = config;
+    result.workers = pool->getWorkerCount();
+
+    Profiler &profiler = Profiler::instance();
+    profiler.reset();
+    profiler.setEnabled(true);
+    auto begin = std::chrono::steady_clock::now();
+    BasicBlockManager<Sample> manager(&image, config.blockSize, config.cutDimension, pool);
+    manager.setResultCacheBudget(cacheBudget);
+    delete manager.compress();
+    result.coldMs = millisecondsSince(begin);
+    profiler.setEnabled(false);
+    result.planningMs = profiler.getTotals(Stage::Planning).milliseconds();
+
+    for (int i = 0; i < warmup; ++i) {
+        manager.updateImage(image);
+        delete manager.compress();
+    }
+    manager.resetBlockCacheStats();
+
+    std::vector<double> update;
+    std::vector<double> compress;
+    std::vector<double> total;
+    for (int i = 0; i < repetitions; ++i) {
+        begin = std::chrono::steady_clock::now();
+        manager.updateImage(image);
+        update.push_back(millisecondsSince(begin));
+
+        begin = std::chrono::steady_clock::now();
+        delete manager.compress();
+        compress.push_back(millisecondsSince(begin));
+        total.push_back(update.back() + compress.back());
+    }
+    result.update = summarize(update);
+    result.compress = summarize(compress);
+    result.total = summarize(total);
+    result.blockCache = manager.getBlockCacheStats();
+    return result;
+}
+
+void writeStats(std::ostream &out, const char *name, const Stats &stats) {
+    out << "\"" << name << "\": {\"min\": " << stats.minimum << ", \"mean\": " << stats.mean
+        << ", \"p50\": " << stats.p50 << ", \"p90\": " << stats.p90 << ", \"p99\": " << stats.p99
+        << ", \"max\": " << stats.maximum << "}";
+}
+
+std::string toJson(const std::vector<Result> &results, int warmup, int repetitions, std::size_t cacheBudget) {
+    std::ostringstream out;
+    out << "{\"hardwareThreads\": " << std::thread::hardware_concurrency()
+        << ", \"dctIsa\": \"" << dctIsaName(getDctIsa()) << "\""
+        << ", \"warmup\": " << warmup << ", \"repetitions\": " << repetitions
+        << ", \"blockCacheBytes\": " << cacheBudget
+        << ", \"units\": \"ms\", \"results\": [";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result &result = results[i];
+        const Config &config = result.config;
+        double megapixels = config.size.width() * (double) config.size.height() / 1e6;
+        out << (i > 0 ? ",\n  " : "\n  ")
+            << "{\"width\": " << config.size.width() << ", \"height\": " << config.size.height()
+            << ", \"blockSize\": " << config.blockSize << ", \"cut\": " << config.cutDimension
+            << ", \"threads\": " << result.workers << ", \"precision\": \"" << precisionName(config.precision) << "\""
+            << ", \"planningMs\": " << result.planningMs << ", \"coldMs\": " << result.coldMs << ", ";
+        writeStats(out, "update", result.update);
+        out << ", ";
+        writeStats(out, "compress", result.compress);
+        out << ", ";
+        writeStats(out, "total", result.total);
+        out << ", \"megapixelsPerSecond\": " << (result.total.p50 > 0 ? megapixels / (result.total.p50 / 1e3) : 0.0)
+            << ", \"blockCache\": {\"flatBlocks\": " << result.blockCache.flatBlocks << ", \"hits\": " << result.blockCache.hits
+            << ", \"misses\": " << result.blockCache.misses << ", \"evictions\": " << result.blockCache.evictions << "}}";
+    }
+    out << "\n]}\n";
+    return out.str();
+}
+
+// Comma separated, empty entries dropped.
+QStringList splitList(const QString &value) {
+    QStringList parts;
+    for (const QString &part : value.split(',')) {
+        if (!part.trimmed().isEmpty()) {
+            parts << part.trimmed();
+        }
+    }
+    return parts;
+}
+
+std::vector<int> parseIntegers(const QString &value, bool &ok) {
+    std::vector<int> values;
+    for (const QString &part : splitList(value)) {
+        values.push_back(part.toInt(&ok));
+        if (!ok) {
+            return values;
+        }
+    }
+    ok = !values.empty();
+    return values;
+}
+
+std::vector<QSize> parseSizes(const QString &value, bool &ok) {
+    std::vector<QSize> sizes;
+    ok = true;
+    for (const QString &part : splitList(value)) {
+        QStringList dimensions = part.split('x');
+        bool widthOk = false;
+        bool heightOk = false;
+        int width = dimensions.value(0).toInt(&widthOk);
+        int height = dimensions.value(1).toInt(&heightOk);
+        if (dimensions.size() != 2 || !widthOk || !heightOk || width < 1 || height < 1) {
+            ok = false;
+            return sizes;
+        }
+        sizes.push_back(QSize(width, height));
+    }
+    ok = !sizes.empty();
+    return sizes;
+}
+
+std::vector<Precision> parsePrecisions(const QString &value, bool &ok) {
+    std::vector<Precision> precisions;
+    ok = true;
+    for (const QString &part : splitList(value)) {
+        Precision precision = part == "float" ? Precision::Float : part == "fixed" ? Precision::Fixed : Precision::Double;
+        if (part != precisionName(precision)) {
+            ok = false;
+            return precisions;
+        }
+        precisions.push_back(precision);
+    }
+    ok = !precisions.empty();
+    return precisions;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication application(argc, argv);
+    QCoreApplication::setApplicationName("jpegc_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times BlockManager end to end over a matrix of configurations and writes the results as JSON.");
+    parser.addHelpOption();
+    QCommandLineOption sizesOption("sizes", "Image sizes WxH, comma separated.", "list", "512x512,2048x2048");
+    QCommandLineOption blocksOption(QStringList() << "b" << "block-sizes", "Block sizes, comma separated.", "list", "8,16,32");
+    QCommandLineOption cutsOption(QStringList() << "d" << "cuts", "Cut dimensions, comma separated; cuts above 2F - 1 are skipped.", "list", "4,8");
+    QCommandLineOption threadsOption(QStringList() << "j" << "threads", "Worker thread counts, comma separated (0 = all cores).", "list", "1,0");
+    QCommandLineOption precisionOption("precision", "Sample types, comma separated: double, float, fixed.", "list", "double,float,fixed");
+    QCommandLineOption imageOption("image", "Scale this image to every size instead of a synthetic one.", "file");
+    QCommandLineOption warmupOption("warmup", "Untimed rounds before measuring.", "N", "2");
+    QCommandLineOption repetitionsOption(QStringList() << "r" << "repetitions", "Timed rounds per configuration.", "N", "10");
+    QCommandLineOption wisdomOption("wisdom", "FFTW wisdom file to load and update.", "file");
+    QCommandLineOption blockCacheOption("block-cache", "Share the reconstruction of identical blocks through a cache of this many MB.", "MB", "0");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "JSON output file.", "file", "benchmark.json");
+    parser.addOption(sizesOption);
+    parser.addOption(blocksOption);
+    parser.addOption(cutsOption);
+    parser.addOption(threadsOption);
+    parser.addOption(precisionOption);
+    parser.addOption(imageOption);
+    parser.addOption(warmupOption);
+    parser.addOption(repetitionsOption);
+    parser.addOption(wisdomOption);
+    parser.addOption(blockCacheOption);
+    parser.addOption(outputOption);
+    parser.process(application);
+
+    bool sizesOk, blocksOk, cutsOk, threadsOk, precisionOk;
+    std::vector<QSize> sizes = parseSizes(parser.value(sizesOption), sizesOk);
+    std::vector<int> blockSizes = parseIntegers(parser.value(blocksOption), blocksOk);
+    std::vector<int> cuts = parseIntegers(parser.value(cutsOption), cutsOk);
+    std::vector<int> threadCounts = parseIntegers(parser.value(threadsOption), threadsOk);
+    std::vector<Precision> precisions = parsePrecisions(parser.value(precisionOption), precisionOk);
+    int warmup = parser.value(warmupOption).toInt();
+    int repetitions = parser.value(repetitionsOption).toInt();
+    int cacheMegabytes = parser.value(blockCacheOption).toInt();
+    std::size_t cacheBudget = (std::size_t) std::max(cacheMegabytes, 0) << 20;
+
+    if (!sizesOk || !blocksOk || !cutsOk || !threadsOk || !precisionOk || warmup < 0 || repetitions < 1 || cacheMegabytes < 0
+        || std::any_of(blockSizes.begin(), blockSizes.end(), [](int size){ return size < 2; })) {
+        parser.showHelp(1);
+    }
+
+    QImage source;
+    if (parser.isSet(imageOption) && !source.load(parser.value(imageOption))) {
+        std::cerr << "Cannot decode " << parser.value(imageOption).toStdString() << std::endl;
+        return 1;
+    }
+    if (parser.isSet(wisdomOption)) {
+        PlanCache::instance().setWisdomFile(parser.value(wisdomOption).toStdString());
+    }
+
+    std::vector<Result> results;
+    for (int threads : threadCounts) {
+        ThreadPool pool(threads);
+        for (const QSize &size : sizes) {
+            QImage image = source.isNull() ? syntheticImage(size)
+                                           : source.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation).convertToFormat(QImage::Format_Grayscale8);
+            for (int blockSize : blockSizes) {
+                for (int cutDimension : cuts) {
+                    if (blockSize > std::min(size.width(), size.height()) || cutDimension > 2 * blockSize - 1) {
+                        continue;
+                    }
+                    for (Precision precision : precisions) {
+                        Config config = {size, blockSize, cutDimension, threads, precision};
+                        Result result;
+                        switch (precision) {
+                            case Precision::Float:
+                                result = runConfig<float>(config, image, &pool, warmup, repetitions, cacheBudget);
+                                break;
+                            case Precision::Fixed:
+                                result = runConfig<std::int32_t>(config, image, &pool, warmup, repetitions, cacheBudget);
+                                break;
+                            default:
+                                result = runConfig<double>(config, image, &pool, warmup, repetitions, cacheBudget);
+                                break;
+                        }
+                        results.push_back(result);
+
+                        std::cout << size.width() << "x" << size.height() << " F=" << blockSize << " D=" << cutDimension
+                                  << " threads=" << result.workers << " " << precisionName(precision)
+                                  << ": planning " << result.planningMs << " ms, cold " << result.coldMs
+                                  << " ms, p50 " << result.total.p50 << " ms, p90 " << result.total.p90 << " ms" << std::endl;
+                    }
+                }
+            }
+        }
+    }
+    PlanCache::instance().saveWisdom();
+
+    QFile file(parser.value(outputOption));
+    if (!file.open(QIODevice::WriteOnly) || file.write(QByteArray::fromStdString(toJson(results, warmup, repetitions, cacheBudget))) < 0) {
+        std::cerr << "Cannot write " << file.fileName().toStdString() << std::endl;
+        return 1;
+    }
+    return 0;
+}
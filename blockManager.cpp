@@ -1,100 +1,149 @@
 #include "blockManager.h"
+#include "threadPool.h"
+#include "planCache.h"
+#include "dct2d.h"
+#include "blockStore.h"
+#include "pixelPack.h"
+#include "imagePyramid.h"
+#include "prunedIdct.h"
+#include "profiler.h"
 #include <iostream>
 #include <fftw3.h>
 #include <thread>
 #include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
 
-void BlockManager::parallelTask(const std::function<void(int, int)> &function, bool wait) {
-    int coreCount = ceil(sqrt((double) std::thread::hardware_concurrency()));
+namespace {
 
-    int rowsPerThread = ceil((double)rows / (double)coreCount);
-    int colsPerThread = ceil((double)columns / (double)coreCount);
-
-    workers = new std::thread*[(int)(ceil((double)rows / (double)rowsPerThread) * ceil((double)columns / (double)colsPerThread))];
-
-    threadsCount = 0;
-    for (int threadRow = 0; threadRow * rowsPerThread < rows; ++threadRow) {
-        for (int threadCol = 0; threadCol * colsPerThread < columns; ++threadCol) {
-            workers[threadsCount] = new std::thread([&function, threadRow, threadCol, rowsPerThread, colsPerThread, this](){
-                for (int i = threadRow * rowsPerThread; i < threadRow * rowsPerThread + rowsPerThread && i < rows; ++i) {
-                    for (int j = threadCol * colsPerThread; j < threadCol * colsPerThread + colsPerThread && j < columns; ++j) {
-                        function(i, j);
-                    }
-                }
-
-            });
-            threadsCount++;
-        }
+// Gray staging line for the RGB32 output format.
+uchar *grayScratch(int size) {
+    thread_local std::vector<uchar> scratch;
+    if ((int) scratch.size() < size) {
+        scratch.resize(size);
     }
+    return scratch.data();
+}
 
-    if (!wait) {
-        return;
+// Aligned block of at least size x size samples, reused by each worker.
+template<typename Sample>
+Sample *blockScratch(int size) {
+    thread_local std::unique_ptr<BlockStore<Sample>> scratch;
+    if (scratch == nullptr || scratch->getBlockStride() < size * size) {
+        scratch.reset(new BlockStore<Sample>(1, 1, size));
     }
+    return scratch->block(0, 0);
+}
 
-    for (int i = 0; i < threadsCount; ++i) {
-        workers[i]->join();
-        delete workers[i];
-    }
+}
 
-    delete[] workers;
-    workers = nullptr;
+template<typename Sample>
+void BasicBlockManager<Sample>::parallelTask(const std::function<void(int, int)> &function) {
+    pool->parallelFor(rows * columns, [&](int index){
+        function(index / columns, index % columns);
+    });
 }
 
 
-BlockManager::BlockManager(const QImage *image, int blockSize, int cutDimension): workers(nullptr), imgWidth(image->width()), imgHeight(image->height()), blockSize(blockSize), threadsCount(0), cutDimension(cutDimension) {
+template<typename Sample>
+BasicBlockManager<Sample>::BasicBlockManager(const QImage *image, int blockSize, int cutDimension, ThreadPool *pool): imgWidth(image->width()), imgHeight(image->height()), blockSize(blockSize), cutDimension(cutDimension), transformMode(TransformMode::Batched), outputFormat(QImage::Format_Grayscale8), qualityEnabled(false), resultCache(new BlockResultCache()), flatBlocks(0), cacheableBlocks(0), pool(pool != nullptr ? pool : &ThreadPool::global()) {
 
     rows = ceil((double)imgHeight /(double) blockSize);
     columns = ceil((double)imgWidth / (double)blockSize);
 
-    values = new double[imgHeight * imgWidth];
-    dctPlan = fftw_plan_r2r_2d(blockSize, blockSize, values, values, FFTW_REDFT10, FFTW_REDFT10, 0);
-    idctPlan = fftw_plan_r2r_2d(blockSize, blockSize, values, values, FFTW_REDFT01, FFTW_REDFT01, 0);
+    // Every block starts on a cache line, so the plans never need FFTW_UNALIGNED.
+    values = new BlockStore<Sample>(rows, columns, blockSize);
+    coefficients = new BlockStore<Sample>(rows, columns, blockSize);
+    blockHashes.resize((std::size_t) rows * columns);
+    flatValues.resize((std::size_t) rows * columns);
+
+    dctPlan = createPlan(blockSize, blockSize, 1, PlanCache::Kind::Forward);
+    idctPlan = createPlan(blockSize, blockSize, 1, PlanCache::Kind::Inverse);
 
     int lastBlockHeight = imgHeight % blockSize == 0 ? blockSize : imgHeight % blockSize;
     int lastBlockWidth = imgWidth % blockSize == 0 ? blockSize : imgWidth % blockSize;
 
-    dctPlanLastRow = fftw_plan_r2r_2d(lastBlockHeight, blockSize, values, values, FFTW_REDFT10, FFTW_REDFT10, 0);
-    idctPlanLastRow = fftw_plan_r2r_2d(lastBlockHeight, blockSize, values, values, FFTW_REDFT01, FFTW_REDFT01, 0);
+    dctPlanLastRow = createPlan(lastBlockHeight, blockSize, 1, PlanCache::Kind::Forward);
+    idctPlanLastRow = createPlan(lastBlockHeight, blockSize, 1, PlanCache::Kind::Inverse);
+
+    dctPlanLastColumn = createPlan(blockSize, lastBlockWidth, 1, PlanCache::Kind::Forward);
+    idctPlanLastColumn = createPlan(blockSize, lastBlockWidth, 1, PlanCache::Kind::Inverse);
 
-    dctPlanLastColumn = fftw_plan_r2r_2d(blockSize, lastBlockWidth, values, values, FFTW_REDFT10, FFTW_REDFT10, 0);
-    idctPlanLastColumn = fftw_plan_r2r_2d(blockSize, lastBlockWidth, values, values, FFTW_REDFT01, FFTW_REDFT01, 0);
+    dctPlanLastElement = createPlan(lastBlockHeight, lastBlockWidth, 1, PlanCache::Kind::Forward);
+    idctPlanLastElement = createPlan(lastBlockHeight, lastBlockWidth, 1, PlanCache::Kind::Inverse);
 
-    dctPlanLastElement = fftw_plan_r2r_2d(lastBlockHeight, lastBlockWidth, values, values, FFTW_REDFT10, FFTW_REDFT10, 0);
-    idctPlanLastElement = fftw_plan_r2r_2d(lastBlockHeight, lastBlockWidth, values, values, FFTW_REDFT01, FFTW_REDFT01, 0);
+    fixedKernel = Backend::hasKernel(blockSize);
+    prunedThreshold = 0.1;
+    batchColumns = imgWidth % blockSize == 0 ? columns : columns - 1;
+    batchDctPlan = createBatchPlan(blockSize, PlanCache::Kind::Forward);
+    batchIdctPlan = createBatchPlan(blockSize, PlanCache::Kind::Inverse);
+    batchDctPlanLastRow = createBatchPlan(lastBlockHeight, PlanCache::Kind::Forward);
+    batchIdctPlanLastRow = createBatchPlan(lastBlockHeight, PlanCache::Kind::Inverse);
+    PlanCache::instance().saveWisdom();
 
     updateImage(*image);
 }
 
 
-double* BlockManager::getBlock(int row, int column) {
-    int lastColumnWidth = imgWidth % blockSize == 0 ? blockSize : imgWidth % blockSize;
-    int lastRowHeight = getBlockHeight(row, column);
-    int lastColumn = row * (lastColumnWidth * blockSize);
-    int lastRowPixels = column * blockSize * lastRowHeight;
-    int centerPixels = row * (columns - 1) * blockSize * blockSize;
+template<typename Sample>
+typename BasicBlockManager<Sample>::Plan BasicBlockManager<Sample>::createPlan(int blockHeight, int blockWidth, int howMany, PlanCache::Kind kind) {
+    return Backend::createPlan(blockHeight, blockWidth, coefficients->getRowStride(), howMany, coefficients->getBlockStride(), kind);
+}
+
+template<typename Sample>
+typename BasicBlockManager<Sample>::Plan BasicBlockManager<Sample>::createBatchPlan(int blockHeight, PlanCache::Kind kind) {
+    if (batchColumns == 0) {
+        return Plan();
+    }
 
-    return &values[lastColumn + lastRowPixels + centerPixels];
+    // The full-width blocks of a block row are evenly spaced in the store,
+    // so one advanced-interface plan covers the whole strip.
+    return createPlan(blockHeight, blockSize, batchColumns, kind);
 }
 
+template<typename Sample>
+Sample* BasicBlockManager<Sample>::getBlock(int row, int column) {
+    return values->block(row, column);
+}
 
-BlockManager::~BlockManager() {
-    delete[] values;
-    delete[] workers;
-    fftw_destroy_plan(dctPlan);
-    fftw_destroy_plan(idctPlan);
-    fftw_destroy_plan(dctPlanLastRow);
-    fftw_destroy_plan(idctPlanLastRow);
-    fftw_destroy_plan(dctPlanLastColumn);
-    fftw_destroy_plan(idctPlanLastColumn);
-    fftw_destroy_plan(dctPlanLastElement);
-    fftw_destroy_plan(idctPlanLastElement);
-    fftw_cleanup();
+template<typename Sample>
+Sample* BasicBlockManager<Sample>::getCoefficients(int row, int column) {
+    return coefficients->block(row, column);
 }
 
+template<typename Sample>
+const Sample* BasicBlockManager<Sample>::getCoefficients(int row, int column) const {
+    return coefficients->block(row, column);
+}
 
-void BlockManager::cutValues(int row, int column) {
-    double *block = getBlock(row, column);
+template<typename Sample>
+double BasicBlockManager<Sample>::getCoefficientScale(int u, int v) const {
+    return Backend::coefficientScale(u, v, blockSize);
+}
 
+template<typename Sample>
+int BasicBlockManager<Sample>::getRowStride() const {
+    return coefficients->getRowStride();
+}
+
+template<typename Sample>
+std::size_t BasicBlockManager<Sample>::getMemoryFootprint() const {
+    return values->getByteSize() + coefficients->getByteSize();
+}
+
+
+template<typename Sample>
+BasicBlockManager<Sample>::~BasicBlockManager() {
+    delete values;
+    delete coefficients;
+    delete resultCache;
+}
+
+
+template<typename Sample>
+int BasicBlockManager<Sample>::getAdjustedCut(int row, int column) const {
     int blockWidth = getBlockWidth(row, column);
     int blockHeight = getBlockHeight(row, column);
 
@@ -103,25 +152,53 @@ void BlockManager::cutValues(int row, int column) {
         adjustedD = std::max((double) cutDimension - (blockSize - std::min(blockWidth, blockHeight)),
                              ceil((double)cutDimension * sqrt((((double)(blockWidth * blockHeight)) / (double) (blockSize * blockSize)))));
     }
+    return adjustedD;
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::cutValues(int row, int column, Sample *block) const {
+    cutCorner(row, column, block, getBlockHeight(row, column), getBlockWidth(row, column), getRowStride());
+}
+
+// Copies the top-left height x width coefficients of a block with the cut applied.
+template<typename Sample>
+void BasicBlockManager<Sample>::cutCorner(int row, int column, Sample *target, int height, int width, int stride) const {
+    cutLines(row, column, target, 0, height, width, stride);
+}
+
+// cutCorner() for count lines from first only.
+template<typename Sample>
+void BasicBlockManager<Sample>::cutLines(int row, int column, Sample *target, int first, int count, int width, int stride) const {
+    const Sample *source = getCoefficients(row, column);
+    int sourceStride = getRowStride();
+    int adjustedD = getAdjustedCut(row, column);
 
-    int rowLimit = adjustedD - std::max(blockWidth, blockHeight);
-    if (rowLimit < 0) {
-        rowLimit = 0;
+    for (int i = first; i < first + count; ++i) {
+        int colLimit = std::min(std::max(adjustedD - i, 0), width);
+
+        std::copy(source + i * sourceStride, source + i * sourceStride + colLimit, target + i * stride);
+        std::fill(target + i * stride + colLimit, target + i * stride + width, (Sample) 0);
     }
+}
 
-    for (int i = rowLimit; i < blockHeight; ++i) {
-        int colLimit = adjustedD - i;
-        if (colLimit < 0) {
-            colLimit = 0;
-        }
+template<typename Sample>
+void BasicBlockManager<Sample>::reconstructBlock(int row, int column, Sample *pixels) {
+    int blockWidth = getBlockWidth(row, column);
+    int blockHeight = getBlockHeight(row, column);
+    double divisor = Backend::pixelDivisor(blockWidth, blockHeight);
+    int stride = getRowStride();
 
-        for (int j = colLimit; j < blockWidth; ++j) {
-            block[i * blockWidth + j] = 0;
+    cutValues(row, column, pixels);
+    inverseTransform(row, column, pixels);
+    for (int y = 0; y < blockHeight; ++y) {
+        for (int x = 0; x < blockWidth; ++x) {
+            pixels[y * stride + x] = (Sample) std::min(std::max(pixels[y * stride + x] / divisor, 0.0), 255.0);
         }
     }
 }
 
-fftw_plan BlockManager::selectDctPlan(int i, int j) {
+template<typename Sample>
+const typename BasicBlockManager<Sample>::Plan &BasicBlockManager<Sample>::selectDctPlan(int i, int j) const {
     if (i < rows - 1 && j < columns - 1) {
         return dctPlan;
     }
@@ -134,7 +211,8 @@ fftw_plan BlockManager::selectDctPlan(int i, int j) {
     return dctPlanLastElement;
 }
 
-fftw_plan BlockManager::selectIdctPlan(int i, int j) {
+template<typename Sample>
+const typename BasicBlockManager<Sample>::Plan &BasicBlockManager<Sample>::selectIdctPlan(int i, int j) const {
     if (i < rows - 1 && j < columns - 1) {
         return idctPlan;
     }
@@ -147,88 +225,1121 @@ fftw_plan BlockManager::selectIdctPlan(int i, int j) {
     return idctPlanLastElement;
 }
 
-QImage* BlockManager::compress() {
-    auto *out = new QImage(imgWidth, imgHeight, QImage::Format_RGB32);
-    QRgb *imageBits = (QRgb*)out->bits();
+template<typename Sample>
+const typename BasicBlockManager<Sample>::Plan &BasicBlockManager<Sample>::selectBatchDctPlan(int i) const {
+    return i < rows - 1 ? batchDctPlan : batchDctPlanLastRow;
+}
 
-    parallelTask([&](int i, int j){
-        double* block = getBlock(i, j);
-        int blockWidth = getBlockWidth(i, j);
-        int blockHeight = getBlockHeight(i, j);
+template<typename Sample>
+const typename BasicBlockManager<Sample>::Plan &BasicBlockManager<Sample>::selectBatchIdctPlan(int i) const {
+    return i < rows - 1 ? batchIdctPlan : batchIdctPlanLastRow;
+}
+
+// Besides loading, hashes the block and notes whether all its pixels are
+// equal, while they are in cache anyway.
+template<typename Sample>
+void BasicBlockManager<Sample>::loadBlock(int i, int j, const QImage &image) {
+    int first = firstPixel(i, j, image);
+    std::uint64_t hash = BlockResultCache::hashSeed();
+    int differs = 0;
+    for (int pixelRow = 0; pixelRow < getBlockHeight(i, j); ++pixelRow) {
+        hash = BlockResultCache::hashLine(hash, loadLine(i, j, pixelRow, image, first, differs));
+    }
 
-        fftw_plan dct = selectDctPlan(i, j);
-        fftw_plan idct = selectIdctPlan(i, j);
+    blockHashes[i * columns + j] = hash;
+    flatValues[i * columns + j] = differs == 0 ? first : -1;
+}
+
+template<typename Sample>
+int BasicBlockManager<Sample>::firstPixel(int i, int j, const QImage &image) const {
+    const uchar *line = image.constScanLine(i * blockSize);
+    return image.format() == QImage::Format_Grayscale8 ? line[j * blockSize] : qGray(((const QRgb*)line)[j * blockSize]);
+}
+
+// Loads one pixel line of block (i, j) and returns its hash; differs
+// collects the bits in which its pixels differ from first.
+template<typename Sample>
+std::uint64_t BasicBlockManager<Sample>::loadLine(int i, int j, int pixelRow, const QImage &image, int first, int &differs) {
+    int blockWidth = getBlockWidth(i, j);
+    const uchar *line = image.constScanLine(i * blockSize + pixelRow);
+    Sample *block = getCoefficients(i, j) + pixelRow * getRowStride();
+    std::uint64_t hash = BlockResultCache::hashSeed();
+
+    if (image.format() == QImage::Format_Grayscale8) {
+        const uchar *pixels = line + j * blockSize;
+        for (int pixelCol = 0; pixelCol < blockWidth; ++pixelCol) {
+            block[pixelCol] = pixels[pixelCol];
+            hash = BlockResultCache::hashPixel(hash, pixels[pixelCol]);
+            differs |= pixels[pixelCol] ^ first;
+        }
+    } else {
+        const QRgb *pixels = (const QRgb*)line + j * blockSize;
+        for (int pixelCol = 0; pixelCol < blockWidth; ++pixelCol) {
+            int value = qGray(pixels[pixelCol]);
+            block[pixelCol] = value;
+            hash = BlockResultCache::hashPixel(hash, value);
+            differs |= value ^ first;
+        }
+    }
+    return hash;
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::packBlock(int i, int j, uchar *target, int bytesPerLine) {
+    int blockWidth = getBlockWidth(i, j);
+    int blockHeight = getBlockHeight(i, j);
+    packSamples(getBlock(i, j), getRowStride(), blockWidth, blockHeight, 1.0 / Backend::pixelDivisor(blockWidth, blockHeight), target, bytesPerLine);
+}
 
-        fftw_execute_r2r(dct, block, block);
-        cutValues(i, j);
-        fftw_execute_r2r(idct, block, block);
+template<typename Sample>
+void BasicBlockManager<Sample>::packSamples(const Sample *samples, int stride, int width, int height, double scale, uchar *target, int bytesPerLine) const {
+    bool gray = outputFormat == QImage::Format_Grayscale8;
 
-        int count = 0;
-        for (int pixelRow = 0; pixelRow <  blockHeight; ++pixelRow) {
+    for (int pixelRow = 0; pixelRow < height; ++pixelRow) {
+        const Sample *source = samples + pixelRow * stride;
+        uchar *line = target + (std::size_t)pixelRow * bytesPerLine;
+
+        if (gray) {
+            packGrayLine(source, width, scale, line);
+        } else {
+            uchar *staging = grayScratch(width);
+            packGrayLine(source, width, scale, staging);
+            expandGrayLine(staging, width, (QRgb*)line);
+        }
+    }
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::packRow(int i, uchar *bits, int bytesPerLine) {
+    int blockHeight = getBlockHeight(i, 0);
+    int stride = getRowStride();
+    // Only the last column can differ in width, so two factors cover the row.
+    double scale = 1.0 / Backend::pixelDivisor(blockSize, blockHeight);
+    double lastScale = 1.0 / Backend::pixelDivisor(getBlockWidth(i, columns - 1), blockHeight);
+    bool gray = outputFormat == QImage::Format_Grayscale8;
+
+    for (int pixelRow = 0; pixelRow < blockHeight; ++pixelRow) {
+        uchar *line = bits + (std::size_t)(i * blockSize + pixelRow) * bytesPerLine;
+        uchar *target = gray ? line : grayScratch(imgWidth);
+
+        for (int j = 0; j < columns; ++j) {
+            packGrayLine(getBlock(i, j) + pixelRow * stride, getBlockWidth(i, j),
+                         j == columns - 1 ? lastScale : scale, target + j * blockSize);
+        }
+        if (!gray) {
+            expandGrayLine(target, imgWidth, (QRgb*)line);
+        }
+    }
+}
+
+// Compares a packed block with its source while the block is still in cache.
+template<typename Sample>
+void BasicBlockManager<Sample>::measureBlock(int i, int j, const uchar *target, int bytesPerLine) {
+    int blockWidth = getBlockWidth(i, j);
+    int blockHeight = getBlockHeight(i, j);
+    bool graySource = sourceImage.format() == QImage::Format_Grayscale8;
+    bool grayOutput = outputFormat == QImage::Format_Grayscale8;
+    uchar *staging = grayScratch(2 * blockWidth);
+    BlockQuality quality;
+
+    for (int pixelRow = 0; pixelRow < blockHeight; ++pixelRow) {
+        const uchar *sourceLine = sourceImage.constScanLine(i * blockSize + pixelRow);
+        const uchar *outputLine = target + (std::size_t)pixelRow * bytesPerLine;
+        const uchar *sourcePixels = sourceLine + j * blockSize;
+        const uchar *outputPixels = outputLine;
+
+        if (!graySource) {
+            const QRgb *pixels = (const QRgb*)sourceLine + j * blockSize;
+            for (int pixelCol = 0; pixelCol < blockWidth; ++pixelCol) {
+                staging[pixelCol] = qGray(pixels[pixelCol]);
+            }
+            sourcePixels = staging;
+        }
+        if (!grayOutput) {
+            const QRgb *pixels = (const QRgb*)outputLine;
             for (int pixelCol = 0; pixelCol < blockWidth; ++pixelCol) {
-                int excessColumnWidth = imgWidth % blockSize;
-                int fullCols = columns;
-                if (excessColumnWidth > 0) {
-                    --fullCols;
+                staging[blockWidth + pixelCol] = qBlue(pixels[pixelCol]);
+            }
+            outputPixels = staging + blockWidth;
+        }
+        quality.addLine(sourcePixels, outputPixels, blockWidth);
+    }
+    blockQuality[i * columns + j] = quality;
+}
+
+// Writes a block without transforming it when it can: a flat block
+// reconstructs to its own value at any cut (to 0 at cut 0), and a block
+// whose content was reconstructed before with the same shape and cut is
+// copied from the result cache. Returns false when it has to be computed.
+template<typename Sample>
+bool BasicBlockManager<Sample>::resolveBlock(int i, int j, uchar *target, int bytesPerLine) {
+    int flat = flatValues[i * columns + j];
+    if (flat < 0 && !resultCache->isEnabled()) {
+        return false;
+    }
+
+    int blockWidth = getBlockWidth(i, j);
+    int blockHeight = getBlockHeight(i, j);
+    int cut = getAdjustedCut(i, j);
+    BlockResultKey key{blockHashes[i * columns + j], blockHeight, blockWidth, cut};
+    if (flat < 0 && !resultCache->wasSeen(key)) {
+        return false;
+    }
+
+    uchar *pixels = grayScratch(2 * blockWidth * blockHeight);
+    if (flat >= 0) {
+        std::fill(pixels, pixels + blockWidth * blockHeight, (uchar) (cut > 0 ? flat : 0));
+    } else {
+        uchar *source = pixels + blockWidth * blockHeight;
+        gatherSource(i, j, source);
+        if (!resultCache->lookup(key, source, pixels)) {
+            return false;
+        }
+    }
+    writeGrayBlock(pixels, blockWidth, blockHeight, target, bytesPerLine);
+    return true;
+}
+
+// Offers a computed and packed block to the result cache, which takes it
+// the second time the same content is computed.
+template<typename Sample>
+void BasicBlockManager<Sample>::storeBlock(int i, int j, const uchar *target, int bytesPerLine) {
+    if (!resultCache->isEnabled() || flatValues[i * columns + j] >= 0) {
+        return;
+    }
+
+    int blockWidth = getBlockWidth(i, j);
+    int blockHeight = getBlockHeight(i, j);
+    BlockResultKey key{blockHashes[i * columns + j], blockHeight, blockWidth, getAdjustedCut(i, j)};
+    if (!resultCache->markSeen(key)) {
+        return;
+    }
+
+    bool gray = outputFormat == QImage::Format_Grayscale8;
+    uchar *pixels = grayScratch(2 * blockWidth * blockHeight);
+    uchar *source = pixels + blockWidth * blockHeight;
+    gatherSource(i, j, source);
+
+    for (int pixelRow = 0; pixelRow < blockHeight; ++pixelRow) {
+        const uchar *line = target + (std::size_t)pixelRow * bytesPerLine;
+        uchar *out = pixels + pixelRow * blockWidth;
+        if (gray) {
+            std::copy(line, line + blockWidth, out);
+        } else {
+            for (int pixelCol = 0; pixelCol < blockWidth; ++pixelCol) {
+                out[pixelCol] = qBlue(((const QRgb*)line)[pixelCol]);
+            }
+        }
+    }
+    resultCache->insert(key, source, pixels);
+}
+
+// Gray source pixels of a block, row after row without padding.
+template<typename Sample>
+void BasicBlockManager<Sample>::gatherSource(int i, int j, uchar *pixels) const {
+    int blockWidth = getBlockWidth(i, j);
+    int blockHeight = getBlockHeight(i, j);
+    bool grayscale = sourceImage.format() == QImage::Format_Grayscale8;
+
+    for (int pixelRow = 0; pixelRow < blockHeight; ++pixelRow) {
+        const uchar *line = sourceImage.constScanLine(i * blockSize + pixelRow);
+        uchar *out = pixels + pixelRow * blockWidth;
+        if (grayscale) {
+            std::copy(line + j * blockSize, line + j * blockSize + blockWidth, out);
+        } else {
+            const QRgb *source = (const QRgb*)line + j * blockSize;
+            for (int pixelCol = 0; pixelCol < blockWidth; ++pixelCol) {
+                out[pixelCol] = qGray(source[pixelCol]);
+            }
+        }
+    }
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::writeGrayBlock(const uchar *pixels, int width, int height, uchar *target, int bytesPerLine) const {
+    bool gray = outputFormat == QImage::Format_Grayscale8;
+    for (int pixelRow = 0; pixelRow < height; ++pixelRow) {
+        uchar *line = target + (std::size_t)pixelRow * bytesPerLine;
+        if (gray) {
+            std::copy(pixels + pixelRow * width, pixels + (pixelRow + 1) * width, line);
+        } else {
+            expandGrayLine(pixels + pixelRow * width, width, (QRgb*)line);
+        }
+    }
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::countBlocks(const QRect &blocks) {
+    std::uint64_t flat = 0;
+    for (int i = blocks.top(); i <= blocks.bottom(); ++i) {
+        for (int j = blocks.left(); j <= blocks.right(); ++j) {
+            flat += flatValues[i * columns + j] >= 0;
+        }
+    }
+    flatBlocks += flat;
+    if (resultCache->isEnabled()) {
+        cacheableBlocks += (std::uint64_t) blocks.width() * blocks.height() - flat;
+    }
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::countBlocks(const std::vector<char> &changed) {
+    std::uint64_t flat = 0;
+    std::uint64_t count = 0;
+    for (std::size_t index = 0; index < changed.size(); ++index) {
+        flat += changed[index] && flatValues[index] >= 0;
+        count += changed[index] != 0;
+    }
+    flatBlocks += flat;
+    if (resultCache->isEnabled()) {
+        cacheableBlocks += count - flat;
+    }
+}
+
+template<typename Sample>
+bool BasicBlockManager<Sample>::useFixedKernel(int i, int j) const {
+    return fixedKernel && getBlockWidth(i, j) == blockSize && getBlockHeight(i, j) == blockSize;
+}
+
+template<typename Sample>
+bool BasicBlockManager<Sample>::useBatchedPlans() const {
+    return transformMode == TransformMode::Batched && batchColumns > 0 && !fixedKernel;
+}
+
+// With fewer blocks than twice the workers, whole blocks cannot keep every
+// worker busy, so large blocks are split into groups of lines instead.
+template<typename Sample>
+bool BasicBlockManager<Sample>::useSplitBlocks() const {
+    int workers = pool->getWorkerCount();
+    return workers > 1 && rows * columns < 2 * workers && blockSize >= 4 * splitLines;
+}
+
+// Below this fraction of surviving coefficients the pruned inverse does
+// less work than a full transform of the block.
+template<typename Sample>
+bool BasicBlockManager<Sample>::usePrunedInverse(int i, int j) const {
+    return PrunedIdct::nonzeroFraction(getBlockHeight(i, j), getBlockWidth(i, j), getAdjustedCut(i, j)) < prunedThreshold;
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::forwardTransform(int i, int j, Sample *block) {
+    if (useFixedKernel(i, j)) {
+        Backend::kernelForward(blockSize, block);
+        return;
+    }
+    Backend::execute(selectDctPlan(i, j), block);
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::inverseTransform(int i, int j, Sample *block) {
+    if (usePrunedInverse(i, j)) {
+        Backend::prunedInverse(getBlockHeight(i, j), getBlockWidth(i, j), getAdjustedCut(i, j), block, getRowStride());
+        return;
+    }
+    if (useFixedKernel(i, j)) {
+        Backend::kernelInverse(blockSize, block);
+        return;
+    }
+    Backend::execute(selectIdctPlan(i, j), block);
+}
+
+template<typename Sample>
+QImage* BasicBlockManager<Sample>::compress(const std::function<bool()> &cancelled) {
+    auto *out = new QImage(imgWidth, imgHeight, outputFormat);
+    uchar *bits = out->bits();
+    int bytesPerLine = out->bytesPerLine();
+    int pixelBytes = outputFormat == QImage::Format_Grayscale8 ? 1 : 4;
+
+    // Checked once per block; once set every remaining block is skipped.
+    std::atomic<bool> aborted(false);
+    auto isAborted = [&](){
+        if (!aborted.load(std::memory_order_relaxed) && cancelled && cancelled()) {
+            aborted.store(true, std::memory_order_relaxed);
+        }
+        return aborted.load(std::memory_order_relaxed);
+    };
+
+    Profiler::Scope scope(Stage::Compress, (std::uint64_t) rows * columns);
+    resultCache->trimFilter();
+    std::uint64_t blockBytes = (std::uint64_t) blockSize * blockSize * sizeof(Sample);
+    std::uint64_t blockPixelBytes = (std::uint64_t) blockSize * blockSize * pixelBytes;
+
+    if (useSplitBlocks()) {
+        compressSplit(bits, bytesPerLine, isAborted);
+    } else if (useBatchedPlans()) {
+        Profiler::Section section(std::min(pool->getWorkerCount(), rows));
+        pool->parallelFor(rows, [&](int i){
+            if (!isAborted()) {
+                reconstructRow(i, bits, bytesPerLine);
+            }
+        });
+    } else {
+        Profiler::Section section(std::min(pool->getWorkerCount(), rows * columns));
+        parallelTask([&](int i, int j){
+            if (isAborted()) {
+                return;
+            }
+
+            Sample* block = getBlock(i, j);
+            uchar *target = bits + (std::size_t)i * blockSize * bytesPerLine + j * blockSize * pixelBytes;
+            bool resolved;
+            {
+                Profiler::Scope pack(Stage::Pack, 1, blockPixelBytes);
+                resolved = resolveBlock(i, j, target, bytesPerLine);
+            }
+
+            if (!resolved) {
+                {
+                    Profiler::Scope cut(Stage::Cut, 1, blockBytes);
+                    cutValues(i, j, getBlock(i, j));
+                }
+                {
+                    Profiler::Scope inverse(Stage::InverseDct, 1, blockBytes);
+                    inverseTransform(i, j, block);
+                }
+                Profiler::Scope pack(Stage::Pack, 1, blockPixelBytes);
+                packBlock(i, j, target, bytesPerLine);
+                storeBlock(i, j, target, bytesPerLine);
+            }
+
+            if (qualityEnabled) {
+                Profiler::Scope quality(Stage::Quality, 1);
+                measureBlock(i, j, target, bytesPerLine);
+            }
+        });
+    }
+
+    if (aborted) {
+        delete out;
+        return nullptr;
+    }
+    countBlocks(QRect(0, 0, columns, rows));
+    return out;
+}
+
+// Reconstructs block row i into an image of the output format whose first
+// line is bits: flat and cached blocks directly, the others through cut,
+// inverse transform and pack. Rows are independent, so callers can
+// schedule the rows of several managers in one parallel section.
+template<typename Sample>
+void BasicBlockManager<Sample>::reconstructRow(int i, uchar *bits, int bytesPerLine) {
+    reconstructBlocks(i, bits, bytesPerLine, nullptr);
+}
+
+// reconstructRow() limited to the blocks flagged in changed, all of them
+// when it is null.
+template<typename Sample>
+void BasicBlockManager<Sample>::reconstructBlocks(int i, uchar *bits, int bytesPerLine, const char *changed) {
+    int pixelBytes = outputFormat == QImage::Format_Grayscale8 ? 1 : 4;
+    uchar *rowTarget = bits + (std::size_t)i * blockSize * bytesPerLine;
+    std::vector<char> resolved(columns);
+    int pending = columns;
+    {
+        Profiler::Scope pack(Stage::Pack, columns);
+        for (int j = 0; j < columns; ++j) {
+            resolved[j] = (changed != nullptr && !changed[j]) || resolveBlock(i, j, rowTarget + j * blockSize * pixelBytes, bytesPerLine);
+            pending -= resolved[j];
+        }
+    }
+    if (pending > 0) {
+        computeRow(i, bits, bytesPerLine, resolved, pending);
+    }
+
+    if (qualityEnabled) {
+        Profiler::Scope quality(Stage::Quality, columns);
+        for (int j = 0; j < columns; ++j) {
+            if (changed == nullptr || changed[j]) {
+                measureBlock(i, j, rowTarget + j * blockSize * pixelBytes, bytesPerLine);
+            }
+        }
+    }
+}
+
+// Cuts, inverse transforms, packs and caches the blocks of row i that
+// resolveBlock() could not write.
+template<typename Sample>
+void BasicBlockManager<Sample>::computeRow(int i, uchar *bits, int bytesPerLine, std::vector<char> &resolved, int pending) {
+    int pixelBytes = outputFormat == QImage::Format_Grayscale8 ? 1 : 4;
+    std::uint64_t blockBytes = (std::uint64_t) blockSize * blockSize * sizeof(Sample);
+    std::uint64_t blockPixelBytes = (std::uint64_t) blockSize * blockSize * pixelBytes;
+    uchar *rowTarget = bits + (std::size_t)i * blockSize * bytesPerLine;
+
+    // All full-width blocks of a row share their cut, so they either all
+    // take the pruned inverse or the batch plan. A mostly unresolved row
+    // still runs the batch plan and recomputes its few resolved blocks.
+    bool batch = useBatchedPlans() && !usePrunedInverse(i, 0);
+    bool wholeRow = pending == columns || (batch && pending * 4 > columns * 3);
+    if (wholeRow) {
+        std::fill(resolved.begin(), resolved.end(), 0);
+        pending = columns;
+    }
+
+    {
+        Profiler::Scope cut(Stage::Cut, pending, pending * blockBytes);
+        for (int j = 0; j < columns; ++j) {
+            if (!resolved[j]) {
+                cutValues(i, j, getBlock(i, j));
+            }
+        }
+    }
+
+    {
+        Profiler::Scope inverse(Stage::InverseDct, pending, pending * blockBytes);
+        int first = 0;
+        if (wholeRow && batch) {
+            Backend::execute(selectBatchIdctPlan(i), getBlock(i, 0));
+            first = batchColumns;
+        }
+        for (int j = first; j < columns; ++j) {
+            if (!resolved[j]) {
+                inverseTransform(i, j, getBlock(i, j));
+            }
+        }
+    }
+
+    {
+        Profiler::Scope pack(Stage::Pack, pending, pending * blockPixelBytes);
+        if (wholeRow) {
+            packRow(i, bits, bytesPerLine);
+        }
+        for (int j = 0; j < columns; ++j) {
+            if (!resolved[j]) {
+                if (!wholeRow) {
+                    packBlock(i, j, rowTarget + j * blockSize * pixelBytes, bytesPerLine);
                 }
+                storeBlock(i, j, rowTarget + j * blockSize * pixelBytes, bytesPerLine);
+            }
+        }
+    }
+}
 
-                int realRow = i * (blockSize * fullCols + excessColumnWidth) * blockSize + pixelRow * (blockSize * fullCols + excessColumnWidth);
-                int realCol = j * blockSize + pixelCol;
+// Runs function(position, first, count) over groups of at most splitLines
+// of the lines(i, j) lines of every listed block as one parallel section;
+// position is the index of the block in blocks.
+template<typename Sample>
+void BasicBlockManager<Sample>::parallelLines(const std::vector<int> &blocks, const std::function<int(int, int)> &lines, const std::function<void(int, int, int)> &function) {
+    std::vector<std::pair<int, int>> tasks;
+    for (int position = 0; position < (int) blocks.size(); ++position) {
+        int count = lines(blocks[position] / columns, blocks[position] % columns);
+        for (int first = 0; first < count; first += splitLines) {
+            tasks.emplace_back(position, first);
+        }
+    }
 
-                int value = (int)(block[count] / (4 * blockWidth * blockHeight));
-                if (value < 0) value = 0;
-                if (value > 255) value = 255;
+    Profiler::Section section(std::min(pool->getWorkerCount(), (int) tasks.size()));
+    pool->parallelFor((int) tasks.size(), [&](int index){
+        int position = tasks[index].first;
+        int first = tasks[index].second;
+        int count = lines(blocks[position] / columns, blocks[position] % columns);
+        function(position, first, std::min(splitLines, count - first));
+    });
+}
 
-                imageBits[realRow + realCol] = QColor(value, value, value).rgba();
-                ++count;
+// Transforms the listed blocks as two separable passes, each split into
+// groups of lines: the forward transform of the coefficients store rows
+// first, the inverse one of the values store columns first. Columns past
+// the cut hold only zeros, so the inverse skips them; blocks that take the
+// pruned inverse run its row and column passes instead.
+template<typename Sample>
+void BasicBlockManager<Sample>::splitTransform(const std::vector<int> &blocks, PlanCache::Kind kind) {
+    bool inverse = kind == PlanCache::Kind::Inverse;
+    int stride = getRowStride();
+    std::vector<char> pruned(blocks.size());
+    std::vector<std::size_t> partialOffsets(blocks.size());
+    std::size_t partialSize = 0;
+    for (std::size_t position = 0; inverse && position < blocks.size(); ++position) {
+        int i = blocks[position] / columns;
+        int j = blocks[position] % columns;
+        pruned[position] = usePrunedInverse(i, j);
+        partialOffsets[position] = partialSize;
+        if (pruned[position]) {
+            partialSize += (std::size_t) std::max(std::min(getAdjustedCut(i, j), getBlockHeight(i, j)), 0) * getBlockWidth(i, j);
+        }
+    }
+    std::vector<double> partial(partialSize);
+
+    for (int pass = 0; pass < 2; ++pass) {
+        bool columnPass = inverse == (pass == 0);
+        auto lines = [&](int i, int j){
+            int cut = getAdjustedCut(i, j);
+            if (!inverse || !columnPass) {
+                return columnPass ? getBlockWidth(i, j) : getBlockHeight(i, j);
+            }
+            if (usePrunedInverse(i, j)) {
+                return std::max(std::min(cut, getBlockHeight(i, j)), 0);
             }
+            return std::min(getBlockWidth(i, j), cut);
+        };
+
+        // A full group and the remainder per block, planned before the workers start.
+        std::vector<Plan> plans(2 * blocks.size());
+        for (std::size_t position = 0; position < blocks.size(); ++position) {
+            int i = blocks[position] / columns;
+            int j = blocks[position] % columns;
+            int length = columnPass ? getBlockHeight(i, j) : getBlockWidth(i, j);
+            int count = lines(i, j);
+            for (int k = 0; k < 2 && !pruned[position]; ++k) {
+                int howMany = k == 0 ? std::min(splitLines, count) : count % splitLines;
+                if (howMany > 0) {
+                    plans[2 * position + k] = columnPass ? Backend::createLinePlan(length, stride, howMany, 1, kind)
+                                                         : Backend::createLinePlan(length, 1, howMany, stride, kind);
+                }
+            }
+        }
+
+        parallelLines(blocks, lines, [&](int position, int first, int count){
+            int i = blocks[position] / columns;
+            int j = blocks[position] % columns;
+            int blockWidth = getBlockWidth(i, j);
+            int blockHeight = getBlockHeight(i, j);
+            Sample *block = inverse ? getBlock(i, j) : getCoefficients(i, j);
+            Profiler::Scope transform(inverse ? Stage::InverseDct : Stage::ForwardDct, 0,
+                                      (std::uint64_t) count * (columnPass ? blockHeight : blockWidth) * sizeof(Sample));
+            if (pruned[position]) {
+                const PrunedIdct &transform = Backend::prunedTransform(blockHeight, blockWidth);
+                double *blockPartial = partial.data() + partialOffsets[position];
+                if (pass == 0) {
+                    transform.rowPass(block, stride, getAdjustedCut(i, j), blockPartial, first, count);
+                } else {
+                    transform.columnPass(blockPartial, getAdjustedCut(i, j), block, stride, first, count);
+                }
+                return;
+            }
+            Backend::execute(plans[2 * position + (count == splitLines ? 0 : 1)], block + (columnPass ? first : first * stride));
+        });
+    }
+}
+
+// updateImage() for a few large blocks: loads and hashes groups of lines,
+// then transforms them with splitTransform().
+template<typename Sample>
+void BasicBlockManager<Sample>::updateSplit() {
+    std::vector<int> blocks(rows * columns);
+    std::vector<int> firsts(blocks.size());
+    for (int index = 0; index < rows * columns; ++index) {
+        blocks[index] = index;
+        firsts[index] = firstPixel(index / columns, index % columns, sourceImage);
+    }
+    std::vector<std::uint64_t> lineHashes(blocks.size() * blockSize);
+    std::vector<int> lineDiffers(blocks.size() * blockSize);
+    int pixelBytes = sourceImage.depth() / 8;
+
+    auto height = [&](int i, int j){
+        return getBlockHeight(i, j);
+    };
+    parallelLines(blocks, height, [&](int position, int first, int count){
+        int i = position / columns;
+        int j = position % columns;
+        Profiler::Scope load(Stage::Load, 0, (std::uint64_t) count * getBlockWidth(i, j) * pixelBytes);
+        for (int pixelRow = first; pixelRow < first + count; ++pixelRow) {
+            std::size_t slot = (std::size_t) position * blockSize + pixelRow;
+            lineDiffers[slot] = 0;
+            lineHashes[slot] = loadLine(i, j, pixelRow, sourceImage, firsts[position], lineDiffers[slot]);
+        }
+    });
+
+    for (int position = 0; position < (int) blocks.size(); ++position) {
+        std::uint64_t hash = BlockResultCache::hashSeed();
+        int differs = 0;
+        for (int pixelRow = 0; pixelRow < getBlockHeight(position / columns, position % columns); ++pixelRow) {
+            hash = BlockResultCache::hashLine(hash, lineHashes[(std::size_t) position * blockSize + pixelRow]);
+            differs |= lineDiffers[(std::size_t) position * blockSize + pixelRow];
+        }
+        blockHashes[position] = hash;
+        flatValues[position] = differs == 0 ? firsts[position] : -1;
+    }
+
+    splitTransform(blocks, PlanCache::Kind::Forward);
+}
+
+// compress() for a few large blocks: flat and cached blocks are written
+// whole, the others cut, inverse transformed and packed in groups of lines.
+template<typename Sample>
+void BasicBlockManager<Sample>::compressSplit(uchar *bits, int bytesPerLine, const std::function<bool()> &isAborted) {
+    int pixelBytes = outputFormat == QImage::Format_Grayscale8 ? 1 : 4;
+    int stride = getRowStride();
+    auto target = [&](int i, int j){
+        return bits + (std::size_t)i * blockSize * bytesPerLine + j * blockSize * pixelBytes;
+    };
+    auto height = [&](int i, int j){
+        return getBlockHeight(i, j);
+    };
+
+    std::vector<char> resolved(rows * columns);
+    {
+        Profiler::Section section(std::min(pool->getWorkerCount(), rows * columns));
+        parallelTask([&](int i, int j){
+            Profiler::Scope pack(Stage::Pack, 1);
+            resolved[i * columns + j] = resolveBlock(i, j, target(i, j), bytesPerLine);
+        });
+    }
+    std::vector<int> pending;
+    for (int index = 0; index < rows * columns; ++index) {
+        if (!resolved[index]) {
+            pending.push_back(index);
+        }
+    }
+
+    if (!pending.empty() && !isAborted()) {
+        parallelLines(pending, height, [&](int position, int first, int count){
+            int i = pending[position] / columns;
+            int j = pending[position] % columns;
+            Profiler::Scope cut(Stage::Cut, 0, (std::uint64_t) count * stride * sizeof(Sample));
+            cutLines(i, j, getBlock(i, j), first, count, getBlockWidth(i, j), stride);
+        });
+    }
+    if (!pending.empty() && !isAborted()) {
+        splitTransform(pending, PlanCache::Kind::Inverse);
+    }
+    if (!pending.empty() && !isAborted()) {
+        parallelLines(pending, height, [&](int position, int first, int count){
+            int i = pending[position] / columns;
+            int j = pending[position] % columns;
+            int blockWidth = getBlockWidth(i, j);
+            Profiler::Scope pack(Stage::Pack, 0, (std::uint64_t) count * blockWidth * pixelBytes);
+            packSamples(getBlock(i, j) + first * stride, stride, blockWidth, count, 1.0 / Backend::pixelDivisor(blockWidth, getBlockHeight(i, j)),
+                        target(i, j) + (std::size_t) first * bytesPerLine, bytesPerLine);
+        });
+        for (int index : pending) {
+            storeBlock(index / columns, index % columns, target(index / columns, index % columns), bytesPerLine);
+        }
+    }
+
+    if (qualityEnabled && !isAborted()) {
+        Profiler::Section section(std::min(pool->getWorkerCount(), rows * columns));
+        parallelTask([&](int i, int j){
+            Profiler::Scope quality(Stage::Quality, 1);
+            measureBlock(i, j, target(i, j), bytesPerLine);
+        });
+    }
+}
+
+// Reconstructs only the blocks inside the block rectangle, e.g. the part
+// of the image a viewer currently shows. The tile covers their pixels.
+template<typename Sample>
+QImage BasicBlockManager<Sample>::compressTile(const QRect &blocks, const std::function<bool()> &cancelled) {
+    QRect grid = blocks.intersected(QRect(0, 0, columns, rows));
+    if (grid.isEmpty()) {
+        return QImage();
+    }
+
+    int right = grid.right() * blockSize + getBlockWidth(0, grid.right());
+    int bottom = grid.bottom() * blockSize + getBlockHeight(grid.bottom(), 0);
+    QImage tile(right - grid.left() * blockSize, bottom - grid.top() * blockSize, outputFormat);
+    uchar *bits = tile.bits();
+    int bytesPerLine = tile.bytesPerLine();
+    int pixelBytes = outputFormat == QImage::Format_Grayscale8 ? 1 : 4;
+
+    std::atomic<bool> aborted(false);
+    pool->parallelFor(grid.width() * grid.height(), [&](int index){
+        if (aborted.load(std::memory_order_relaxed) || (cancelled && cancelled())) {
+            aborted.store(true, std::memory_order_relaxed);
+            return;
+        }
+
+        int row = index / grid.width();
+        int column = index % grid.width();
+        int i = grid.top() + row;
+        int j = grid.left() + column;
+        Sample *block = getBlock(i, j);
+
+        uchar *target = bits + (std::size_t)row * blockSize * bytesPerLine + column * blockSize * pixelBytes;
+
+        if (!resolveBlock(i, j, target, bytesPerLine)) {
+            cutValues(i, j, block);
+            inverseTransform(i, j, block);
+            packBlock(i, j, target, bytesPerLine);
+            storeBlock(i, j, target, bytesPerLine);
+        }
+        if (qualityEnabled) {
+            measureBlock(i, j, target, bytesPerLine);
         }
     });
 
+    if (aborted) {
+        return QImage();
+    }
+    countBlocks(grid);
+    return tile;
+}
+
+// Reconstructs the blocks at 1/denominator of their size by running a
+// reduced inverse transform over each block's low-frequency corner, so the
+// cost follows the output pixels. Block sizes the denominator does not
+// divide reconstruct at full size and are box filtered down instead, so the
+// denominator must be a power of two.
+template<typename Sample>
+QImage BasicBlockManager<Sample>::compressReduced(int denominator, const QRect &blocks, const std::function<bool()> &cancelled) {
+    QRect grid = (blocks.isNull() ? QRect(0, 0, columns, rows) : blocks).intersected(QRect(0, 0, columns, rows));
+    if (grid.isEmpty() || denominator < 1 || (denominator & (denominator - 1)) != 0) {
+        return QImage();
+    }
+
+    if (denominator == 1 || blockSize % denominator != 0) {
+        QImage image = compressTile(grid, cancelled);
+        for (int scale = 1; scale < denominator && !image.isNull(); scale *= 2) {
+            image = ImagePyramid::downsample(image, pool);
+        }
+        return image;
+    }
+
+    int reduced = blockSize / denominator;
+    auto reducedSize = [denominator](int extent){
+        return (extent + denominator - 1) / denominator;
+    };
+    int lastBlockHeight = reducedSize(imgHeight - (rows - 1) * blockSize);
+    int lastBlockWidth = reducedSize(imgWidth - (columns - 1) * blockSize);
+
+    // One plan per reduced block shape; [last row][last column].
+    Plan plans[2][2];
+    for (int tall = 0; tall < 2; ++tall) {
+        for (int wide = 0; wide < 2; ++wide) {
+            plans[tall][wide] = Backend::createPlan(tall ? lastBlockHeight : reduced, wide ? lastBlockWidth : reduced, reduced, 1, reduced * reduced, PlanCache::Kind::Inverse);
+        }
+    }
+
+    int width = (grid.width() - 1) * reduced + (grid.right() == columns - 1 ? lastBlockWidth : reduced);
+    int height = (grid.height() - 1) * reduced + (grid.bottom() == rows - 1 ? lastBlockHeight : reduced);
+    QImage out(width, height, outputFormat);
+    uchar *bits = out.bits();
+    int bytesPerLine = out.bytesPerLine();
+    int pixelBytes = outputFormat == QImage::Format_Grayscale8 ? 1 : 4;
+
+    std::atomic<bool> aborted(false);
+    pool->parallelFor(grid.height(), [&](int row){
+        if (aborted.load(std::memory_order_relaxed) || (cancelled && cancelled())) {
+            aborted.store(true, std::memory_order_relaxed);
+            return;
+        }
+
+        int i = grid.top() + row;
+        Sample *block = blockScratch<Sample>(reduced);
+
+        for (int column = 0; column < grid.width(); ++column) {
+            int j = grid.left() + column;
+            int blockWidth = getBlockWidth(i, j);
+            int blockHeight = getBlockHeight(i, j);
+            int reducedWidth = reducedSize(blockWidth);
+            int reducedHeight = reducedSize(blockHeight);
+
+            cutCorner(i, j, block, reducedHeight, reducedWidth, reduced);
+            Backend::execute(plans[i == rows - 1][j == columns - 1], block);
+            packSamples(block, reduced, reducedWidth, reducedHeight, 1.0 / Backend::reducedDivisor(blockWidth, blockHeight, reducedWidth, reducedHeight),
+                        bits + (std::size_t)row * reduced * bytesPerLine + column * reduced * pixelBytes, bytesPerLine);
+        }
+    });
+
+    if (aborted) {
+        return QImage();
+    }
     return out;
 }
 
-void BlockManager::setCutDimension(int dimension) {
+template<typename Sample>
+int BasicBlockManager<Sample>::getBlockSize() const {
+    return blockSize;
+}
+
+template<typename Sample>
+int BasicBlockManager<Sample>::getCutDimension() const {
+    return cutDimension;
+}
+
+template<typename Sample>
+ThreadPool *BasicBlockManager<Sample>::getThreadPool() const {
+    return pool;
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::setCutDimension(int dimension) {
+    if (dimension != cutDimension && qualityEnabled) {
+        blockQuality.assign(blockQuality.size(), BlockQuality());
+    }
     this->cutDimension = dimension;
 }
 
-void BlockManager::updateImage(const QImage &image) {
-    QRgb * imageBits = (QRgb*)image.bits();
+template<typename Sample>
+void BasicBlockManager<Sample>::setTransformMode(TransformMode mode) {
+    if (mode != transformMode) {
+        resultCache->clear();
+    }
+    this->transformMode = mode;
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::setFixedSizeKernels(bool enabled) {
+    this->fixedKernel = enabled && Backend::hasKernel(blockSize);
+    resultCache->clear();
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::setOutputFormat(QImage::Format format) {
+    this->outputFormat = format == QImage::Format_RGB32 ? QImage::Format_RGB32 : QImage::Format_Grayscale8;
+}
+
+template<typename Sample>
+QImage::Format BasicBlockManager<Sample>::getOutputFormat() const {
+    return outputFormat;
+}
+
+// Measures every block compress() and compressTile() reconstruct against the
+// last updateImage() source. The measurements reset when the source or the
+// cut changes.
+template<typename Sample>
+void BasicBlockManager<Sample>::setQualityMetrics(bool enabled) {
+    qualityEnabled = enabled;
+    blockQuality.assign(enabled ? (std::size_t) rows * columns : 0, BlockQuality());
+}
+
+template<typename Sample>
+bool BasicBlockManager<Sample>::hasQualityMetrics() const {
+    return qualityEnabled;
+}
+
+template<typename Sample>
+QualityMetrics BasicBlockManager<Sample>::getQualityMetrics() const {
+    return QualityMetrics(rows, columns, blockQuality);
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::setPrunedThreshold(double fraction) {
+    this->prunedThreshold = fraction;
+    resultCache->clear();
+}
+
+// Shares the reconstruction of identical blocks through a cache of at most
+// bytes; 0 turns sharing off. Cached results survive updateImage(), so
+// repeated content across images or frames hits as well. Different
+// transform settings round differently, so changing them clears it.
+template<typename Sample>
+void BasicBlockManager<Sample>::setResultCacheBudget(std::size_t bytes) {
+    resultCache->setByteBudget(bytes);
+}
 
+template<typename Sample>
+BlockCacheStats BasicBlockManager<Sample>::getBlockCacheStats() const {
+    BlockCacheStats stats = resultCache->getStats();
+    stats.flatBlocks = flatBlocks;
+    stats.misses = cacheableBlocks - std::min<std::uint64_t>(stats.hits, cacheableBlocks);
+    return stats;
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::resetBlockCacheStats() {
+    resultCache->resetStats();
+    flatBlocks = 0;
+    cacheableBlocks = 0;
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::setThreadPool(ThreadPool *pool) {
+    this->pool = pool != nullptr ? pool : &ThreadPool::global();
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::updateImage(const QImage &source) {
+    setSource(source);
+
+    Profiler::Scope scope(Stage::Update, (std::uint64_t) rows * columns);
+
+    if (useSplitBlocks()) {
+        updateSplit();
+        return;
+    }
+
+    if (useBatchedPlans()) {
+        Profiler::Section section(std::min(pool->getWorkerCount(), rows));
+        pool->parallelFor(rows, [&](int i){
+            loadRow(i);
+        });
+        return;
+    }
+
+    std::uint64_t blockBytes = (std::uint64_t) blockSize * blockSize * sizeof(Sample);
+    std::uint64_t blockPixelBytes = (std::uint64_t) blockSize * blockSize * (sourceImage.depth() / 8);
+
+    Profiler::Section section(std::min(pool->getWorkerCount(), rows * columns));
     parallelTask([&](int i, int j){
-        int blockWidth = getBlockWidth(i, j);
-        int blockHeight = getBlockHeight(i, j);
-        double *block = getBlock(i, j);
+        Sample *block = getCoefficients(i, j);
 
-        int count = 0;
-        for (int pixelRow = 0; pixelRow < blockHeight; ++pixelRow) {
-            for (int pixelCol = 0; pixelCol < blockWidth; ++pixelCol) {
-                int excessColumnWidth = imgWidth % blockSize;
-                int fullCols = columns;
-                if (excessColumnWidth > 0) {
-                    --fullCols;
-                }
+        {
+            Profiler::Scope load(Stage::Load, 1, blockPixelBytes);
+            loadBlock(i, j, sourceImage);
+        }
+        Profiler::Scope forward(Stage::ForwardDct, 1, blockBytes);
+        forwardTransform(i, j, block);
+    });
+}
 
-                int realRow = i * (blockSize * fullCols + excessColumnWidth) * blockSize + pixelRow * (blockSize * fullCols + excessColumnWidth);
-                int realCol = j * blockSize + pixelCol;
+// Takes a new source without transforming it; loadRow() then transforms it
+// row by row.
+template<typename Sample>
+void BasicBlockManager<Sample>::setSource(const QImage &source) {
+    takeSource(source);
+    if (qualityEnabled) {
+        blockQuality.assign(blockQuality.size(), BlockQuality());
+    }
+}
+
+template<typename Sample>
+void BasicBlockManager<Sample>::takeSource(const QImage &source) {
+    QImage converted;
+    switch (source.format()) {
+        case QImage::Format_Grayscale8:
+        case QImage::Format_RGB32:
+        case QImage::Format_ARGB32:
+        case QImage::Format_ARGB32_Premultiplied:
+            break;
+        default:
+            converted = source.convertToFormat(QImage::Format_RGB32);
+            break;
+    }
+    sourceImage = converted.isNull() ? source : converted;
+    resultCache->trimFilter();
+}
 
-                block[count] = qGray(imageBits[realRow + realCol]);
-                ++count;
+// Takes a new frame of the same size in which only the flagged blocks
+// differ from the current source, and loads and transforms just those.
+// The other blocks keep their coefficients and quality measurements.
+template<typename Sample>
+void BasicBlockManager<Sample>::updateBlocks(const QImage &source, const std::vector<char> &changed) {
+    takeSource(source);
+    if (qualityEnabled) {
+        for (std::size_t index = 0; index < changed.size(); ++index) {
+            if (changed[index]) {
+                blockQuality[index] = BlockQuality();
             }
         }
+    }
+
+    Profiler::Scope scope(Stage::Update, (std::uint64_t) std::count(changed.begin(), changed.end(), 1));
+    std::vector<int> changedRows;
+    for (int i = 0; i < rows; ++i) {
+        if (std::any_of(changed.begin() + i * columns, changed.begin() + (i + 1) * columns, [](char flag){ return flag != 0; })) {
+            changedRows.push_back(i);
+        }
+    }
+
+    Profiler::Section section(std::min(pool->getWorkerCount(), (int) changedRows.size()));
+    pool->parallelFor((int) changedRows.size(), [&](int index){
+        loadBlocks(changedRows[index], changed.data() + changedRows[index] * columns);
     });
 }
 
-int BlockManager::getBlockHeight(int i, int j) const {
+// Reconstructs the flagged blocks into output, an image of the output
+// format that holds the reconstruction of the previous frame. Returns false
+// when cancelled, leaving output partly updated.
+template<typename Sample>
+bool BasicBlockManager<Sample>::compressBlocks(QImage &output, const std::vector<char> &changed, const std::function<bool()> &cancelled) {
+    uchar *bits = output.bits();
+    int bytesPerLine = output.bytesPerLine();
+    std::vector<int> changedRows;
+    for (int i = 0; i < rows; ++i) {
+        if (std::any_of(changed.begin() + i * columns, changed.begin() + (i + 1) * columns, [](char flag){ return flag != 0; })) {
+            changedRows.push_back(i);
+        }
+    }
+
+    std::atomic<bool> aborted(false);
+    Profiler::Scope scope(Stage::Compress, (std::uint64_t) std::count(changed.begin(), changed.end(), 1));
+    resultCache->trimFilter();
+    Profiler::Section section(std::min(pool->getWorkerCount(), (int) changedRows.size()));
+    pool->parallelFor((int) changedRows.size(), [&](int index){
+        if (!aborted.load(std::memory_order_relaxed) && cancelled && cancelled()) {
+            aborted.store(true, std::memory_order_relaxed);
+        }
+        if (!aborted.load(std::memory_order_relaxed)) {
+            reconstructBlocks(changedRows[index], bits, bytesPerLine, changed.data() + changedRows[index] * columns);
+        }
+    });
+
+    if (aborted) {
+        return false;
+    }
+    countBlocks(changed);
+    return true;
+}
+
+// Loads and forward transforms block row i of the source.
+template<typename Sample>
+void BasicBlockManager<Sample>::loadRow(int i) {
+    std::uint64_t blockBytes = (std::uint64_t) blockSize * blockSize * sizeof(Sample);
+    std::uint64_t blockPixelBytes = (std::uint64_t) blockSize * blockSize * (sourceImage.depth() / 8);
+
+    {
+        Profiler::Scope load(Stage::Load, columns, columns * blockPixelBytes);
+        for (int j = 0; j < columns; ++j) {
+            loadBlock(i, j, sourceImage);
+        }
+    }
+
+    Profiler::Scope forward(Stage::ForwardDct, columns, columns * blockBytes);
+    int first = 0;
+    if (useBatchedPlans()) {
+        Backend::execute(selectBatchDctPlan(i), getCoefficients(i, 0));
+        first = batchColumns;
+    }
+    for (int j = first; j < columns; ++j) {
+        forwardTransform(i, j, getCoefficients(i, j));
+    }
+}
+
+// Loads and forward transforms the flagged blocks of row i. A mostly
+// changed row is cheaper through the row's batch plan.
+template<typename Sample>
+void BasicBlockManager<Sample>::loadBlocks(int i, const char *changed) {
+    int pending = (int) std::count_if(changed, changed + columns, [](char flag){ return flag != 0; });
+    if (pending == columns || (useBatchedPlans() && pending * 4 > columns * 3)) {
+        loadRow(i);
+        return;
+    }
+
+    std::uint64_t blockBytes = (std::uint64_t) blockSize * blockSize * sizeof(Sample);
+    std::uint64_t blockPixelBytes = (std::uint64_t) blockSize * blockSize * (sourceImage.depth() / 8);
+    {
+        Profiler::Scope load(Stage::Load, pending, pending * blockPixelBytes);
+        for (int j = 0; j < columns; ++j) {
+            if (changed[j]) {
+                loadBlock(i, j, sourceImage);
+            }
+        }
+    }
+
+    Profiler::Scope forward(Stage::ForwardDct, pending, pending * blockBytes);
+    for (int j = 0; j < columns; ++j) {
+        if (changed[j]) {
+            forwardTransform(i, j, getCoefficients(i, j));
+        }
+    }
+}
+
+template<typename Sample>
+int BasicBlockManager<Sample>::getBlockHeight(int i, int j) const {
     if (i == rows - 1 && imgHeight % blockSize > 0) {
         return imgHeight % blockSize;
     }
     return blockSize;
 }
 
-int BlockManager::getBlockWidth(int i, int j) const {
+template<typename Sample>
+int BasicBlockManager<Sample>::getBlockWidth(int i, int j) const {
     if (j == columns - 1 && imgWidth % blockSize > 0) {
         return imgWidth % blockSize;
     }
     return blockSize;
 }
+
+const char *precisionName(Precision precision) {
+    switch (precision) {
+        case Precision::Float:
+            return "float";
+        case Precision::Fixed:
+            return "fixed";
+        default:
+            return "double";
+    }
+}
+
+template class BasicBlockManager<double>;
+template class BasicBlockManager<float>;
+template class BasicBlockManager<std::int32_t>;
@@ -4,22 +4,78 @@
 #include <vector>
 #include <QList>
 #include <QImage>
+#include <QRect>
 #include <QRgb>
 #include <QListIterator>
 #include <iterator>
 #include <cstddef>
 #include <iostream>
 #include <thread>
+#include <functional>
+#include <cstdint>
+#include <atomic>
 #include <fftw3.h>
+#include "planCache.h"
+#include "transformBackend.h"
+#include "qualityMetrics.h"
+#include "blockResultCache.h"
 
-class BlockManager {
+class ThreadPool;
+template<typename Sample> class BlockStore;
+
+// Sample type of the whole pipeline; Double is the reference path.
+enum class Precision {
+    Double,
+    Float,
+    Fixed
+};
+
+const char *precisionName(Precision precision);
+
+template<typename Sample>
+class BasicBlockManager {
     
 public:
-    BlockManager(const QImage *image, int blockSize, int cutDimension);
-    ~BlockManager();
-    double* getBlock(int row, int column);
+    enum class TransformMode {
+        PerBlock,
+        Batched
+    };
+
+    typedef Sample SampleType;
+
+    BasicBlockManager(const QImage *image, int blockSize, int cutDimension, ThreadPool *pool = nullptr);
+    ~BasicBlockManager();
+    Sample* getBlock(int row, int column);
+    const Sample* getCoefficients(int row, int column) const;
+    double getCoefficientScale(int u, int v) const;
+    int getRowStride() const;
+    int getBlockWidth(int i, int j) const;
+    int getBlockHeight(int i, int j) const;
+    int getBlockSize() const;
+    int getCutDimension() const;
+    int getAdjustedCut(int row, int column) const;
+    ThreadPool *getThreadPool() const;
+    void reconstructBlock(int row, int column, Sample *pixels);
     void setCutDimension(int dimension);
-    QImage* compress();
+    void setThreadPool(ThreadPool *pool);
+    void setTransformMode(TransformMode mode);
+    void setFixedSizeKernels(bool enabled);
+    void setPrunedThreshold(double fraction);
+    void setOutputFormat(QImage::Format format);
+    QImage::Format getOutputFormat() const;
+    void setQualityMetrics(bool enabled);
+    bool hasQualityMetrics() const;
+    QualityMetrics getQualityMetrics() const;
+    void setResultCacheBudget(std::size_t bytes);
+    BlockCacheStats getBlockCacheStats() const;
+    void resetBlockCacheStats();
+    QImage* compress(const std::function<bool()> &cancelled = nullptr);
+    QImage compressTile(const QRect &blocks, const std::function<bool()> &cancelled = nullptr);
+    QImage compressReduced(int denominator, const QRect &blocks = QRect(), const std::function<bool()> &cancelled = nullptr);
+    // Sequence support: changed holds one flag per block, row after row.
+    void updateBlocks(const QImage &image, const std::vector<char> &changed);
+    bool compressBlocks(QImage &output, const std::vector<char> &changed, const std::function<bool()> &cancelled = nullptr);
+    std::size_t getMemoryFootprint() const;
 
 public:
     int rows;
@@ -28,28 +84,90 @@ public:
     int imgHeight;
 
     void updateImage(const QImage &image);
+    void setSource(const QImage &image);
+    void loadRow(int i);
+    void reconstructRow(int i, uchar *bits, int bytesPerLine);
 
 private:
-    int getBlockWidth(int i, int j) const;
-    int getBlockHeight(int i, int j) const;
-    fftw_plan selectDctPlan(int i, int j);
-    fftw_plan selectIdctPlan(int i, int j);
-    void cutValues(int row, int column);
-    void parallelTask(const std::function<void(int, int)> &function, bool wait = true);
-    int threadsCount;
+    typedef TransformBackend<Sample> Backend;
+    typedef typename Backend::Plan Plan;
+
+    // Lines per task when the lines of a block are split across workers.
+    static const int splitLines = 8;
+
+    Sample* getCoefficients(int row, int column);
+    const Plan &selectDctPlan(int i, int j) const;
+    const Plan &selectIdctPlan(int i, int j) const;
+    const Plan &selectBatchDctPlan(int i) const;
+    const Plan &selectBatchIdctPlan(int i) const;
+    Plan createPlan(int blockHeight, int blockWidth, int howMany, PlanCache::Kind kind);
+    Plan createBatchPlan(int blockHeight, PlanCache::Kind kind);
+    bool useFixedKernel(int i, int j) const;
+    bool useBatchedPlans() const;
+    bool usePrunedInverse(int i, int j) const;
+    void forwardTransform(int i, int j, Sample *block);
+    void inverseTransform(int i, int j, Sample *block);
+    void takeSource(const QImage &image);
+    void loadBlock(int i, int j, const QImage &image);
+    int firstPixel(int i, int j, const QImage &image) const;
+    std::uint64_t loadLine(int i, int j, int pixelRow, const QImage &image, int first, int &differs);
+    void loadBlocks(int i, const char *changed);
+    void packBlock(int i, int j, uchar *target, int bytesPerLine);
+    void packRow(int i, uchar *bits, int bytesPerLine);
+    void reconstructBlocks(int i, uchar *bits, int bytesPerLine, const char *changed);
+    void computeRow(int i, uchar *bits, int bytesPerLine, std::vector<char> &resolved, int pending);
+    void measureBlock(int i, int j, const uchar *target, int bytesPerLine);
+    bool resolveBlock(int i, int j, uchar *target, int bytesPerLine);
+    void storeBlock(int i, int j, const uchar *target, int bytesPerLine);
+    void gatherSource(int i, int j, uchar *pixels) const;
+    void writeGrayBlock(const uchar *pixels, int width, int height, uchar *target, int bytesPerLine) const;
+    void countBlocks(const QRect &blocks);
+    void countBlocks(const std::vector<char> &changed);
+    void cutValues(int row, int column, Sample *block) const;
+    void cutCorner(int row, int column, Sample *target, int height, int width, int stride) const;
+    void cutLines(int row, int column, Sample *target, int first, int count, int width, int stride) const;
+    bool useSplitBlocks() const;
+    void parallelLines(const std::vector<int> &blocks, const std::function<int(int, int)> &lines, const std::function<void(int, int, int)> &function);
+    void splitTransform(const std::vector<int> &blocks, PlanCache::Kind kind);
+    void updateSplit();
+    void compressSplit(uchar *bits, int bytesPerLine, const std::function<bool()> &isAborted);
+    void packSamples(const Sample *samples, int stride, int width, int height, double scale, uchar *target, int bytesPerLine) const;
+    void parallelTask(const std::function<void(int, int)> &function);
     int cutDimension;
-    double *values;
+    BlockStore<Sample> *values;
+    BlockStore<Sample> *coefficients;
     int blockSize;
-    std::thread** workers;
-    fftw_plan dctPlan;
-    fftw_plan idctPlan;
-    fftw_plan dctPlanLastRow;
-    fftw_plan idctPlanLastRow;
-    fftw_plan dctPlanLastColumn;
-    fftw_plan idctPlanLastColumn;
-    fftw_plan dctPlanLastElement;
-    fftw_plan idctPlanLastElement;
+    int batchColumns;
+    bool fixedKernel;
+    double prunedThreshold;
+    TransformMode transformMode;
+    QImage::Format outputFormat;
+    bool qualityEnabled;
+    std::vector<BlockQuality> blockQuality;
+    QImage sourceImage;
+    std::vector<std::uint64_t> blockHashes;
+    std::vector<std::int16_t> flatValues;
+    BlockResultCache *resultCache;
+    std::atomic<std::uint64_t> flatBlocks;
+    std::atomic<std::uint64_t> cacheableBlocks;
+    ThreadPool *pool;
+    Plan dctPlan;
+    Plan idctPlan;
+    Plan dctPlanLastRow;
+    Plan idctPlanLastRow;
+    Plan dctPlanLastColumn;
+    Plan idctPlanLastColumn;
+    Plan dctPlanLastElement;
+    Plan idctPlanLastElement;
+    Plan batchDctPlan;
+    Plan batchIdctPlan;
+    Plan batchDctPlanLastRow;
+    Plan batchIdctPlanLastRow;
 };
 
+typedef BasicBlockManager<double> BlockManager;
+typedef BasicBlockManager<float> FloatBlockManager;
+typedef BasicBlockManager<std::int32_t> FixedBlockManager;
+
 
 #endif
@@ -0,0 +1,159 @@
+#include "blockResultCache.h"
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <iterator>
+
+BlockResultCache::BlockResultCache(std::size_t byteBudget): byteBudget(0) {
+    setByteBudget(byteBudget);
+}
+
+// FNV-1a over the gray values of a block line.
+std::uint64_t BlockResultCache::hashSeed() {
+    return 14695981039346656037ULL;
+}
+
+std::uint64_t BlockResultCache::hashPixel(std::uint64_t hash, int value) {
+    return (hash ^ (std::uint64_t) value) * 1099511628211ULL;
+}
+
+std::uint64_t BlockResultCache::hashLine(std::uint64_t hash, std::uint64_t line) {
+    return (hash ^ line) * 1099511628211ULL;
+}
+
+bool BlockResultCache::isEnabled() const {
+    return byteBudget > 0;
+}
+
+void BlockResultCache::setByteBudget(std::size_t byteBudget) {
+    this->byteBudget = byteBudget;
+    if (byteBudget == 0) {
+        clear();
+        filter.reset();
+    } else if (!filter) {
+        filter.reset(new std::atomic<std::uint64_t>[filterWords]);
+        for (int word = 0; word < filterWords; ++word) {
+            filter[word].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+std::size_t BlockResultCache::getByteBudget() const {
+    return byteBudget;
+}
+
+// Two bits of one word per key: one atomic operation, and about the
+// square of the fill ratio in false positives.
+std::uint64_t BlockResultCache::filterMask(std::size_t hash) {
+    return std::uint64_t(1) << (hash % 64) | std::uint64_t(1) << ((hash >> 6) % 64);
+}
+
+bool BlockResultCache::wasSeen(const BlockResultKey &key) const {
+    std::size_t hash = BlockResultKeyHash()(key);
+    std::uint64_t mask = filterMask(hash);
+    return (filter[(hash >> 12) % filterWords].load(std::memory_order_relaxed) & mask) == mask;
+}
+
+bool BlockResultCache::markSeen(const BlockResultKey &key) {
+    std::size_t hash = BlockResultKeyHash()(key);
+    std::uint64_t mask = filterMask(hash);
+    return (filter[(hash >> 12) % filterWords].fetch_or(mask, std::memory_order_relaxed) & mask) == mask;
+}
+
+void BlockResultCache::trimFilter() {
+    if (!filter) {
+        return;
+    }
+    int count = 0;
+    for (int word = 0; word < filterWords; ++word) {
+        count += (int) std::bitset<64>(filter[word].load(std::memory_order_relaxed)).count();
+    }
+    if (count < filterWords * 64 / 4) {
+        return;
+    }
+    for (int word = 0; word < filterWords; ++word) {
+        filter[word].store(0, std::memory_order_relaxed);
+    }
+}
+
+BlockResultCache::Shard &BlockResultCache::shardOf(const BlockResultKey &key) {
+    return shards[(key.hash >> 32) % shardCount];
+}
+
+bool BlockResultCache::lookup(const BlockResultKey &key, const uchar *source, uchar *pixels) {
+    std::size_t size = (std::size_t) key.height * key.width;
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.entries.find(key);
+    if (found == shard.entries.end() || std::memcmp(found->second.data.data(), source, size) != 0) {
+        return false;
+    }
+    shard.recent.splice(shard.recent.end(), shard.recent, found->second.position);
+    std::memcpy(pixels, found->second.data.data() + size, size);
+    ++shard.hits;
+    return true;
+}
+
+// A colliding entry with other source pixels is replaced.
+void BlockResultCache::insert(const BlockResultKey &key, const uchar *source, const uchar *pixels) {
+    std::size_t size = (std::size_t) key.height * key.width;
+    std::size_t shardBudget = byteBudget / shardCount;
+    if (2 * size > shardBudget) {
+        return;
+    }
+
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.entries.find(key);
+    if (found != shard.entries.end()) {
+        shard.byteSize -= found->second.data.size();
+        shard.recent.erase(found->second.position);
+        shard.entries.erase(found);
+    }
+
+    while (!shard.recent.empty() && shard.byteSize + 2 * size > shardBudget) {
+        auto oldest = shard.entries.find(shard.recent.front());
+        shard.byteSize -= oldest->second.data.size();
+        shard.entries.erase(oldest);
+        shard.recent.pop_front();
+        ++shard.evictions;
+    }
+
+    Entry entry;
+    entry.data.resize(2 * size);
+    std::memcpy(entry.data.data(), source, size);
+    std::memcpy(entry.data.data() + size, pixels, size);
+    shard.recent.push_back(key);
+    entry.position = std::prev(shard.recent.end());
+    shard.entries[key] = std::move(entry);
+    shard.byteSize += 2 * size;
+}
+
+void BlockResultCache::clear() {
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.entries.clear();
+        shard.recent.clear();
+        shard.byteSize = 0;
+    }
+}
+
+BlockCacheStats BlockResultCache::getStats() {
+    BlockCacheStats stats;
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.hits += shard.hits;
+        stats.evictions += shard.evictions;
+        stats.entries += shard.entries.size();
+        stats.byteSize += shard.byteSize;
+    }
+    return stats;
+}
+
+void BlockResultCache::resetStats() {
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.hits = 0;
+        shard.evictions = 0;
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef BLOCK_RESULT_CACHE_H
+#define BLOCK_RESULT_CACHE_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// Content hash of a source block plus the shape and adjusted cut it is
+// reconstructed with.
+struct BlockResultKey {
+    std::uint64_t hash;
+    int height;
+    int width;
+    int cutDimension;
+
+    bool operator==(const BlockResultKey &other) const {
+        return std::tie(hash, height, width, cutDimension) == std::tie(other.hash, other.height, other.width, other.cutDimension);
+    }
+};
+
+// Mixes all key bits into the low ones, which pick buckets and filter bits.
+struct BlockResultKeyHash {
+    std::size_t operator()(const BlockResultKey &key) const {
+        std::uint64_t value = key.hash ^ ((std::uint64_t) key.height << 40 ^ (std::uint64_t) key.width << 20 ^ (std::uint64_t) key.cutDimension) * 0x9E3779B97F4A7C15ULL;
+        value = (value ^ (value >> 33)) * 0xFF51AFD7ED558CCDULL;
+        value = (value ^ (value >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+        return (std::size_t) (value ^ (value >> 33));
+    }
+};
+
+// Misses count the non-flat blocks that had to be computed.
+struct BlockCacheStats {
+    std::uint64_t flatBlocks = 0;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::size_t entries = 0;
+    std::size_t byteSize = 0;
+};
+
+// Packed gray reconstructions of blocks by content, so identical blocks
+// (repeated glyphs, UI chrome, tiled backgrounds) are transformed once.
+// Every entry keeps its source pixels and a hit requires them to match,
+// so hash collisions only cost a miss. Split into shards by hash, each
+// with its own lock and least recently used order within its share of
+// the byte budget. A budget of 0 disables the cache.
+//
+// Content is only admitted the second time it is computed: a lock-free
+// bit filter remembers what was seen once, so images without repeats pay
+// one atomic operation per block and no lookups or copies.
+class BlockResultCache {
+
+public:
+    static const int shardCount = 16;
+    static constexpr std::size_t defaultBudget = std::size_t(16) << 20;
+
+    explicit BlockResultCache(std::size_t byteBudget = 0);
+
+    static std::uint64_t hashSeed();
+    static std::uint64_t hashPixel(std::uint64_t hash, int value);
+    // Folds the hash of one pixel line into that of its block, so the lines
+    // of a block can be hashed apart.
+    static std::uint64_t hashLine(std::uint64_t hash, std::uint64_t line);
+
+    bool isEnabled() const;
+    void setByteBudget(std::size_t byteBudget);
+    std::size_t getByteBudget() const;
+    // Whether the key may be cached, i.e. was marked seen before.
+    bool wasSeen(const BlockResultKey &key) const;
+    // Marks the key seen; returns whether it already was.
+    bool markSeen(const BlockResultKey &key);
+    // Empties the filter once a quarter of it is set. Marks made meanwhile may
+    // be lost, which only delays their admission.
+    void trimFilter();
+    // source and pixels are height x width bytes without padding.
+    bool lookup(const BlockResultKey &key, const uchar *source, uchar *pixels);
+    void insert(const BlockResultKey &key, const uchar *source, const uchar *pixels);
+    void clear();
+    BlockCacheStats getStats();
+    void resetStats();
+
+private:
+    struct Entry {
+        std::vector<uchar> data;
+        std::list<BlockResultKey>::iterator position;
+    };
+
+    struct Shard {
+        std::unordered_map<BlockResultKey, Entry, BlockResultKeyHash> entries;
+        std::list<BlockResultKey> recent;
+        std::mutex mutex;
+        std::size_t byteSize = 0;
+        std::uint64_t hits = 0;
+        std::uint64_t evictions = 0;
+    };
+
+    static const int filterWords = 1 << 14;
+
+    static std::uint64_t filterMask(std::size_t hash);
+
+    Shard &shardOf(const BlockResultKey &key);
+
+    Shard shards[shardCount];
+    std::size_t byteBudget;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> filter;
+};
+
+#endif
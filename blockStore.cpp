@@ -0,0 +1,58 @@
+#include "blockStore.h"
+#include <fftw3.h>
+#include <cstdint>
+
+template<typename Sample>
+BlockStore<Sample>::BlockStore(int rows, int columns, int blockSize): rows(rows), columns(columns), rowStride(blockSize) {
+    int perLine = alignment / sizeof(Sample);
+    blockStride = (blockSize * blockSize + perLine - 1) / perLine * perLine;
+
+    // fftw_malloc only promises SIMD alignment, so round the start up to a line.
+    allocation = fftw_malloc(getByteSize() + alignment);
+    std::uintptr_t address = (std::uintptr_t) allocation;
+    data = (Sample*)((address + alignment - 1) / alignment * alignment);
+}
+
+template<typename Sample>
+BlockStore<Sample>::~BlockStore() {
+    fftw_free(allocation);
+}
+
+template<typename Sample>
+Sample *BlockStore<Sample>::block(int row, int column) {
+    return data + ((std::size_t) row * columns + column) * blockStride;
+}
+
+template<typename Sample>
+const Sample *BlockStore<Sample>::block(int row, int column) const {
+    return data + ((std::size_t) row * columns + column) * blockStride;
+}
+
+template<typename Sample>
+int BlockStore<Sample>::getRowStride() const {
+    return rowStride;
+}
+
+template<typename Sample>
+int BlockStore<Sample>::getBlockStride() const {
+    return blockStride;
+}
+
+template<typename Sample>
+int BlockStore<Sample>::getRows() const {
+    return rows;
+}
+
+template<typename Sample>
+int BlockStore<Sample>::getColumns() const {
+    return columns;
+}
+
+template<typename Sample>
+std::size_t BlockStore<Sample>::getByteSize() const {
+    return (std::size_t) rows * columns * blockStride * sizeof(Sample);
+}
+
+template class BlockStore<double>;
+template class BlockStore<float>;
+template class BlockStore<std::int32_t>;
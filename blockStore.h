@@ -0,0 +1,40 @@
+#ifndef BLOCK_STORE_H
+#define BLOCK_STORE_H
+
+#include <cstddef>
+
+// Block-major grid of blocks of samples. Every block gets a slot of
+// getBlockStride() samples that starts on a cache line, and edge blocks
+// use the full slot with the same row stride as interior ones, so a block
+// pixel (y, x) is always at block(row, column)[y * getRowStride() + x].
+// Neighbouring blocks never share a cache line, and the blocks of a block
+// row are evenly spaced for batched FFTW plans.
+template<typename Sample>
+class BlockStore {
+
+public:
+    static const int alignment = 64;
+
+    BlockStore(int rows, int columns, int blockSize);
+    ~BlockStore();
+    BlockStore(const BlockStore &) = delete;
+    BlockStore &operator=(const BlockStore &) = delete;
+
+    Sample *block(int row, int column);
+    const Sample *block(int row, int column) const;
+    int getRowStride() const;
+    int getBlockStride() const;
+    int getRows() const;
+    int getColumns() const;
+    std::size_t getByteSize() const;
+
+private:
+    int rows;
+    int columns;
+    int rowStride;
+    int blockStride;
+    void *allocation;
+    Sample *data;
+};
+
+#endif
@@ -0,0 +1,494 @@
+#include "blockManager.h"
+#include "colorBlockManager.h"
+#include "threadPool.h"
+#include "planCache.h"
+#include "jpegEncoder.h"
+#include "profiler.h"
+#include "rateSearch.h"
+#include "sequenceCompressor.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QTextStream>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Single-producer / single-consumer hand-off between pipeline stages. A
+// closed queue still drains; pop() returns false once it is empty.
+template<typename T>
+class BoundedQueue {
+
+public:
+    explicit BoundedQueue(size_t capacity): capacity(capacity), closed(false) {
+    }
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this](){ return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this](){ return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+};
+
+struct Job {
+    QString input;
+    QString output;
+    QImage image;
+    QByteArray encoded;
+    QImage thumbnail;
+    RateSearchResult search;
+    BlockCacheStats blockCache;
+};
+
+QStringList collectInputs(const QStringList &arguments) {
+    QStringList inputs;
+    for (const QString &argument : arguments) {
+        if (argument.startsWith('@')) {
+            QFile list(argument.mid(1));
+            if (!list.open(QIODevice::ReadOnly | QIODevice::Text)) {
+                std::cerr << "Cannot read list " << argument.mid(1).toStdString() << std::endl;
+                continue;
+            }
+            QTextStream stream(&list);
+            while (!stream.atEnd()) {
+                QString line = stream.readLine().trimmed();
+                if (!line.isEmpty()) {
+                    inputs << line;
+                }
+            }
+            continue;
+        }
+
+        QFileInfo info(argument);
+        if (info.isDir()) {
+            QDir directory(argument);
+            for (const QString &name : directory.entryList(QStringList() << "*.bmp" << "*.BMP", QDir::Files, QDir::Name)) {
+                inputs << directory.filePath(name);
+            }
+        } else {
+            inputs << argument;
+        }
+    }
+    return inputs;
+}
+
+// Both images are Grayscale8 reconstructions.
+double psnr(const QImage &image, const QImage &reference) {
+    double sum = 0;
+    for (int y = 0; y < image.height(); ++y) {
+        const uchar *line = image.constScanLine(y);
+        const uchar *referenceLine = reference.constScanLine(y);
+        for (int x = 0; x < image.width(); ++x) {
+            double difference = (int) line[x] - (int) referenceLine[x];
+            sum += difference * difference;
+        }
+    }
+    double mse = sum / ((double) image.width() * image.height());
+    return mse == 0 ? 99.0 : 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+// Compresses one job at the given precision. Returns the reconstruction
+// when it is written out or needed for the PSNR report. With quality set,
+// the reconstruction is also measured against the source. With a target,
+// the cut (and with several searchSizes also the block size) is searched.
+template<typename Sample>
+QImage compressJob(Job &job, int blockSize, int cutDimension, bool writeBitmap, bool keepReconstruction, int thumbnailScale, ThreadPool *pool, std::size_t &footprint, QualityMetrics *quality, const RateTarget *target, const std::vector<int> &searchSizes, std::size_t cacheBudget) {
+    if (target != nullptr && searchSizes.size() > 1) {
+        job.search = BasicRateSearch<Sample>(*target).search(job.image, searchSizes, pool);
+        blockSize = job.search.blockSize > 0 ? job.search.blockSize : blockSize;
+        cutDimension = job.search.cutDimension;
+    }
+
+    BasicBlockManager<Sample> manager(&job.image, blockSize, cutDimension, pool);
+    if (target != nullptr && searchSizes.size() <= 1) {
+        job.search = BasicRateSearch<Sample>(*target).searchCut(manager);
+    }
+    footprint = manager.getMemoryFootprint();
+    manager.setQualityMetrics(quality != nullptr);
+    manager.setResultCacheBudget(cacheBudget);
+
+    if (thumbnailScale > 1) {
+        job.thumbnail = manager.compressReduced(thumbnailScale);
+    }
+
+    QImage reconstruction;
+    if (writeBitmap || keepReconstruction || quality != nullptr) {
+        std::unique_ptr<QImage> output(manager.compress());
+        reconstruction = *output;
+    }
+    if (quality != nullptr) {
+        *quality = manager.getQualityMetrics();
+    }
+    job.blockCache = manager.getBlockCacheStats();
+
+    if (writeBitmap) {
+        job.output += ".bmp";
+    } else {
+        job.encoded = BasicJpegEncoder<Sample>(manager).encode();
+        job.output += blockSize == 8 ? ".jpg" : ".jpgc";
+    }
+    return reconstruction;
+}
+
+// Colour counterpart of compressJob() for bitmap output: Y, Cb and Cr are
+// compressed as separate planes, the chroma ones at chromaCut.
+template<typename Sample>
+QImage compressColorJob(Job &job, int blockSize, int cutDimension, int chromaCut, ChromaSubsampling subsampling, ThreadPool *pool, std::size_t &footprint) {
+    BasicColorBlockManager<Sample> manager(&job.image, blockSize, cutDimension, subsampling, pool);
+    manager.setCutDimension(BasicColorBlockManager<Sample>::BlueChroma, chromaCut);
+    manager.setCutDimension(BasicColorBlockManager<Sample>::RedChroma, chromaCut);
+    footprint = manager.getMemoryFootprint();
+
+    std::unique_ptr<QImage> output(manager.compress());
+    job.output += ".bmp";
+    return *output;
+}
+
+// Sequence counterpart of compressJob() for bitmap output: only the blocks
+// that changed from the previous frame are recompressed.
+template<typename Sample>
+QImage compressFrameJob(Job &job, BasicSequenceCompressor<Sample> &sequence, std::size_t &footprint) {
+    QImage reconstruction = sequence.compressFrame(job.image);
+    BasicBlockManager<Sample> *manager = sequence.getManager();
+    footprint = manager->getMemoryFootprint();
+    job.blockCache = manager->getBlockCacheStats();
+    manager->resetBlockCacheStats();
+    job.output += ".bmp";
+    return reconstruction;
+}
+
+QImage reconstructDouble(const QImage &image, int blockSize, int cutDimension, ThreadPool *pool) {
+    BlockManager manager(&image, blockSize, cutDimension, pool);
+    std::unique_ptr<QImage> output(manager.compress());
+    return *output;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication application(argc, argv);
+    QCoreApplication::setApplicationName("jpegc");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless batch DCT compression of bitmap images.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("inputs", "Bitmap files, directories of bitmaps, or @list files.", "inputs...");
+    QCommandLineOption blockSizeOption(QStringList() << "b" << "block-size", "Block size F.", "F", "8");
+    QCommandLineOption cutOption(QStringList() << "d" << "cut", "Cut dimension D.", "D", "4");
+    QCommandLineOption threadsOption(QStringList() << "j" << "threads", "Worker threads (0 = all cores).", "N", "0");
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Output directory.", "dir", ".");
+    QCommandLineOption wisdomOption("wisdom", "FFTW wisdom file to load and update.", "file");
+    QCommandLineOption formatOption("format", "Output format: jpeg (.jpg for 8x8 blocks, .jpgc otherwise) or bmp.", "format", "jpeg");
+    QCommandLineOption precisionOption("precision", "Sample type: double, float or fixed.", "type", "double");
+    QCommandLineOption psnrOption("report-psnr", "Also run the double pipeline and report the PSNR of the chosen precision against it.");
+    QCommandLineOption thumbnailOption("thumbnail", "Also write a <name>_thumb.bmp reconstructed at 1/S scale (2, 4 or 8).", "S");
+    QCommandLineOption targetPsnrOption("target-psnr", "Search the smallest cut reaching this PSNR against the source.", "dB");
+    QCommandLineOption targetSizeOption("target-size", "Search the best cut whose encoded stream fits in this many bytes.", "bytes");
+    QCommandLineOption searchSizesOption("search-block-sizes", "With a target, also pick the block size from this comma separated list.", "list");
+    QCommandLineOption qualityOption("quality", "Report the PSNR and SSIM of every reconstruction against its source.");
+    QCommandLineOption colorOption("color", "Compress in colour as Y/Cb/Cr planes with 444, 422 or 420 chroma (bmp output only).", "subsampling");
+    QCommandLineOption chromaCutOption("chroma-cut", "Cut dimension of the chroma planes with --color (default: D).", "D");
+    QCommandLineOption blockCacheOption("block-cache", "Share the reconstruction of identical blocks within an image through a cache of this many MB, and report flat and cached blocks.", "MB");
+    QCommandLineOption sequenceOption("sequence", "Treat the inputs as frames of one sequence and recompress only the blocks that changed from the previous frame (bmp output only).");
+    QCommandLineOption profileOption("profile", "Time every pipeline stage and write the totals as JSON.", "file");
+    parser.addOption(blockSizeOption);
+    parser.addOption(cutOption);
+    parser.addOption(threadsOption);
+    parser.addOption(outputOption);
+    parser.addOption(wisdomOption);
+    parser.addOption(formatOption);
+    parser.addOption(precisionOption);
+    parser.addOption(psnrOption);
+    parser.addOption(thumbnailOption);
+    parser.addOption(targetPsnrOption);
+    parser.addOption(targetSizeOption);
+    parser.addOption(searchSizesOption);
+    parser.addOption(qualityOption);
+    parser.addOption(colorOption);
+    parser.addOption(chromaCutOption);
+    parser.addOption(blockCacheOption);
+    parser.addOption(sequenceOption);
+    parser.addOption(profileOption);
+    parser.process(application);
+
+    int blockSize = parser.value(blockSizeOption).toInt();
+    int cutDimension = parser.value(cutOption).toInt();
+    QDir outputDirectory(parser.value(outputOption));
+    QString format = parser.value(formatOption);
+    bool writeBitmap = format == "bmp";
+    QString precisionValue = parser.value(precisionOption);
+    Precision precision = precisionValue == "float" ? Precision::Float : precisionValue == "fixed" ? Precision::Fixed : Precision::Double;
+    bool reportPsnr = parser.isSet(psnrOption);
+    bool reportQuality = parser.isSet(qualityOption);
+    int thumbnailScale = parser.isSet(thumbnailOption) ? parser.value(thumbnailOption).toInt() : 0;
+    QStringList inputs = collectInputs(parser.positionalArguments());
+    QString colorValue = parser.value(colorOption);
+    bool color = parser.isSet(colorOption);
+    ChromaSubsampling subsampling = colorValue == "444" ? ChromaSubsampling::Yuv444 : colorValue == "422" ? ChromaSubsampling::Yuv422 : ChromaSubsampling::Yuv420;
+    int chromaCut = parser.isSet(chromaCutOption) ? parser.value(chromaCutOption).toInt() : cutDimension;
+    bool reportBlockCache = parser.isSet(blockCacheOption);
+    std::size_t cacheBudget = (std::size_t) std::max(parser.value(blockCacheOption).toInt(), 0) << 20;
+    bool sequence = parser.isSet(sequenceOption);
+
+    std::unique_ptr<RateTarget> target;
+    bool targetOk = !(parser.isSet(targetPsnrOption) && parser.isSet(targetSizeOption));
+    if (parser.isSet(targetPsnrOption)) {
+        double decibels = parser.value(targetPsnrOption).toDouble(&targetOk);
+        target.reset(new RateTarget(RateTarget::psnr(decibels)));
+        targetOk = targetOk && decibels > 0;
+    } else if (parser.isSet(targetSizeOption)) {
+        qint64 budget = parser.value(targetSizeOption).toLongLong(&targetOk);
+        target.reset(new RateTarget(RateTarget::bytes(budget)));
+        targetOk = targetOk && budget > 0;
+    }
+    std::vector<int> searchSizes;
+    for (const QString &value : parser.value(searchSizesOption).split(',')) {
+        if (!value.trimmed().isEmpty()) {
+            searchSizes.push_back(value.trimmed().toInt());
+            targetOk = targetOk && searchSizes.back() >= 2;
+        }
+    }
+
+    if (blockSize < 2 || inputs.isEmpty() || (!writeBitmap && format != "jpeg") || precisionName(precision) != precisionValue
+        || (parser.isSet(thumbnailOption) && thumbnailScale != 2 && thumbnailScale != 4 && thumbnailScale != 8)
+        || !targetOk || (!searchSizes.empty() && !target)
+        || (color && ((colorValue != "444" && colorValue != "422" && colorValue != "420") || !writeBitmap || target || reportPsnr || reportQuality || thumbnailScale > 0))
+        || (sequence && (color || !writeBitmap || target || reportPsnr || reportQuality || thumbnailScale > 0))) {
+        parser.showHelp(1);
+    }
+    if (!outputDirectory.exists() && !QDir().mkpath(outputDirectory.path())) {
+        std::cerr << "Cannot create " << outputDirectory.path().toStdString() << std::endl;
+        return 1;
+    }
+    if (parser.isSet(wisdomOption)) {
+        PlanCache::instance().setWisdomFile(parser.value(wisdomOption).toStdString());
+    }
+
+    if (parser.isSet(profileOption)) {
+        Profiler::instance().setEnabled(true);
+    }
+
+    ThreadPool pool(parser.value(threadsOption).toInt());
+
+    // decode (reader thread) -> transform (this thread) -> write (writer thread),
+    // so I/O of neighbouring images overlaps the transform of the current one.
+    BoundedQueue<Job> decoded(2);
+    BoundedQueue<Job> compressed(2);
+    int failures = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread reader([&](){
+        for (const QString &input : inputs) {
+            Job job;
+            job.input = input;
+            job.output = outputDirectory.filePath(QFileInfo(input).completeBaseName());
+            if (!job.image.load(input)) {
+                std::cerr << "Cannot decode " << input.toStdString() << std::endl;
+            }
+            decoded.push(std::move(job));
+        }
+        decoded.close();
+    });
+
+    std::thread writer([&](){
+        Job job;
+        while (compressed.pop(job)) {
+            bool written;
+            if (writeBitmap) {
+                written = !job.image.isNull() && job.image.save(job.output, "BMP");
+            } else {
+                QFile file(job.output);
+                written = !job.encoded.isEmpty() && file.open(QIODevice::WriteOnly) && file.write(job.encoded) == job.encoded.size();
+            }
+            if (written && !job.thumbnail.isNull()) {
+                written = job.thumbnail.save(outputDirectory.filePath(QFileInfo(job.input).completeBaseName() + "_thumb.bmp"), "BMP");
+            }
+            if (!written) {
+                std::cerr << "Failed " << job.input.toStdString() << std::endl;
+                ++failures;
+            }
+        }
+    });
+
+    int processed = 0;
+    double megapixels = 0;
+    double footprintBytes = 0;
+    double psnrSum = 0;
+    double psnrMin = 99.0;
+    double qualityPsnrSum = 0;
+    double qualityPsnrMin = 99.0;
+    double qualitySsimSum = 0;
+    BlockCacheStats blockCache;
+    BasicSequenceCompressor<double> doubleSequence(blockSize, cutDimension, &pool);
+    BasicSequenceCompressor<float> floatSequence(blockSize, cutDimension, &pool);
+    BasicSequenceCompressor<std::int32_t> fixedSequence(blockSize, cutDimension, &pool);
+    doubleSequence.setResultCacheBudget(cacheBudget);
+    floatSequence.setResultCacheBudget(cacheBudget);
+    fixedSequence.setResultCacheBudget(cacheBudget);
+    std::uint64_t keyFrames = 0;
+    std::uint64_t changedBlocks = 0;
+    std::uint64_t frameBlocks = 0;
+    Job job;
+    while (decoded.pop(job)) {
+        if (!job.image.isNull()) {
+            int size = std::min(blockSize, std::min(job.image.width(), job.image.height()));
+            bool keepReconstruction = reportPsnr && precision != Precision::Double;
+            std::size_t footprint = 0;
+            QualityMetrics quality;
+            QualityMetrics *measured = reportQuality ? &quality : nullptr;
+            QImage reconstruction;
+            if (sequence) {
+                switch (precision) {
+                    case Precision::Float:
+                        reconstruction = compressFrameJob(job, floatSequence, footprint);
+                        keyFrames += floatSequence.wasKeyFrame();
+                        changedBlocks += floatSequence.getChangedBlocks();
+                        frameBlocks += floatSequence.getBlockCount();
+                        break;
+                    case Precision::Fixed:
+                        reconstruction = compressFrameJob(job, fixedSequence, footprint);
+                        keyFrames += fixedSequence.wasKeyFrame();
+                        changedBlocks += fixedSequence.getChangedBlocks();
+                        frameBlocks += fixedSequence.getBlockCount();
+                        break;
+                    default:
+                        reconstruction = compressFrameJob(job, doubleSequence, footprint);
+                        keyFrames += doubleSequence.wasKeyFrame();
+                        changedBlocks += doubleSequence.getChangedBlocks();
+                        frameBlocks += doubleSequence.getBlockCount();
+                        break;
+                }
+            } else if (color) {
+                switch (precision) {
+                    case Precision::Float:
+                        reconstruction = compressColorJob<float>(job, size, cutDimension, chromaCut, subsampling, &pool, footprint);
+                        break;
+                    case Precision::Fixed:
+                        reconstruction = compressColorJob<std::int32_t>(job, size, cutDimension, chromaCut, subsampling, &pool, footprint);
+                        break;
+                    default:
+                        reconstruction = compressColorJob<double>(job, size, cutDimension, chromaCut, subsampling, &pool, footprint);
+                        break;
+                }
+            } else {
+                switch (precision) {
+                    case Precision::Float:
+                        reconstruction = compressJob<float>(job, size, cutDimension, writeBitmap, keepReconstruction, thumbnailScale, &pool, footprint, measured, target.get(), searchSizes, cacheBudget);
+                        break;
+                    case Precision::Fixed:
+                        reconstruction = compressJob<std::int32_t>(job, size, cutDimension, writeBitmap, keepReconstruction, thumbnailScale, &pool, footprint, measured, target.get(), searchSizes, cacheBudget);
+                        break;
+                    default:
+                        reconstruction = compressJob<double>(job, size, cutDimension, writeBitmap, false, thumbnailScale, &pool, footprint, measured, target.get(), searchSizes, cacheBudget);
+                        break;
+                }
+            }
+
+            if (keepReconstruction) {
+                double value = psnr(reconstruction, reconstructDouble(job.image, size, cutDimension, &pool));
+                psnrSum += value;
+                psnrMin = std::min(psnrMin, value);
+            }
+
+            if (target) {
+                std::cout << QFileInfo(job.input).fileName().toStdString() << ": F=" << job.search.blockSize
+                          << " D=" << job.search.cutDimension << ", PSNR " << job.search.psnr << " dB, "
+                          << job.search.encodedSize << " bytes" << (job.search.met ? "" : " (target missed)")
+                          << ", " << job.search.fullPasses << " full passes" << std::endl;
+            }
+
+            if (reportQuality) {
+                qualityPsnrSum += quality.getPsnr();
+                qualityPsnrMin = std::min(qualityPsnrMin, quality.getPsnr());
+                qualitySsimSum += quality.getSsim();
+            }
+
+            blockCache.flatBlocks += job.blockCache.flatBlocks;
+            blockCache.hits += job.blockCache.hits;
+            blockCache.misses += job.blockCache.misses;
+
+            megapixels += job.image.width() * (double) job.image.height() / 1e6;
+            footprintBytes += footprint;
+            job.image = writeBitmap ? reconstruction : QImage();
+            ++processed;
+        }
+        compressed.push(std::move(job));
+    }
+    compressed.close();
+
+    reader.join();
+    writer.join();
+    PlanCache::instance().saveWisdom();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << processed << " images in " << seconds << " s: "
+              << processed / seconds << " images/s, "
+              << megapixels / seconds << " MP/s" << std::endl;
+    if (processed > 0) {
+        std::cout << precisionName(precision) << " block storage: "
+                  << footprintBytes / processed / 1e6 << " MB/image" << std::endl;
+    }
+    if (processed > 0 && reportPsnr && precision != Precision::Double) {
+        std::cout << "PSNR vs double: mean " << psnrSum / processed << " dB, min " << psnrMin << " dB" << std::endl;
+    }
+    if (processed > 0 && reportQuality) {
+        std::cout << "Quality vs source: PSNR mean " << qualityPsnrSum / processed << " dB, min " << qualityPsnrMin
+                  << " dB, SSIM mean " << qualitySsimSum / processed << std::endl;
+    }
+    if (processed > 0 && sequence) {
+        std::cout << "Sequence: " << keyFrames << " key frames, " << changedBlocks << " of " << frameBlocks
+                  << " blocks recompressed (" << 100.0 * changedBlocks / std::max<std::uint64_t>(frameBlocks, 1) << "%)" << std::endl;
+    }
+    if (processed > 0 && reportBlockCache) {
+        std::cout << "Blocks: " << blockCache.flatBlocks << " flat, " << blockCache.hits << " cached, "
+                  << blockCache.misses << " computed" << std::endl;
+    }
+    if (parser.isSet(profileOption)) {
+        QFile profile(parser.value(profileOption));
+        if (!profile.open(QIODevice::WriteOnly) || profile.write(QByteArray::fromStdString(Profiler::instance().toJson())) < 0) {
+            std::cerr << "Cannot write " << profile.fileName().toStdString() << std::endl;
+            ++failures;
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
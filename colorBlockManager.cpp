@@ -0,0 +1,233 @@
+#include "colorBlockManager.h"
+#include "colorConvert.h"
+#include "threadPool.h"
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace {
+
+// Full resolution Cb / Cr staging lines, two of each for 4:2:0.
+uchar *chromaScratch(int size) {
+    thread_local std::vector<uchar> scratch;
+    if ((int) scratch.size() < size) {
+        scratch.resize(size);
+    }
+    return scratch.data();
+}
+
+}
+
+const char *subsamplingName(ChromaSubsampling subsampling) {
+    switch (subsampling) {
+        case ChromaSubsampling::Yuv444:
+            return "4:4:4";
+        case ChromaSubsampling::Yuv422:
+            return "4:2:2";
+        case ChromaSubsampling::Yuv420:
+            return "4:2:0";
+    }
+    return "";
+}
+
+template<typename Sample>
+BasicColorBlockManager<Sample>::BasicColorBlockManager(const QImage *image, int blockSize, int cutDimension, ChromaSubsampling subsampling, ThreadPool *pool): imgWidth(image->width()), imgHeight(image->height()), subsampling(subsampling), pool(pool != nullptr ? pool : &ThreadPool::global()) {
+    splitPlanes(*image);
+    for (int p = 0; p < PlaneCount; ++p) {
+        planes[p] = new BasicBlockManager<Sample>(&planeImages[p], blockSize, cutDimension, this->pool);
+    }
+}
+
+template<typename Sample>
+BasicColorBlockManager<Sample>::~BasicColorBlockManager() {
+    for (int p = 0; p < PlaneCount; ++p) {
+        delete planes[p];
+    }
+}
+
+template<typename Sample>
+BasicBlockManager<Sample> &BasicColorBlockManager<Sample>::getPlane(Plane plane) {
+    return *planes[plane];
+}
+
+template<typename Sample>
+const BasicBlockManager<Sample> &BasicColorBlockManager<Sample>::getPlane(Plane plane) const {
+    return *planes[plane];
+}
+
+template<typename Sample>
+ChromaSubsampling BasicColorBlockManager<Sample>::getSubsampling() const {
+    return subsampling;
+}
+
+template<typename Sample>
+int BasicColorBlockManager<Sample>::getWidth() const {
+    return imgWidth;
+}
+
+template<typename Sample>
+int BasicColorBlockManager<Sample>::getHeight() const {
+    return imgHeight;
+}
+
+template<typename Sample>
+void BasicColorBlockManager<Sample>::setCutDimension(int dimension) {
+    for (int p = 0; p < PlaneCount; ++p) {
+        planes[p]->setCutDimension(dimension);
+    }
+}
+
+template<typename Sample>
+void BasicColorBlockManager<Sample>::setCutDimension(Plane plane, int dimension) {
+    planes[plane]->setCutDimension(dimension);
+}
+
+template<typename Sample>
+void BasicColorBlockManager<Sample>::setTransformMode(typename BasicBlockManager<Sample>::TransformMode mode) {
+    for (int p = 0; p < PlaneCount; ++p) {
+        planes[p]->setTransformMode(mode);
+    }
+}
+
+template<typename Sample>
+std::size_t BasicColorBlockManager<Sample>::getMemoryFootprint() const {
+    std::size_t bytes = 0;
+    for (int p = 0; p < PlaneCount; ++p) {
+        bytes += planes[p]->getMemoryFootprint() + planeImages[p].sizeInBytes();
+    }
+    return bytes;
+}
+
+// Runs function(plane, row) for the block rows of all planes as one
+// parallel section.
+template<typename Sample>
+void BasicColorBlockManager<Sample>::parallelRows(const std::function<void(int, int)> &function) {
+    int total = 0;
+    for (int p = 0; p < PlaneCount; ++p) {
+        total += planes[p]->rows;
+    }
+
+    Profiler::Section section(std::min(pool->getWorkerCount(), total));
+    pool->parallelFor(total, [&](int index){
+        int plane = 0;
+        while (index >= planes[plane]->rows) {
+            index -= planes[plane]->rows;
+            ++plane;
+        }
+        function(plane, index);
+    });
+}
+
+// Converts the image into the three plane images, one chroma line (and the
+// one or two luma lines it covers) per task.
+template<typename Sample>
+void BasicColorBlockManager<Sample>::splitPlanes(const QImage &source) {
+    QImage image = source.format() == QImage::Format_RGB32 || source.format() == QImage::Format_ARGB32
+            ? source : source.convertToFormat(QImage::Format_RGB32);
+    int chromaWidth = subsampling == ChromaSubsampling::Yuv444 ? imgWidth : (imgWidth + 1) / 2;
+    int chromaHeight = subsampling == ChromaSubsampling::Yuv420 ? (imgHeight + 1) / 2 : imgHeight;
+    int lumaLines = subsampling == ChromaSubsampling::Yuv420 ? 2 : 1;
+
+    planeImages[Luma] = QImage(imgWidth, imgHeight, QImage::Format_Grayscale8);
+    planeImages[BlueChroma] = QImage(chromaWidth, chromaHeight, QImage::Format_Grayscale8);
+    planeImages[RedChroma] = QImage(chromaWidth, chromaHeight, QImage::Format_Grayscale8);
+
+    const uchar *bits = image.constBits();
+    int bytesPerLine = image.bytesPerLine();
+    uchar *lumaBits = planeImages[Luma].bits();
+    uchar *blueBits = planeImages[BlueChroma].bits();
+    uchar *redBits = planeImages[RedChroma].bits();
+    int lumaStride = planeImages[Luma].bytesPerLine();
+    int chromaStride = planeImages[BlueChroma].bytesPerLine();
+
+    Profiler::Section section(std::min(pool->getWorkerCount(), chromaHeight));
+    pool->parallelFor(chromaHeight, [&](int r){
+        Profiler::Scope load(Stage::Load, 0, (std::uint64_t) lumaLines * imgWidth * 4);
+        uchar *blue = blueBits + (std::size_t) r * chromaStride;
+        uchar *red = redBits + (std::size_t) r * chromaStride;
+        if (subsampling == ChromaSubsampling::Yuv444) {
+            rgbToYcbcrLine((const QRgb*)(bits + (std::size_t) r * bytesPerLine), imgWidth, lumaBits + (std::size_t) r * lumaStride, blue, red);
+            return;
+        }
+
+        uchar *scratch = chromaScratch(4 * imgWidth);
+        uchar *lines[2][2] = {{scratch, scratch + imgWidth}, {scratch + 2 * imgWidth, scratch + 3 * imgWidth}};
+        int count = 0;
+        for (int y = r * lumaLines; y < std::min((r + 1) * lumaLines, imgHeight); ++y, ++count) {
+            rgbToYcbcrLine((const QRgb*)(bits + (std::size_t) y * bytesPerLine), imgWidth, lumaBits + (std::size_t) y * lumaStride, lines[count][0], lines[count][1]);
+        }
+        for (int c = 0; c < 2; ++c) {
+            uchar *out = c == 0 ? blue : red;
+            if (count == 2) {
+                halveLines(lines[0][c], lines[1][c], imgWidth, out);
+            } else {
+                halveLine(lines[0][c], imgWidth, out);
+            }
+        }
+    });
+}
+
+// Splits the new image and transforms the block rows of all planes
+// together.
+template<typename Sample>
+void BasicColorBlockManager<Sample>::updateImage(const QImage &image) {
+    Profiler::Scope scope(Stage::Update);
+    splitPlanes(image);
+    for (int p = 0; p < PlaneCount; ++p) {
+        planes[p]->setSource(planeImages[p]);
+    }
+    parallelRows([&](int plane, int row){
+        planes[plane]->loadRow(row);
+    });
+}
+
+template<typename Sample>
+QImage* BasicColorBlockManager<Sample>::compress(const std::function<bool()> &cancelled) {
+    std::atomic<bool> aborted(false);
+    auto isAborted = [&](){
+        if (!aborted.load(std::memory_order_relaxed) && cancelled && cancelled()) {
+            aborted.store(true, std::memory_order_relaxed);
+        }
+        return aborted.load(std::memory_order_relaxed);
+    };
+
+    Profiler::Scope scope(Stage::Compress);
+    QImage reconstructed[PlaneCount];
+    uchar *planeBits[PlaneCount];
+    for (int p = 0; p < PlaneCount; ++p) {
+        planes[p]->setOutputFormat(QImage::Format_Grayscale8);
+        reconstructed[p] = QImage(planeImages[p].width(), planeImages[p].height(), QImage::Format_Grayscale8);
+        planeBits[p] = reconstructed[p].bits();
+    }
+
+    parallelRows([&](int plane, int row){
+        if (!isAborted()) {
+            planes[plane]->reconstructRow(row, planeBits[plane], reconstructed[plane].bytesPerLine());
+        }
+    });
+    if (aborted) {
+        return nullptr;
+    }
+
+    auto *out = new QImage(imgWidth, imgHeight, QImage::Format_RGB32);
+    uchar *bits = out->bits();
+    int bytesPerLine = out->bytesPerLine();
+    int lumaStride = reconstructed[Luma].bytesPerLine();
+    int chromaStride = reconstructed[BlueChroma].bytesPerLine();
+    int verticalShift = subsampling == ChromaSubsampling::Yuv420 ? 1 : 0;
+    int horizontalShift = subsampling == ChromaSubsampling::Yuv444 ? 0 : 1;
+
+    Profiler::Section section(std::min(pool->getWorkerCount(), imgHeight));
+    pool->parallelFor(imgHeight, [&](int y){
+        Profiler::Scope pack(Stage::Pack, 0, (std::uint64_t) imgWidth * 4);
+        const uchar *blue = planeBits[BlueChroma] + (std::size_t)(y >> verticalShift) * chromaStride;
+        const uchar *red = planeBits[RedChroma] + (std::size_t)(y >> verticalShift) * chromaStride;
+        ycbcrToRgbLine(planeBits[Luma] + (std::size_t) y * lumaStride, blue, red, imgWidth, (QRgb*)(bits + (std::size_t) y * bytesPerLine), horizontalShift);
+    });
+    return out;
+}
+
+template class BasicColorBlockManager<double>;
+template class BasicColorBlockManager<float>;
+template class BasicColorBlockManager<std::int32_t>;
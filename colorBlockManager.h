@@ -0,0 +1,67 @@
+#ifndef COLOR_BLOCK_MANAGER_H
+#define COLOR_BLOCK_MANAGER_H
+
+#include <QImage>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include "blockManager.h"
+
+class ThreadPool;
+
+enum class ChromaSubsampling {
+    Yuv444,
+    Yuv422,
+    Yuv420
+};
+
+const char *subsamplingName(ChromaSubsampling subsampling);
+
+// Colour pipeline: the image is split into planar Y, Cb and Cr images,
+// with Cb and Cr halved horizontally (4:2:2) or in both directions (4:2:0),
+// and every plane is compressed by its own BasicBlockManager with its own
+// plans and cut dimension. The rows of all three planes are scheduled in
+// one parallel section, so the workers never wait on a plane boundary.
+// With 4:2:0 the chroma planes add half a gray image of work.
+template<typename Sample>
+class BasicColorBlockManager {
+
+public:
+    enum Plane {
+        Luma,
+        BlueChroma,
+        RedChroma,
+        PlaneCount
+    };
+
+    BasicColorBlockManager(const QImage *image, int blockSize, int cutDimension, ChromaSubsampling subsampling = ChromaSubsampling::Yuv420, ThreadPool *pool = nullptr);
+    ~BasicColorBlockManager();
+
+    BasicBlockManager<Sample> &getPlane(Plane plane);
+    const BasicBlockManager<Sample> &getPlane(Plane plane) const;
+    ChromaSubsampling getSubsampling() const;
+    int getWidth() const;
+    int getHeight() const;
+    // Sets the cut of all planes; the second form only one of them.
+    void setCutDimension(int dimension);
+    void setCutDimension(Plane plane, int dimension);
+    void setTransformMode(typename BasicBlockManager<Sample>::TransformMode mode);
+    void updateImage(const QImage &image);
+    // RGB32 reconstruction of all planes.
+    QImage* compress(const std::function<bool()> &cancelled = nullptr);
+    std::size_t getMemoryFootprint() const;
+
+private:
+    void splitPlanes(const QImage &image);
+    void parallelRows(const std::function<void(int, int)> &function);
+    int imgWidth;
+    int imgHeight;
+    ChromaSubsampling subsampling;
+    ThreadPool *pool;
+    QImage planeImages[PlaneCount];
+    BasicBlockManager<Sample> *planes[PlaneCount];
+};
+
+typedef BasicColorBlockManager<double> ColorBlockManager;
+
+#endif
@@ -0,0 +1,133 @@
+#include "colorConvert.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+inline uchar clampByte(float value) {
+    return (uchar) std::min(std::max(std::lrint(value), 0L), 255L);
+}
+
+#if defined(__SSE2__)
+
+// Four rounded floats to four saturated bytes.
+inline void storeBytes(__m128 values, uchar *out) {
+    __m128i lanes = _mm_cvtps_epi32(values);
+    __m128i words = _mm_packs_epi32(lanes, lanes);
+    std::int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+    std::memcpy(out, &bytes, sizeof(bytes));
+}
+
+inline __m128 loadBytes(const uchar *in) {
+    std::int32_t bytes;
+    std::memcpy(&bytes, in, sizeof(bytes));
+    __m128i zero = _mm_setzero_si128();
+    __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+// Two bytes, each repeated, as four floats.
+inline __m128 loadPairs(const uchar *in) {
+    std::uint16_t bytes;
+    std::memcpy(&bytes, in, sizeof(bytes));
+    __m128i zero = _mm_setzero_si128();
+    __m128i pairs = _mm_cvtsi32_si128(bytes);
+    __m128i words = _mm_unpacklo_epi8(_mm_unpacklo_epi8(pairs, pairs), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+#endif
+
+}
+
+void rgbToYcbcrLine(const QRgb *pixels, int count, uchar *y, uchar *cb, uchar *cr) {
+    int x = 0;
+#if defined(__SSE2__)
+    __m128i mask = _mm_set1_epi32(0xFF);
+    __m128 offset = _mm_set1_ps(128.0f);
+    for (; x + 4 <= count; x += 4) {
+        __m128i rgb = _mm_loadu_si128((const __m128i*)(pixels + x));
+        __m128 r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(rgb, 16), mask));
+        __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(rgb, 8), mask));
+        __m128 b = _mm_cvtepi32_ps(_mm_and_si128(rgb, mask));
+
+        __m128 luma = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(0.299f)), _mm_mul_ps(g, _mm_set1_ps(0.587f))),
+                                 _mm_mul_ps(b, _mm_set1_ps(0.114f)));
+        __m128 blue = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(-0.168736f)), _mm_mul_ps(g, _mm_set1_ps(-0.331264f))),
+                                 _mm_add_ps(_mm_mul_ps(b, _mm_set1_ps(0.5f)), offset));
+        __m128 red = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, _mm_set1_ps(0.5f)), _mm_mul_ps(g, _mm_set1_ps(-0.418688f))),
+                                _mm_add_ps(_mm_mul_ps(b, _mm_set1_ps(-0.081312f)), offset));
+        storeBytes(luma, y + x);
+        storeBytes(blue, cb + x);
+        storeBytes(red, cr + x);
+    }
+#endif
+    for (; x < count; ++x) {
+        float r = qRed(pixels[x]);
+        float g = qGreen(pixels[x]);
+        float b = qBlue(pixels[x]);
+        y[x] = clampByte((r * 0.299f + g * 0.587f) + b * 0.114f);
+        cb[x] = clampByte((r * -0.168736f + g * -0.331264f) + (b * 0.5f + 128.0f));
+        cr[x] = clampByte((r * 0.5f + g * -0.418688f) + (b * -0.081312f + 128.0f));
+    }
+}
+
+void ycbcrToRgbLine(const uchar *y, const uchar *cb, const uchar *cr, int count, QRgb *out, int chromaShift) {
+    int x = 0;
+#if defined(__SSE2__)
+    __m128 offset = _mm_set1_ps(128.0f);
+    __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+    for (; x + 4 <= count; x += 4) {
+        __m128 luma = loadBytes(y + x);
+        __m128 blue = _mm_sub_ps(chromaShift == 0 ? loadBytes(cb + x) : loadPairs(cb + x / 2), offset);
+        __m128 red = _mm_sub_ps(chromaShift == 0 ? loadBytes(cr + x) : loadPairs(cr + x / 2), offset);
+
+        __m128 r = _mm_add_ps(luma, _mm_mul_ps(red, _mm_set1_ps(1.402f)));
+        __m128 g = _mm_add_ps(luma, _mm_add_ps(_mm_mul_ps(blue, _mm_set1_ps(-0.344136f)), _mm_mul_ps(red, _mm_set1_ps(-0.714136f))));
+        __m128 b = _mm_add_ps(luma, _mm_mul_ps(blue, _mm_set1_ps(1.772f)));
+
+        // Saturate every channel to a byte, then interleave as 0xAARRGGBB.
+        __m128i zero = _mm_setzero_si128();
+        __m128i rb = _mm_packus_epi16(_mm_packs_epi32(_mm_cvtps_epi32(b), _mm_cvtps_epi32(r)), zero);
+        __m128i gg = _mm_packus_epi16(_mm_packs_epi32(_mm_cvtps_epi32(g), zero), zero);
+        __m128i bg = _mm_unpacklo_epi8(rb, gg);
+        __m128i ra = _mm_unpacklo_epi8(_mm_srli_si128(rb, 4), zero);
+        __m128i pixels = _mm_or_si128(_mm_unpacklo_epi16(bg, ra), alpha);
+        _mm_storeu_si128((__m128i*)(out + x), pixels);
+    }
+#endif
+    for (; x < count; ++x) {
+        float luma = y[x];
+        float blue = cb[x >> chromaShift] - 128.0f;
+        float red = cr[x >> chromaShift] - 128.0f;
+        out[x] = qRgb(clampByte(luma + red * 1.402f),
+                      clampByte(luma + (blue * -0.344136f + red * -0.714136f)),
+                      clampByte(luma + blue * 1.772f));
+    }
+}
+
+void halveLine(const uchar *line, int count, uchar *out) {
+    int half = count / 2;
+    for (int x = 0; x < half; ++x) {
+        out[x] = (uchar) ((line[2 * x] + line[2 * x + 1] + 1) >> 1);
+    }
+    if (count % 2 != 0) {
+        out[half] = line[count - 1];
+    }
+}
+
+void halveLines(const uchar *first, const uchar *second, int count, uchar *out) {
+    int half = count / 2;
+    for (int x = 0; x < half; ++x) {
+        out[x] = (uchar) ((first[2 * x] + first[2 * x + 1] + second[2 * x] + second[2 * x + 1] + 2) >> 2);
+    }
+    if (count % 2 != 0) {
+        out[half] = (uchar) ((first[count - 1] + second[count - 1] + 1) >> 1);
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef COLOR_CONVERT_H
+#define COLOR_CONVERT_H
+
+#include <QRgb>
+
+// Full range BT.601 (JFIF) conversion between RGB32 lines and planar
+// Y / Cb / Cr lines. Runs four pixels per step with SSE2 where available.
+void rgbToYcbcrLine(const QRgb *pixels, int count, uchar *y, uchar *cb, uchar *cr);
+// With chromaShift 1 the chroma lines hold one sample per two pixels and
+// are doubled on the fly.
+void ycbcrToRgbLine(const uchar *y, const uchar *cb, const uchar *cr, int count, QRgb *out, int chromaShift = 0);
+
+// Halves a chroma line horizontally, rounding; an odd last pixel is kept.
+void halveLine(const uchar *line, int count, uchar *out);
+// Same, averaging two lines (2x2 boxes).
+void halveLines(const uchar *first, const uchar *second, int count, uchar *out);
+
+#endif
@@ -1,8 +1,20 @@
 #include <iostream>
 #include <fftw3.h>
 #include "timer.h"
+#include "../dct2d.h"
+#include "../blockManager.h"
+#include "../jpegEncoder.h"
+#include "../jpegDecoder.h"
+#include "../sequenceCompressor.h"
+#include "../qualityMetrics.h"
+#include "../rateSearch.h"
+#include "../colorBlockManager.h"
+#include "../colorConvert.h"
+#include "../threadPool.h"
 #include <fstream>
+#include <memory>
 #include <cmath>
+#include <cstring>
 #include <vector>
 #include <cassert>
 
@@ -105,50 +117,87 @@ void fastDCT(int N, double *in, double *out) {
 }
 
 void test();
-void compare();
+void testFixedDct();
+void testJpegRoundTrip();
+void testLargeBlockStream();
+void testBlockCache();
+void testSequence();
+void testReducedOutput();
+void testPrunedInverse();
+void testQualityMetrics();
+void testRateSearch();
+void testColorPipeline();
+void testSplitBlocks();
+void compareBatched();
 void testIDCT();
 
 int main() {
     test();
-    compare();
+    testFixedDct();
+    testJpegRoundTrip();
+    testLargeBlockStream();
+    testBlockCache();
+    testSequence();
+    testReducedOutput();
+    testPrunedInverse();
+    testQualityMetrics();
+    testRateSearch();
+    testColorPipeline();
+    testSplitBlocks();
+    compareBatched();
 
     return 0;
 }
 
 
-void compare() {
-    std::vector<int> dim;
-    std::vector<double> timeSlow;
-    std::vector<double> timeFast;
+// BlockManager with one plan execution per block against one
+// plan_many_r2r call per block row, on the same image. Both modes must
+// reconstruct the same pixels; only the time may differ.
+void compareBatched() {
+    const int width = 4096;
+    const int height = 4096;
+    const int repetitions = 5;
 
-    Timer timer;
-    for (int N = 10; N <= 1500; N += 100) {
-        double * out = new double[N * N];
-        double *in = new double[N * N];
-        for (int i = 0; i < N * N; ++i) {
-            in[i] = random() * 100;
-        }
-
-        timer.tic();
-        fastDCT2(N, N, in, out);
-        timer.toc();
+    std::ofstream file("batched_results.csv");
+    file << "blockSize,perBlock,batched\n";
 
+    QImage image(width, height, QImage::Format_Grayscale8);
+    for (int y = 0; y < height; ++y) {
+        uchar *line = image.scanLine(y);
+        for (int x = 0; x < width; ++x) {
+            line[x] = random() % 256;
+        }
+    }
 
-        std::cout << "Fast. N = " << N <<  ". Elapsed " << timer.elapsedMilliseconds() << " ms" << std::endl;
-        timeFast.push_back(timer.elapsedMilliseconds());
-        timer.tic();
-        dct2(N, N, in, out);
-        timer.toc();
-        std::cout << "Classic. N = " << N <<  ". Elapsed " << timer.elapsedMilliseconds() << " ms" << std::endl;
-        timeSlow.push_back(timer.elapsedMilliseconds());
-        dim.push_back(N);
-
+    std::cout << "\n\n---- Compare per-block and batched BlockManager transforms ---- " << std::endl;
+    Timer timer;
+    for (int blockSize : {8, 16, 32}) {
+        BlockManager manager(&image, blockSize, blockSize);
+        // The fixed 8x8 and 16x16 kernels never use the FFTW plans.
+        manager.setFixedSizeKernels(false);
+
+        BlockManager::TransformMode modes[2] = {BlockManager::TransformMode::PerBlock, BlockManager::TransformMode::Batched};
+        std::unique_ptr<QImage> outputs[2];
+        double times[2] = {0, 0};
+        for (int mode = 0; mode < 2; ++mode) {
+            manager.setTransformMode(modes[mode]);
+            for (int repetition = 0; repetition < repetitions; ++repetition) {
+                timer.tic();
+                manager.updateImage(image);
+                outputs[mode].reset(manager.compress());
+                timer.toc();
+                times[mode] += timer.elapsedMilliseconds() / repetitions;
+            }
+        }
 
-        std::ofstream file("results.csv");
-        file << "N,fast,slow\n";
-        for (int i = 0; i < dim.size(); ++i) {
-            file << dim[i] << "," << timeFast[i] << "," << timeSlow[i] << "\n";
+        assert(outputs[0]->size() == outputs[1]->size());
+        for (int y = 0; y < height; ++y) {
+            assert(std::memcmp(outputs[0]->constScanLine(y), outputs[1]->constScanLine(y), width) == 0);
         }
+
+        std::cout << "Block " << blockSize << "x" << blockSize << ". Per block " << times[0]
+                  << " ms, batched " << times[1] << " ms, identical output" << std::endl;
+        file << blockSize << "," << times[0] << "," << times[1] << "\n";
     }
 }
 
@@ -245,4 +294,649 @@ void test() {
         assert(std::abs(outArr2[i] - arrTest[i]) < epsilon);
     }
     std::cout << "passed" << std::endl;
-}
\ No newline at end of file
+}
+
+template<int N>
+void checkFixedDct(double epsilon) {
+    double in[N * N];
+    double expected[N * N];
+    double actual[N * N];
+
+    // FFTW_ESTIMATE leaves the arrays alone while planning.
+    fftw_plan dctPlan = fftw_plan_r2r_2d(N, N, expected, expected, FFTW_REDFT10, FFTW_REDFT10, FFTW_ESTIMATE);
+    fftw_plan idctPlan = fftw_plan_r2r_2d(N, N, expected, expected, FFTW_REDFT01, FFTW_REDFT01, FFTW_ESTIMATE);
+
+    for (int i = 0; i < N * N; ++i) {
+        in[i] = random() % 256;
+        expected[i] = in[i];
+        actual[i] = in[i];
+    }
+
+    fftw_execute(dctPlan);
+    Dct2D<N>::forward(actual);
+    for (int i = 0; i < N * N; ++i) {
+        assert(std::abs(actual[i] - expected[i]) / (4 * N * N) < epsilon);
+    }
+
+    fftw_execute(idctPlan);
+    Dct2D<N>::inverse(actual);
+    for (int i = 0; i < N * N; ++i) {
+        assert(std::abs(actual[i] - expected[i]) / (4 * N * N) < epsilon);
+        assert(std::abs(actual[i] / (4 * N * N) - in[i]) < epsilon);
+    }
+
+    fftw_destroy_plan(dctPlan);
+    fftw_destroy_plan(idctPlan);
+}
+
+void testFixedDct() {
+    double epsilon = 1e-12;
+
+    std::cout << "\n\n---- Test fixed-size Dct2D kernels ---- " << std::endl;
+    for (DctIsa isa : {DctIsa::Scalar, DctIsa::Sse2, DctIsa::Avx2}) {
+        if (!setDctIsa(isa)) {
+            continue;
+        }
+
+        std::cout << "   - " << dctIsaName(isa) << " 8x8 and 16x16 match FFTW: " << std::flush;
+        checkFixedDct<8>(epsilon);
+        checkFixedDct<16>(epsilon);
+        std::cout << "passed" << std::endl;
+    }
+}
+
+bool hasMarker(const QByteArray &data, std::uint8_t marker) {
+    const uchar *bytes = (const uchar*) data.constData();
+    for (int i = 0; i + 1 < data.size(); ++i) {
+        if (bytes[i] == 0xFF && bytes[i + 1] == marker) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Streams written from a BlockManager decode back to what compress()
+// reconstructs, in full and for a region. 8x8 blocks give baseline JFIF,
+// every other size the private SOF plus the JPGC APP11 segment.
+void testJpegRoundTrip() {
+    std::cout << "\n\n---- Test JpegEncoder / JpegDecoder round trip ---- " << std::endl;
+    int configurations[][4] = {{203, 117, 8, 3}, {64, 64, 8, 15}, {100, 70, 12, 12}, {33, 47, 16, 9}, {19, 29, 5, 3}};
+    for (auto &configuration : configurations) {
+        int width = configuration[0];
+        int height = configuration[1];
+        int blockSize = configuration[2];
+        int cutDimension = configuration[3];
+        std::cout << "   - " << width << "x" << height << ", " << blockSize << "x" << blockSize << " blocks, cut " << cutDimension << ": " << std::flush;
+
+        QImage image(width, height, QImage::Format_Grayscale8);
+        for (int y = 0; y < height; ++y) {
+            uchar *line = image.scanLine(y);
+            for (int x = 0; x < width; ++x) {
+                line[x] = (uchar)(128 + 100 * std::sin(x * 0.1) * std::cos(y * 0.13) + (x * y) % 17);
+            }
+        }
+
+        BlockManager manager(&image, blockSize, cutDimension);
+        std::unique_ptr<QImage> compressed(manager.compress());
+        QByteArray data = JpegEncoder(manager).encode();
+        bool baseline = blockSize == jpeg::baselineBlockSize;
+        assert(hasMarker(data, baseline ? jpeg::SOF0 : jpeg::SOF_PRIVATE));
+        assert(hasMarker(data, jpeg::APP11) != baseline);
+
+        JpegDecoder decoder(data);
+        assert(decoder.isValid() && decoder.getBlockSize() == blockSize);
+        assert(decoder.getWidth() == width && decoder.getHeight() == height);
+        QImage decoded = decoder.decode();
+        assert(decoded.size() == compressed->size());
+
+        // Full blocks only differ by the rounding of their coefficients;
+        // edge blocks are padded and transformed again, so only on average.
+        int fullWidth = width / blockSize * blockSize;
+        int fullHeight = height / blockSize * blockSize;
+        double totalError = 0;
+        for (int y = 0; y < height; ++y) {
+            const uchar *expected = compressed->constScanLine(y);
+            const uchar *actual = decoded.constScanLine(y);
+            for (int x = 0; x < width; ++x) {
+                int error = std::abs(actual[x] - expected[x]);
+                assert(error <= 1 || x >= fullWidth || y >= fullHeight);
+                totalError += error;
+            }
+        }
+        assert(totalError / (width * height) < 0.5);
+
+        QRect region(width / 3, height / 4, width / 2, height / 2);
+        QImage part = decoder.decode(region);
+        assert(part.size() == region.size());
+        for (int y = 0; y < region.height(); ++y) {
+            assert(std::memcmp(part.constScanLine(y), decoded.constScanLine(region.top() + y) + region.left(), region.width()) == 0);
+        }
+        std::cout << "passed" << std::endl;
+    }
+}
+
+// A black and a white block carry the largest DC terms a block size can
+// have, so any clipping of the stream's coefficients shows up on them.
+void testLargeBlockStream() {
+    std::cout << "\n\n---- Test stream round trip at large block sizes ---- " << std::endl;
+    for (int blockSize : {128, 256}) {
+        std::cout << "   - " << blockSize << "x" << blockSize << " blocks decode to compress(): " << std::flush;
+
+        int width = 2 * blockSize + 37;
+        int height = blockSize + 19;
+        QImage image(width, height, QImage::Format_Grayscale8);
+        for (int y = 0; y < height; ++y) {
+            uchar *line = image.scanLine(y);
+            for (int x = 0; x < width; ++x) {
+                line[x] = x < blockSize ? 0 : x < 2 * blockSize ? 255 : (x * 7 + y * 3) % 256;
+            }
+        }
+
+        BlockManager manager(&image, blockSize, 2 * blockSize - 1);
+        std::unique_ptr<QImage> compressed(manager.compress());
+        JpegEncoder encoder(manager);
+        JpegDecoder decoder(encoder.encode());
+        assert(decoder.isValid() && decoder.getBlockSize() == blockSize);
+        QImage decoded = decoder.decode();
+        assert(decoded.size() == compressed->size());
+
+        double totalError = 0;
+        for (int y = 0; y < height; ++y) {
+            const uchar *expected = compressed->constScanLine(y);
+            const uchar *actual = decoded.constScanLine(y);
+            for (int x = 0; x < width; ++x) {
+                int error = std::abs(actual[x] - expected[x]);
+                if (x < 2 * blockSize && y < blockSize) {
+                    assert(error <= 1);
+                }
+                totalError += error;
+            }
+        }
+        // Elsewhere only the quantizer step, raised for the largest blocks, adds error.
+        assert(totalError / (width * height) <= 0.5 * encoder.getQuantizerStep());
+        std::cout << "passed (step " << encoder.getQuantizerStep() << ")" << std::endl;
+    }
+}
+
+// The flat-block shortcut and the content cache must not change a pixel:
+// a cached manager compressed twice, the second pass served from the
+// cache, against one with the cache off. Flat blocks keep their value.
+template<typename Sample>
+void checkBlockCache(const QImage &image, int blockSize, int cutDimension) {
+    BasicBlockManager<Sample> uncached(&image, blockSize, cutDimension);
+    BasicBlockManager<Sample> cached(&image, blockSize, cutDimension);
+    cached.setResultCacheBudget(BlockResultCache::defaultBudget);
+
+    std::unique_ptr<QImage> expected(uncached.compress());
+    std::unique_ptr<QImage> first(cached.compress());
+    std::unique_ptr<QImage> second(cached.compress());
+    for (int y = 0; y < image.height(); ++y) {
+        assert(std::memcmp(first->constScanLine(y), expected->constScanLine(y), image.width()) == 0);
+        assert(std::memcmp(second->constScanLine(y), expected->constScanLine(y), image.width()) == 0);
+    }
+
+    int flatRows = 40 / blockSize * blockSize;
+    for (int y = 0; y < flatRows; ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            assert(expected->constScanLine(y)[x] == image.constScanLine(y)[x]);
+        }
+    }
+
+    BlockCacheStats stats = cached.getBlockCacheStats();
+    assert(stats.flatBlocks > 0 && stats.hits > 0);
+}
+
+void testBlockCache() {
+    const int width = 203;
+    const int height = 131;
+
+    // A flat band, repeated glyphs and a texture that never repeats.
+    QImage image(width, height, QImage::Format_Grayscale8);
+    for (int y = 0; y < height; ++y) {
+        uchar *line = image.scanLine(y);
+        for (int x = 0; x < width; ++x) {
+            if (y < 40) {
+                line[x] = 240;
+            } else if (y < 90) {
+                line[x] = x % 16 < 10 && y % 13 < 8 && (x / 16 + x % 16) % 3 != 0 ? 30 : 220;
+            } else {
+                line[x] = (x * 7 + y * y) % 256;
+            }
+        }
+    }
+
+    std::cout << "\n\n---- Test flat blocks and the block result cache ---- " << std::endl;
+    for (int blockSize : {8, 13}) {
+        std::cout << "   - " << blockSize << "x" << blockSize << " blocks match the uncached output: " << std::flush;
+        checkBlockCache<double>(image, blockSize, blockSize / 2);
+        checkBlockCache<float>(image, blockSize, blockSize / 2);
+        checkBlockCache<std::int32_t>(image, blockSize, blockSize / 2);
+        std::cout << "passed" << std::endl;
+    }
+}
+
+void paintRect(QImage &image, const QRect &rect, int value) {
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            if (image.format() == QImage::Format_Grayscale8) {
+                image.scanLine(y)[x] = (uchar)(value + x + y);
+            } else {
+                ((QRgb*) image.scanLine(y))[x] = qRgb((value + x) & 255, (value + y) & 255, value & 255);
+            }
+        }
+    }
+}
+
+// Every frame of a sequence must come out exactly as a full compress() of
+// that frame, whether only some blocks, only edge blocks or nothing
+// changed, and across a same-size frame in another pixel format.
+void testSequence() {
+    const int width = 203;
+    const int height = 131;
+
+    std::cout << "\n\n---- Test SequenceCompressor against full compression ---- " << std::endl;
+    for (int blockSize : {8, 13}) {
+        std::cout << "   - " << blockSize << "x" << blockSize << " blocks: " << std::flush;
+        int cutDimension = blockSize / 2;
+        SequenceCompressor sequence(blockSize, cutDimension);
+
+        auto check = [&](const QImage &frame, bool keyFrame) {
+            QImage output = sequence.compressFrame(frame);
+            BlockManager manager(&frame, blockSize, cutDimension);
+            std::unique_ptr<QImage> expected(manager.compress());
+            assert(sequence.wasKeyFrame() == keyFrame);
+            assert(output.size() == expected->size() && output.format() == expected->format());
+            for (int y = 0; y < height; ++y) {
+                assert(std::memcmp(output.constScanLine(y), expected->constScanLine(y), width) == 0);
+            }
+        };
+
+        QImage frame(width, height, QImage::Format_Grayscale8);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                frame.scanLine(y)[x] = (uchar)(128 + 60 * std::sin(x * 0.031 + y * 0.017)) ^ (x * y & 7);
+            }
+        }
+        check(frame, true);
+        int rows = (height + blockSize - 1) / blockSize;
+
+        paintRect(frame, QRect(30, 20, 25, 17), 40);
+        check(frame, false);
+        assert(sequence.getChangedBlocks() > 0 && sequence.getChangedBlocks() < sequence.getBlockCount());
+
+        check(frame, false);
+        assert(sequence.getChangedBlocks() == 0);
+
+        // The last, partial row and column of blocks.
+        paintRect(frame, QRect(width - 1, height - 1, 1, 1), 90);
+        check(frame, false);
+        assert(sequence.getChangedBlocks() == 1);
+        paintRect(frame, QRect(width - 2, 0, 2, height), 150);
+        check(frame, false);
+        assert(sequence.getChangedBlocks() == rows);
+
+        frame = frame.convertToFormat(QImage::Format_RGB32);
+        check(frame, true);
+        paintRect(frame, QRect(100, 60, 40, 50), 200);
+        check(frame, false);
+        assert(sequence.getChangedBlocks() > 0 && sequence.getChangedBlocks() < sequence.getBlockCount());
+        std::cout << "passed" << std::endl;
+    }
+}
+
+// compressReduced(d) against a d x d box filter of compress(), with
+// ragged last blocks, for block sizes d divides (reduced inverse
+// transforms) and ones it does not (box filtered fallback).
+void testReducedOutput() {
+    int configurations[][3] = {{203, 117, 8}, {100, 70, 16}, {61, 37, 12}, {50, 41, 10}};
+
+    std::cout << "\n\n---- Test reduced-size reconstruction ---- " << std::endl;
+    for (auto &configuration : configurations) {
+        int width = configuration[0];
+        int height = configuration[1];
+        int blockSize = configuration[2];
+        std::cout << "   - " << width << "x" << height << ", " << blockSize << "x" << blockSize << " blocks: " << std::flush;
+
+        QImage image(width, height, QImage::Format_Grayscale8);
+        for (int y = 0; y < height; ++y) {
+            uchar *line = image.scanLine(y);
+            for (int x = 0; x < width; ++x) {
+                line[x] = (uchar)(120 + 90 * std::sin(x * 0.05) * std::cos(y * 0.07) + (x + y) / 16);
+            }
+        }
+
+        BlockManager manager(&image, blockSize, blockSize);
+        std::unique_ptr<QImage> full(manager.compress());
+        for (int denominator : {2, 4, 8}) {
+            QImage reduced = manager.compressReduced(denominator);
+            int reducedWidth = (width + denominator - 1) / denominator;
+            int reducedHeight = (height + denominator - 1) / denominator;
+            assert(reduced.width() == reducedWidth && reduced.height() == reducedHeight);
+
+            double totalError = 0;
+            double maxError = 0;
+            for (int y = 0; y < reducedHeight; ++y) {
+                for (int x = 0; x < reducedWidth; ++x) {
+                    int sum = 0;
+                    int count = 0;
+                    for (int v = y * denominator; v < std::min((y + 1) * denominator, height); ++v) {
+                        for (int u = x * denominator; u < std::min((x + 1) * denominator, width); ++u) {
+                            sum += full->constScanLine(v)[u];
+                            ++count;
+                        }
+                    }
+                    double error = std::abs(reduced.constScanLine(y)[x] - (double) sum / count);
+                    totalError += error;
+                    maxError = std::max(maxError, error);
+                }
+            }
+            // The reduced inverse transform is a sharper low pass than a box.
+            assert(totalError / (reducedWidth * reducedHeight) < 2 && maxError <= 8);
+        }
+
+        for (int denominator : {3, 5, 6}) {
+            assert(manager.compressReduced(denominator).isNull());
+        }
+        std::cout << "passed" << std::endl;
+    }
+}
+
+// Small cuts reconstruct through the pruned inverse; forcing it on
+// (threshold 1) and off (threshold 0) must give the same pixels, up to
+// one level for the fixed-point rounding.
+template<typename Sample>
+void checkPrunedInverse(const QImage &image, int blockSize, int cutDimension, int tolerance) {
+    BasicBlockManager<Sample> pruned(&image, blockSize, cutDimension);
+    BasicBlockManager<Sample> full(&image, blockSize, cutDimension);
+    pruned.setPrunedThreshold(1.0);
+    full.setPrunedThreshold(0);
+
+    std::unique_ptr<QImage> actual(pruned.compress());
+    std::unique_ptr<QImage> expected(full.compress());
+    for (int y = 0; y < image.height(); ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            assert(std::abs(actual->constScanLine(y)[x] - expected->constScanLine(y)[x]) <= tolerance);
+        }
+    }
+}
+
+void testPrunedInverse() {
+    const int width = 203;
+    const int height = 117;
+
+    QImage image(width, height, QImage::Format_Grayscale8);
+    for (int y = 0; y < height; ++y) {
+        uchar *line = image.scanLine(y);
+        for (int x = 0; x < width; ++x) {
+            line[x] = (uchar)(128 + 100 * std::sin(x * 0.1) * std::cos(y * 0.13) + (x * y) % 17);
+        }
+    }
+
+    std::cout << "\n\n---- Test pruned inverse transform ---- " << std::endl;
+    for (int blockSize : {8, 13, 16}) {
+        std::cout << "   - " << blockSize << "x" << blockSize << " blocks, cuts 1 to 3: " << std::flush;
+        for (int cutDimension = 1; cutDimension <= 3; ++cutDimension) {
+            checkPrunedInverse<double>(image, blockSize, cutDimension, 0);
+            checkPrunedInverse<float>(image, blockSize, cutDimension, 0);
+            checkPrunedInverse<std::int32_t>(image, blockSize, cutDimension, 1);
+        }
+        std::cout << "passed" << std::endl;
+    }
+}
+
+// Statistics of 2 x 2 blocks whose lines are over twice the 66051 bright
+// pixels that overflow a 32 bit sum of squares, with the output off by
+// +-error from the source (0 for an identical image).
+QualityMetrics measureOffsetImage(int error) {
+    const int width = 140001;
+    std::vector<uchar> source(width);
+    std::vector<uchar> output(width);
+    for (int x = 0; x < width; ++x) {
+        source[x] = (uchar)(x % 7 == 0 ? 128 : 255 - error);
+        output[x] = (uchar)(source[x] + (x % 2 == 0 ? error : -error));
+    }
+
+    std::vector<BlockQuality> blocks(4);
+    for (BlockQuality &block : blocks) {
+        for (int line = 0; line < 3; ++line) {
+            block.addLine(source.data(), output.data(), width);
+        }
+    }
+    return QualityMetrics(2, 2, blocks);
+}
+
+void testQualityMetrics() {
+    std::cout << "\n\n---- Test quality metrics ---- " << std::endl;
+
+    std::cout << "   - identical image: " << std::flush;
+    QualityMetrics identical = measureOffsetImage(0);
+    assert(identical.getMse() == 0 && identical.getPsnr() == 99.0);
+    assert(std::abs(identical.getSsim() - 1) < 1e-9 && identical.getCoverage() == 1);
+    std::cout << "passed" << std::endl;
+
+    for (int error : {1, 3, 10}) {
+        std::cout << "   - +-" << error << " image: " << std::flush;
+        QualityMetrics offset = measureOffsetImage(error);
+        assert(offset.getMse() == error * error);
+        assert(std::abs(offset.getPsnr() - 10 * std::log10(255.0 * 255.0 / (error * error))) < 1e-9);
+        for (int block = 0; block < 4; ++block) {
+            assert(offset.getBlockMse(block / 2, block % 2) == error * error);
+        }
+        assert(offset.getSsim() < 1 && offset.getSsim() > 0.9);
+        std::cout << "passed" << std::endl;
+    }
+}
+
+// Searches for a PSNR and a byte target between two cuts of an exhaustive
+// table of full passes. The chosen cut must meet the target and, unless the
+// search ran out of full passes, be the smallest (PSNR) or largest (bytes)
+// cut that does.
+void testRateSearch() {
+    const int width = 320;
+    const int height = 240;
+    const int blockSize = 8;
+    const int maxFullPasses = 4;
+    const int maxCut = 2 * blockSize - 1;
+
+    QImage image(width, height, QImage::Format_Grayscale8);
+    for (int y = 0; y < height; ++y) {
+        uchar *line = image.scanLine(y);
+        for (int x = 0; x < width; ++x) {
+            line[x] = (uchar) std::min(255.0, std::max(0.0, 128 + 100 * std::sin(x * 0.05) * std::cos(y * 0.07) + (x * x + y * 3) % 23));
+        }
+    }
+
+    BlockManager manager(&image, blockSize, 1);
+    std::vector<double> psnr(maxCut + 1);
+    std::vector<qint64> bytes(maxCut + 1);
+    manager.setQualityMetrics(true);
+    for (int cut = 1; cut <= maxCut; ++cut) {
+        manager.setCutDimension(cut);
+        std::unique_ptr<QImage> output(manager.compress());
+        psnr[cut] = manager.getQualityMetrics().getPsnr();
+        bytes[cut] = JpegEncoder(manager).encode().size();
+    }
+    manager.setQualityMetrics(false);
+
+    std::cout << "\n\n---- Test rate search ---- " << std::endl;
+    std::cout << "   - PSNR target: " << std::flush;
+    RateSearch psnrSearch(RateTarget::psnr((psnr[5] + psnr[6]) / 2));
+    psnrSearch.setMaxFullPasses(maxFullPasses);
+    RateSearchResult result = psnrSearch.searchCut(manager);
+    assert(result.met && result.fullPasses <= maxFullPasses);
+    assert(result.psnr == psnr[result.cutDimension] && result.encodedSize == bytes[result.cutDimension]);
+    assert(result.fullPasses == maxFullPasses || result.cutDimension == 6);
+    std::cout << "passed (cut " << result.cutDimension << ", " << result.fullPasses << " full passes)" << std::endl;
+
+    std::cout << "   - byte target: " << std::flush;
+    RateSearch byteSearch(RateTarget::bytes((bytes[9] + bytes[10]) / 2));
+    byteSearch.setMaxFullPasses(maxFullPasses);
+    result = byteSearch.searchCut(manager);
+    assert(result.met && result.fullPasses <= maxFullPasses);
+    assert(result.psnr == psnr[result.cutDimension] && result.encodedSize == bytes[result.cutDimension]);
+    assert(result.fullPasses == maxFullPasses || result.cutDimension == 9);
+    std::cout << "passed (cut " << result.cutDimension << ", " << result.fullPasses << " full passes)" << std::endl;
+
+    std::cout << "   - byte target over block sizes 8 and 16: " << std::flush;
+    result = byteSearch.search(image, {8, 16});
+    assert(result.met && result.encodedSize <= (bytes[9] + bytes[10]) / 2);
+    assert(result.fullPasses <= 2 * maxFullPasses);
+    std::cout << "passed (" << result.blockSize << "x" << result.blockSize << ", cut " << result.cutDimension << ")" << std::endl;
+}
+
+// Largest channel difference between two RGB32 pixels.
+int channelError(QRgb a, QRgb b) {
+    return std::max(std::abs(qRed(a) - qRed(b)), std::max(std::abs(qGreen(a) - qGreen(b)), std::abs(qBlue(a) - qBlue(b))));
+}
+
+void testColorPipeline() {
+    std::cout << "\n\n---- Test colour pipeline ---- " << std::endl;
+
+    // A count that is not a multiple of four leaves a scalar tail; single
+    // pixel calls run only the scalar code.
+    const int count = 37;
+    std::vector<QRgb> pixels(count);
+    for (int x = 0; x < count; ++x) {
+        pixels[x] = qRgb((x * 97 + 13) % 256, (x * 59 + 200) % 256, (x * 31 + 7) % 256);
+    }
+    pixels[0] = qRgb(0, 0, 0);
+    pixels[1] = qRgb(255, 255, 255);
+    pixels[2] = qRgb(255, 0, 0);
+    pixels[3] = qRgb(0, 0, 255);
+
+    std::cout << "   - rgbToYcbcrLine against the scalar path: " << std::flush;
+    std::vector<uchar> y(count), cb(count), cr(count);
+    rgbToYcbcrLine(pixels.data(), count, y.data(), cb.data(), cr.data());
+    for (int x = 0; x < count; ++x) {
+        uchar scalar[3];
+        rgbToYcbcrLine(&pixels[x], 1, &scalar[0], &scalar[1], &scalar[2]);
+        assert(y[x] == scalar[0] && cb[x] == scalar[1] && cr[x] == scalar[2]);
+    }
+    std::cout << "passed" << std::endl;
+
+    std::cout << "   - ycbcrToRgbLine against the scalar path: " << std::flush;
+    // Extremes that saturate every channel in both directions.
+    cb[4] = 0;
+    cr[4] = 255;
+    cb[5] = 255;
+    cr[5] = 0;
+    for (int shift = 0; shift <= 1; ++shift) {
+        std::vector<QRgb> out(count);
+        ycbcrToRgbLine(y.data(), cb.data(), cr.data(), count, out.data(), shift);
+        for (int x = 0; x < count; ++x) {
+            QRgb scalar;
+            ycbcrToRgbLine(&y[x], &cb[x >> shift], &cr[x >> shift], 1, &scalar);
+            assert(out[x] == scalar);
+        }
+    }
+    std::cout << "passed" << std::endl;
+
+    // Lossless cut, so only the colour conversion and the chroma
+    // subsampling remain. The chroma is far from neutral, so a dropped odd
+    // last chroma column or row would show.
+    const ChromaSubsampling modes[] = {ChromaSubsampling::Yuv444, ChromaSubsampling::Yuv422, ChromaSubsampling::Yuv420};
+    const int sizes[][3] = {{203, 117, 8}, {61, 37, 12}};
+    for (const auto &size : sizes) {
+        int width = size[0];
+        int height = size[1];
+        int blockSize = size[2];
+        QImage image(width, height, QImage::Format_RGB32);
+        for (int j = 0; j < height; ++j) {
+            QRgb *line = (QRgb*) image.scanLine(j);
+            for (int i = 0; i < width; ++i) {
+                line[i] = qRgb((int) std::lround(190 + 40 * std::sin(i * 0.04) * std::cos(j * 0.03)),
+                               (int) std::lround(90 + (i + j) / 8.0),
+                               (int) std::lround(50 + 30 * std::cos(i * 0.05 + j * 0.02)));
+            }
+        }
+
+        for (ChromaSubsampling mode : modes) {
+            std::cout << "   - " << subsamplingName(mode) << " round trip of " << width << "x" << height << ": " << std::flush;
+            ColorBlockManager manager(&image, blockSize, 2 * blockSize - 1, mode);
+            std::unique_ptr<QImage> output(manager.compress());
+            assert(output && output->width() == width && output->height() == height);
+
+            double sum = 0;
+            int maxError = 0;
+            int edgeError = 0;
+            for (int j = 0; j < height; ++j) {
+                const QRgb *source = (const QRgb*) image.scanLine(j);
+                const QRgb *result = (const QRgb*) output->scanLine(j);
+                for (int i = 0; i < width; ++i) {
+                    int error = channelError(source[i], result[i]);
+                    sum += error;
+                    maxError = std::max(maxError, error);
+                    if (i == width - 1 || j == height - 1) {
+                        edgeError = std::max(edgeError, error);
+                    }
+                }
+            }
+            double meanError = sum / (width * height);
+            assert(meanError < 1.5 && maxError <= 4 && edgeError <= 4);
+            std::cout << "passed (mean " << meanError << ", max " << maxError << ", last row and column " << edgeError << ")" << std::endl;
+        }
+    }
+}
+
+// Compresses on eight workers, where 3x2 blocks of 32 or more pixels are
+// split into groups of lines, and on one worker, where they are not; the
+// ragged edge blocks leave partial groups. tolerance is the largest pixel
+// difference allowed.
+template<typename Sample>
+void checkSplitBlocks(const QImage &image, const QImage &changedImage, int blockSize, int tolerance) {
+    ThreadPool splitPool(8);
+    ThreadPool singlePool(1);
+    const int cuts[] = {3, blockSize, 2 * blockSize - 1};
+    for (int update = 0; update < 2; ++update) {
+        BasicBlockManager<Sample> split(&image, blockSize, 1, &splitPool);
+        BasicBlockManager<Sample> single(&image, blockSize, 1, &singlePool);
+        assert(split.rows * split.columns < 2 * splitPool.getWorkerCount());
+        if (update == 1) {
+            split.updateImage(changedImage);
+            single.updateImage(changedImage);
+        }
+
+        for (int cut : cuts) {
+            split.setCutDimension(cut);
+            single.setCutDimension(cut);
+            std::unique_ptr<QImage> splitOutput(split.compress());
+            std::unique_ptr<QImage> singleOutput(single.compress());
+            for (int y = 0; y < image.height(); ++y) {
+                const uchar *a = splitOutput->scanLine(y);
+                const uchar *b = singleOutput->scanLine(y);
+                for (int x = 0; x < image.width(); ++x) {
+                    assert(std::abs(a[x] - b[x]) <= tolerance);
+                }
+            }
+        }
+    }
+}
+
+void testSplitBlocks() {
+    std::cout << "\n\n---- Test split blocks ---- " << std::endl;
+    const int sizes[][3] = {{110, 75, 40}, {170, 100, 64}};
+    for (const auto &size : sizes) {
+        int width = size[0];
+        int height = size[1];
+        int blockSize = size[2];
+        QImage image(width, height, QImage::Format_Grayscale8);
+        for (int y = 0; y < height; ++y) {
+            uchar *line = image.scanLine(y);
+            for (int x = 0; x < width; ++x) {
+                line[x] = (uchar) std::min(255.0, std::max(0.0, 128 + 90 * std::sin(x * 0.09) * std::cos(y * 0.05) + (x * 7 + y * 13) % 19));
+            }
+        }
+        QImage changedImage = image.copy();
+        paintRect(changedImage, QRect(blockSize + 3, 5, 20, 20), 240);
+
+        std::cout << "   - " << blockSize << "x" << blockSize << " blocks, double: " << std::flush;
+        checkSplitBlocks<double>(image, changedImage, blockSize, 0);
+        std::cout << "passed" << std::endl;
+        std::cout << "   - " << blockSize << "x" << blockSize << " blocks, float: " << std::flush;
+        checkSplitBlocks<float>(image, changedImage, blockSize, 0);
+        std::cout << "passed" << std::endl;
+        std::cout << "   - " << blockSize << "x" << blockSize << " blocks, fixed: " << std::flush;
+        checkSplitBlocks<std::int32_t>(image, changedImage, blockSize, 1);
+        std::cout << "passed" << std::endl;
+    }
+}
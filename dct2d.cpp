@@ -0,0 +1,114 @@
+#include "dct2d.h"
+#include "dct2dKernel.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+namespace {
+
+bool isaSupported(DctIsa isa) {
+    switch (isa) {
+        case DctIsa::Scalar:
+            return true;
+        case DctIsa::Sse2:
+            return sse2DctKernels() != nullptr;
+        case DctIsa::Avx2:
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+            return avx2DctKernels() != nullptr && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+const Dct2DKernels *kernelsFor(DctIsa isa) {
+    switch (isa) {
+        case DctIsa::Avx2:
+            return avx2DctKernels();
+        case DctIsa::Sse2:
+            return sse2DctKernels();
+        default:
+            return scalarDctKernels();
+    }
+}
+
+DctIsa detectIsa() {
+    const char *env = std::getenv("JPEGC_DCT_ISA");
+    if (env != nullptr) {
+        for (DctIsa isa : {DctIsa::Scalar, DctIsa::Sse2, DctIsa::Avx2}) {
+            if (std::strcmp(env, dctIsaName(isa)) == 0 && isaSupported(isa)) {
+                return isa;
+            }
+        }
+    }
+
+    if (isaSupported(DctIsa::Avx2)) {
+        return DctIsa::Avx2;
+    }
+    if (isaSupported(DctIsa::Sse2)) {
+        return DctIsa::Sse2;
+    }
+    return DctIsa::Scalar;
+}
+
+std::atomic<const Dct2DKernels *> &activeKernels() {
+    static std::atomic<const Dct2DKernels *> kernels(kernelsFor(detectIsa()));
+    return kernels;
+}
+
+std::atomic<DctIsa> &activeIsa() {
+    static std::atomic<DctIsa> isa(detectIsa());
+    return isa;
+}
+
+}
+
+template<>
+void Dct2D<8>::forward(double *block) {
+    activeKernels().load(std::memory_order_relaxed)->forward8(block);
+}
+
+template<>
+void Dct2D<8>::inverse(double *block) {
+    activeKernels().load(std::memory_order_relaxed)->inverse8(block);
+}
+
+template<>
+void Dct2D<16>::forward(double *block) {
+    activeKernels().load(std::memory_order_relaxed)->forward16(block);
+}
+
+template<>
+void Dct2D<16>::inverse(double *block) {
+    activeKernels().load(std::memory_order_relaxed)->inverse16(block);
+}
+
+bool hasFixedSizeDct(int blockSize) {
+    return blockSize == 8 || blockSize == 16;
+}
+
+DctIsa getDctIsa() {
+    return activeIsa().load();
+}
+
+bool setDctIsa(DctIsa isa) {
+    if (!isaSupported(isa)) {
+        return false;
+    }
+    activeIsa().store(isa);
+    activeKernels().store(kernelsFor(isa));
+    return true;
+}
+
+const char *dctIsaName(DctIsa isa) {
+    switch (isa) {
+        case DctIsa::Avx2:
+            return "avx2";
+        case DctIsa::Sse2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef DCT_2D_H
+#define DCT_2D_H
+
+// Fixed-size 2D DCT-II / DCT-III kernels for square row-major blocks. They
+// use the same unnormalized scaling as FFTW's REDFT10 / REDFT01, so a
+// forward + inverse round trip multiplies by 4 * N * N exactly as the FFTW
+// plans do. The instruction set is picked once at runtime.
+enum class DctIsa {
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+template<int N>
+class Dct2D {
+
+public:
+    static void forward(double *block);
+    static void inverse(double *block);
+};
+
+template<> void Dct2D<8>::forward(double *block);
+template<> void Dct2D<8>::inverse(double *block);
+template<> void Dct2D<16>::forward(double *block);
+template<> void Dct2D<16>::inverse(double *block);
+
+bool hasFixedSizeDct(int blockSize);
+DctIsa getDctIsa();
+bool setDctIsa(DctIsa isa);
+const char *dctIsaName(DctIsa isa);
+
+#endif
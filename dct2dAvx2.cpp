@@ -0,0 +1,35 @@
+#include "dct2dKernel.h"
+
+// Built with -mavx2 -mfma (see CMakeLists.txt); only reached when the CPU reports both.
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+
+namespace {
+
+struct Avx2Lane {
+    static constexpr int width = 4;
+    __m256d v;
+
+    static inline Avx2Lane load(const double *p) { return {_mm256_loadu_pd(p)}; }
+    static inline void store(double *p, Avx2Lane a) { _mm256_storeu_pd(p, a.v); }
+    static inline Avx2Lane broadcast(double value) { return {_mm256_set1_pd(value)}; }
+    static inline Avx2Lane fma(Avx2Lane a, Avx2Lane b, Avx2Lane c) { return {_mm256_fmadd_pd(a.v, b.v, c.v)}; }
+
+    inline Avx2Lane operator+(Avx2Lane o) const { return {_mm256_add_pd(v, o.v)}; }
+    inline Avx2Lane operator-(Avx2Lane o) const { return {_mm256_sub_pd(v, o.v)}; }
+    inline Avx2Lane operator*(Avx2Lane o) const { return {_mm256_mul_pd(v, o.v)}; }
+};
+
+}
+
+const Dct2DKernels *avx2DctKernels() {
+    return makeDctKernels<Avx2Lane>();
+}
+
+#else
+
+const Dct2DKernels *avx2DctKernels() {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef DCT_2D_KERNEL_H
+#define DCT_2D_KERNEL_H
+
+// Shared implementation of the fixed-size kernels. Every dct2d<Isa>.cpp
+// includes this header with its own lane type, so the templates below live
+// in an anonymous namespace to keep the per-ISA instantiations apart.
+
+struct Dct2DKernels {
+    void (*forward8)(double *block);
+    void (*inverse8)(double *block);
+    void (*forward16)(double *block);
+    void (*inverse16)(double *block);
+};
+
+const Dct2DKernels *scalarDctKernels();
+const Dct2DKernels *sse2DctKernels();
+const Dct2DKernels *avx2DctKernels();
+
+namespace {
+
+constexpr double dctPi = 3.14159265358979323846;
+
+// cos(x) for x in [0, pi / 2].
+constexpr double quarterCos(double x) {
+    double term = 1;
+    double sum = 1;
+    for (int k = 1; k < 20; ++k) {
+        term *= -x * x / ((2 * k - 1) * (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// cos(pi * m / (2 * n)), reduced exactly in integers before the series.
+constexpr double indexCos(int m, int n) {
+    m %= 4 * n;
+    if (m > 2 * n) {
+        m = 4 * n - m;
+    }
+    if (m > n) {
+        return -quarterCos(dctPi * (2 * n - m) / (2 * n));
+    }
+    return quarterCos(dctPi * m / (2 * n));
+}
+
+// Odd half of the length-n butterfly: 2 cos(pi (2i + 1)(2j + 1) / (2n)).
+// The matrix is symmetric, so the forward and inverse passes share it.
+template<int n>
+struct OddMatrix {
+    double v[n / 2][n / 2];
+
+    constexpr OddMatrix(): v() {
+        for (int i = 0; i < n / 2; ++i) {
+            for (int j = 0; j < n / 2; ++j) {
+                v[i][j] = 2 * indexCos((2 * i + 1) * (2 * j + 1), n);
+            }
+        }
+    }
+};
+
+template<int n>
+struct OddTable {
+    static constexpr OddMatrix<n> matrix{};
+};
+
+// Length-n REDFT10 split into an n/2 REDFT10 over the sums and a dense
+// n/2 x n/2 product over the differences.
+template<int n, typename V>
+struct Forward1D {
+    static inline void run(const V *x, V *y) {
+        V even[n / 2];
+        V odd[n / 2];
+        for (int j = 0; j < n / 2; ++j) {
+            even[j] = x[j] + x[n - 1 - j];
+            odd[j] = x[j] - x[n - 1 - j];
+        }
+
+        V evenOut[n / 2];
+        Forward1D<n / 2, V>::run(even, evenOut);
+        for (int m = 0; m < n / 2; ++m) {
+            y[2 * m] = evenOut[m];
+        }
+
+        for (int i = 0; i < n / 2; ++i) {
+            V sum = V::broadcast(OddTable<n>::matrix.v[i][0]) * odd[0];
+            for (int j = 1; j < n / 2; ++j) {
+                sum = V::fma(V::broadcast(OddTable<n>::matrix.v[i][j]), odd[j], sum);
+            }
+            y[2 * i + 1] = sum;
+        }
+    }
+};
+
+template<typename V>
+struct Forward1D<1, V> {
+    static inline void run(const V *x, V *y) {
+        y[0] = x[0] + x[0];
+    }
+};
+
+// Length-n REDFT01: an n/2 REDFT01 over the even inputs gives the symmetric
+// part, the odd inputs give the antisymmetric part.
+template<int n, typename V>
+struct Inverse1D {
+    static inline void run(const V *x, V *y) {
+        V evenIn[n / 2];
+        V evenOut[n / 2];
+        for (int m = 0; m < n / 2; ++m) {
+            evenIn[m] = x[2 * m];
+        }
+        Inverse1D<n / 2, V>::run(evenIn, evenOut);
+
+        for (int k = 0; k < n / 2; ++k) {
+            V odd = V::broadcast(OddTable<n>::matrix.v[k][0]) * x[1];
+            for (int m = 1; m < n / 2; ++m) {
+                odd = V::fma(V::broadcast(OddTable<n>::matrix.v[k][m]), x[2 * m + 1], odd);
+            }
+            y[k] = evenOut[k] + odd;
+            y[n - 1 - k] = evenOut[k] - odd;
+        }
+    }
+};
+
+template<typename V>
+struct Inverse1D<1, V> {
+    static inline void run(const V *x, V *y) {
+        y[0] = x[0];
+    }
+};
+
+template<int N>
+inline void transposeBlock(double *block) {
+    for (int i = 0; i < N; ++i) {
+        for (int j = i + 1; j < N; ++j) {
+            double value = block[i * N + j];
+            block[i * N + j] = block[j * N + i];
+            block[j * N + i] = value;
+        }
+    }
+}
+
+// Transforms every column, V::width columns at a time.
+template<int N, typename V, template<int, typename> class Transform>
+inline void columnPass(double *block) {
+    for (int column = 0; column < N; column += V::width) {
+        V in[N];
+        V out[N];
+        for (int row = 0; row < N; ++row) {
+            in[row] = V::load(block + row * N + column);
+        }
+        Transform<N, V>::run(in, out);
+        for (int row = 0; row < N; ++row) {
+            V::store(block + row * N + column, out[row]);
+        }
+    }
+}
+
+template<int N, typename V, template<int, typename> class Transform>
+void transform2D(double *block) {
+    columnPass<N, V, Transform>(block);
+    transposeBlock<N>(block);
+    columnPass<N, V, Transform>(block);
+    transposeBlock<N>(block);
+}
+
+template<typename V>
+const Dct2DKernels *makeDctKernels() {
+    static const Dct2DKernels kernels = {
+        &transform2D<8, V, Forward1D>,
+        &transform2D<8, V, Inverse1D>,
+        &transform2D<16, V, Forward1D>,
+        &transform2D<16, V, Inverse1D>
+    };
+    return &kernels;
+}
+
+}
+
+#endif
@@ -0,0 +1,23 @@
+#include "dct2dKernel.h"
+
+namespace {
+
+struct ScalarLane {
+    static constexpr int width = 1;
+    double v;
+
+    static inline ScalarLane load(const double *p) { return {*p}; }
+    static inline void store(double *p, ScalarLane a) { *p = a.v; }
+    static inline ScalarLane broadcast(double value) { return {value}; }
+    static inline ScalarLane fma(ScalarLane a, ScalarLane b, ScalarLane c) { return {a.v * b.v + c.v}; }
+
+    inline ScalarLane operator+(ScalarLane o) const { return {v + o.v}; }
+    inline ScalarLane operator-(ScalarLane o) const { return {v - o.v}; }
+    inline ScalarLane operator*(ScalarLane o) const { return {v * o.v}; }
+};
+
+}
+
+const Dct2DKernels *scalarDctKernels() {
+    return makeDctKernels<ScalarLane>();
+}
@@ -0,0 +1,34 @@
+#include "dct2dKernel.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+namespace {
+
+struct Sse2Lane {
+    static constexpr int width = 2;
+    __m128d v;
+
+    static inline Sse2Lane load(const double *p) { return {_mm_loadu_pd(p)}; }
+    static inline void store(double *p, Sse2Lane a) { _mm_storeu_pd(p, a.v); }
+    static inline Sse2Lane broadcast(double value) { return {_mm_set1_pd(value)}; }
+    static inline Sse2Lane fma(Sse2Lane a, Sse2Lane b, Sse2Lane c) { return {_mm_add_pd(_mm_mul_pd(a.v, b.v), c.v)}; }
+
+    inline Sse2Lane operator+(Sse2Lane o) const { return {_mm_add_pd(v, o.v)}; }
+    inline Sse2Lane operator-(Sse2Lane o) const { return {_mm_sub_pd(v, o.v)}; }
+    inline Sse2Lane operator*(Sse2Lane o) const { return {_mm_mul_pd(v, o.v)}; }
+};
+
+}
+
+const Dct2DKernels *sse2DctKernels() {
+    return makeDctKernels<Sse2Lane>();
+}
+
+#else
+
+const Dct2DKernels *sse2DctKernels() {
+    return nullptr;
+}
+
+#endif
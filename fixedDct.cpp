@@ -0,0 +1,129 @@
+#include "fixedDct.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace {
+
+std::int32_t roundShift(std::int64_t value, int shift) {
+    return (std::int32_t)((value + ((std::int64_t) 1 << (shift - 1))) >> shift);
+}
+
+}
+
+const FixedDct &FixedDct::get(int rows, int columns) {
+    static std::mutex mutex;
+    static std::map<std::pair<int, int>, std::unique_ptr<FixedDct>> transforms;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<FixedDct> &transform = transforms[std::make_pair(rows, columns)];
+    if (transform == nullptr) {
+        transform.reset(new FixedDct(rows, columns));
+    }
+    return *transform;
+}
+
+FixedDct::FixedDct(int rows, int columns): rows(rows), columns(columns), rowTable(cosineTable(columns)), columnTable(cosineTable(rows)) {
+}
+
+std::vector<std::int32_t> FixedDct::cosineTable(int n) {
+    const double pi = 3.14159265358979323846;
+    std::vector<std::int32_t> table(n * n);
+    for (int k = 0; k < n; ++k) {
+        double weight = std::sqrt((k == 0 ? 1.0 : 2.0) / n);
+        for (int i = 0; i < n; ++i) {
+            table[k * n + i] = (std::int32_t) std::lround(weight * std::cos(pi * (2 * i + 1) * k / (2.0 * n)) * (1 << tableBits));
+        }
+    }
+    return table;
+}
+
+void FixedDct::forward(std::int32_t *block, int rowStride) const {
+    forwardRows(block, rowStride, 0, rows);
+    forwardColumns(block, rowStride, 0, columns);
+}
+
+void FixedDct::inverse(std::int32_t *block, int rowStride) const {
+    inverseColumns(block, rowStride, 0, columns);
+    inverseRows(block, rowStride, 0, rows);
+}
+
+// Rows: integer pixels to Q(fractionBits).
+void FixedDct::forwardRows(std::int32_t *block, int rowStride, int first, int count) const {
+    thread_local std::vector<std::int64_t> line;
+    line.resize(std::max(rows, columns));
+
+    for (int y = first; y < first + count; ++y) {
+        std::int32_t *pixels = block + y * rowStride;
+        for (int k = 0; k < columns; ++k) {
+            const std::int32_t *basis = rowTable.data() + k * columns;
+            std::int64_t sum = 0;
+            for (int x = 0; x < columns; ++x) {
+                sum += (std::int64_t) pixels[x] * basis[x];
+            }
+            line[k] = sum;
+        }
+        for (int k = 0; k < columns; ++k) {
+            pixels[k] = roundShift(line[k], tableBits - fractionBits);
+        }
+    }
+}
+
+void FixedDct::forwardColumns(std::int32_t *block, int rowStride, int first, int count) const {
+    thread_local std::vector<std::int64_t> line;
+    line.resize(std::max(rows, columns));
+
+    for (int x = first; x < first + count; ++x) {
+        for (int k = 0; k < rows; ++k) {
+            const std::int32_t *basis = columnTable.data() + k * rows;
+            std::int64_t sum = 0;
+            for (int y = 0; y < rows; ++y) {
+                sum += (std::int64_t) block[y * rowStride + x] * basis[y];
+            }
+            line[k] = sum;
+        }
+        for (int k = 0; k < rows; ++k) {
+            block[k * rowStride + x] = roundShift(line[k], tableBits);
+        }
+    }
+}
+
+void FixedDct::inverseColumns(std::int32_t *block, int rowStride, int first, int count) const {
+    thread_local std::vector<std::int64_t> line;
+    line.resize(std::max(rows, columns));
+
+    for (int x = first; x < first + count; ++x) {
+        for (int y = 0; y < rows; ++y) {
+            std::int64_t sum = 0;
+            for (int k = 0; k < rows; ++k) {
+                sum += (std::int64_t) block[k * rowStride + x] * columnTable[k * rows + y];
+            }
+            line[y] = sum;
+        }
+        for (int y = 0; y < rows; ++y) {
+            block[y * rowStride + x] = roundShift(line[y], tableBits);
+        }
+    }
+}
+
+void FixedDct::inverseRows(std::int32_t *block, int rowStride, int first, int count) const {
+    thread_local std::vector<std::int64_t> line;
+    line.resize(std::max(rows, columns));
+
+    for (int y = first; y < first + count; ++y) {
+        std::int32_t *values = block + y * rowStride;
+        for (int x = 0; x < columns; ++x) {
+            std::int64_t sum = 0;
+            for (int k = 0; k < columns; ++k) {
+                sum += (std::int64_t) values[k] * rowTable[k * columns + x];
+            }
+            line[x] = sum;
+        }
+        for (int x = 0; x < columns; ++x) {
+            values[x] = roundShift(line[x], tableBits);
+        }
+    }
+}
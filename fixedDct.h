@@ -0,0 +1,40 @@
+#ifndef FIXED_DCT_H
+#define FIXED_DCT_H
+
+#include <cstdint>
+#include <vector>
+
+// Integer 2D DCT-II / DCT-III for the fixed-point pipeline: two separable
+// matrix passes with orthonormal Q14 cosine tables and 64 bit accumulation.
+// forward() takes integer pixels and leaves coefficients with fractionBits
+// fractional bits; inverse() turns those back into pixels in the same format.
+class FixedDct {
+
+public:
+    static const int tableBits = 14;
+    static const int fractionBits = 4;
+
+    static const FixedDct &get(int rows, int columns);
+
+    void forward(std::int32_t *block, int rowStride) const;
+    void inverse(std::int32_t *block, int rowStride) const;
+    // The two passes of forward() (rows, then columns) and of inverse()
+    // (columns, then rows) over count lines from first, so the lines of one
+    // block can be split across workers.
+    void forwardRows(std::int32_t *block, int rowStride, int first, int count) const;
+    void forwardColumns(std::int32_t *block, int rowStride, int first, int count) const;
+    void inverseColumns(std::int32_t *block, int rowStride, int first, int count) const;
+    void inverseRows(std::int32_t *block, int rowStride, int first, int count) const;
+
+private:
+    FixedDct(int rows, int columns);
+
+    static std::vector<std::int32_t> cosineTable(int n);
+
+    int rows;
+    int columns;
+    std::vector<std::int32_t> rowTable;
+    std::vector<std::int32_t> columnTable;
+};
+
+#endif
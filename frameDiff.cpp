@@ -0,0 +1,36 @@
+#include "frameDiff.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+bool spanEqual(const uchar *previous, const uchar *current, int count) {
+    int x = 0;
+#if defined(__SSE2__)
+    for (; x + 16 <= count; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(previous + x));
+        __m128i b = _mm_loadu_si128((const __m128i*)(current + x));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff) {
+            return false;
+        }
+    }
+#endif
+    return std::memcmp(previous + x, current + x, count - x) == 0;
+}
+
+}
+
+int markChangedSpans(const uchar *previous, const uchar *current, int lineBytes, int spanBytes, char *changed) {
+    int flagged = 0;
+    for (int k = 0, x = 0; x < lineBytes; ++k, x += spanBytes) {
+        if (!changed[k] && !spanEqual(previous + x, current + x, std::min(spanBytes, lineBytes - x))) {
+            changed[k] = 1;
+        }
+        flagged += changed[k] != 0;
+    }
+    return flagged;
+}
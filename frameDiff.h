@@ -0,0 +1,12 @@
+#ifndef FRAME_DIFF_H
+#define FRAME_DIFF_H
+
+#include <QtGlobal>
+
+// Compares one pixel line of two frames block by block: flags changed[k]
+// when the spanBytes bytes of block k differ. Blocks already flagged are
+// skipped, and the last span may be shorter. Compares 16 bytes per step
+// with SSE2 where available. Returns how many blocks are flagged.
+int markChangedSpans(const uchar *previous, const uchar *current, int lineBytes, int spanBytes, char *changed);
+
+#endif
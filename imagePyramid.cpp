@@ -0,0 +1,58 @@
+#include "imagePyramid.h"
+#include "threadPool.h"
+#include <algorithm>
+
+ImagePyramid::ImagePyramid() {
+    levels.push_back(QImage());
+}
+
+ImagePyramid::ImagePyramid(const QImage &base, int minimumSize, ThreadPool *pool) {
+    bool supported = base.format() == QImage::Format_Grayscale8 || base.depth() == 32;
+    levels.push_back(supported ? base : base.convertToFormat(QImage::Format_RGB32));
+
+    while (std::min(levels.back().width(), levels.back().height()) > minimumSize) {
+        levels.push_back(downsample(levels.back(), pool));
+    }
+}
+
+// Odd sizes round up; the last row and column are averaged with themselves.
+QImage ImagePyramid::downsample(const QImage &image, ThreadPool *pool) {
+    int width = (image.width() + 1) / 2;
+    int height = (image.height() + 1) / 2;
+    int channels = image.format() == QImage::Format_Grayscale8 ? 1 : 4;
+    QImage half(width, height, image.format());
+    uchar *bits = half.bits();
+    int bytesPerLine = half.bytesPerLine();
+
+    (pool != nullptr ? pool : &ThreadPool::global())->parallelFor(height, [&](int y){
+        const uchar *top = image.constScanLine(2 * y);
+        const uchar *bottom = image.constScanLine(std::min(2 * y + 1, image.height() - 1));
+        uchar *out = bits + (std::size_t)y * bytesPerLine;
+
+        for (int x = 0; x < width; ++x) {
+            int left = 2 * x * channels;
+            int right = std::min(2 * x + 1, image.width() - 1) * channels;
+            for (int c = 0; c < channels; ++c) {
+                out[x * channels + c] = (uchar)((top[left + c] + top[right + c] + bottom[left + c] + bottom[right + c] + 2) >> 2);
+            }
+        }
+    });
+    return half;
+}
+
+int ImagePyramid::levelForScale(double scaleFactor) {
+    int level = 0;
+    while (scaleFactor <= 0.5) {
+        scaleFactor *= 2;
+        ++level;
+    }
+    return level;
+}
+
+int ImagePyramid::getLevelCount() const {
+    return (int) levels.size();
+}
+
+const QImage &ImagePyramid::getLevel(int level) const {
+    return levels[std::min(std::max(level, 0), getLevelCount() - 1)];
+}
@@ -0,0 +1,29 @@
+#ifndef IMAGE_PYRAMID_H
+#define IMAGE_PYRAMID_H
+
+#include <QImage>
+#include <vector>
+
+class ThreadPool;
+
+// Mip levels of an image, each half the size of the previous one (2x2 box
+// filter), down to minimumSize pixels on the shorter side. Level 0 shares
+// the data of the source image. Views draw from the coarsest level that
+// still has at least one source pixel per screen pixel.
+class ImagePyramid {
+
+public:
+    ImagePyramid();
+    explicit ImagePyramid(const QImage &base, int minimumSize = 64, ThreadPool *pool = nullptr);
+
+    static QImage downsample(const QImage &image, ThreadPool *pool = nullptr);
+    static int levelForScale(double scaleFactor);
+
+    int getLevelCount() const;
+    const QImage &getLevel(int level) const;
+
+private:
+    std::vector<QImage> levels;
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include "jpegCommon.h"
+#include <algorithm>
+
+namespace jpeg {
+
+std::vector<int> zigzagOrder(int n) {
+    std::vector<int> order;
+    order.reserve(n * n);
+
+    for (int diagonal = 0; diagonal < 2 * n - 1; ++diagonal) {
+        int first = std::max(0, diagonal - (n - 1));
+        int last = std::min(diagonal, n - 1);
+        for (int step = 0; step <= last - first; ++step) {
+            int row = diagonal % 2 == 1 ? first + step : last - step;
+            order.push_back(row * n + (diagonal - row));
+        }
+    }
+    return order;
+}
+
+int magnitudeCategory(int value) {
+    unsigned magnitude = value < 0 ? -value : value;
+    int category = 0;
+    while (magnitude != 0) {
+        ++category;
+        magnitude >>= 1;
+    }
+    return category;
+}
+
+void HuffmanTable::buildCodes() {
+    std::fill(lengths, lengths + 256, 0);
+
+    int code = 0;
+    int k = 0;
+    for (int length = 1; length <= maxCodeLength; ++length) {
+        for (int i = 0; i < bits[length]; ++i, ++k) {
+            codes[values[k]] = code++;
+            lengths[values[k]] = length;
+        }
+        code <<= 1;
+    }
+}
+
+HuffmanTable buildHuffmanTable(const std::uint64_t frequencies[256]) {
+    // Symbol 256 is a reserved dummy with the lowest frequency, so that no
+    // real symbol receives the all-ones code.
+    std::uint64_t freq[257];
+    int codeSize[257] = {};
+    int others[257];
+    std::copy(frequencies, frequencies + 256, freq);
+    freq[256] = 1;
+    if (std::all_of(freq, freq + 256, [](std::uint64_t count){ return count == 0; })) {
+        freq[0] = 1;
+    }
+    std::fill(others, others + 257, -1);
+
+    while (true) {
+        int v1 = -1;
+        int v2 = -1;
+        for (int i = 0; i < 257; ++i) {
+            if (freq[i] == 0) {
+                continue;
+            }
+            if (v1 < 0 || freq[i] <= freq[v1]) {
+                v2 = v1;
+                v1 = i;
+            } else if (v2 < 0 || freq[i] <= freq[v2]) {
+                v2 = i;
+            }
+        }
+        if (v2 < 0) {
+            break;
+        }
+
+        freq[v2] += freq[v1];
+        freq[v1] = 0;
+
+        ++codeSize[v2];
+        while (others[v2] >= 0) {
+            v2 = others[v2];
+            ++codeSize[v2];
+        }
+        others[v2] = v1;
+
+        ++codeSize[v1];
+        while (others[v1] >= 0) {
+            v1 = others[v1];
+            ++codeSize[v1];
+        }
+    }
+
+    int counts[258] = {};
+    for (int i = 0; i < 257; ++i) {
+        if (codeSize[i] > 0) {
+            ++counts[codeSize[i]];
+        }
+    }
+
+    for (int length = 257; length > maxCodeLength; --length) {
+        while (counts[length] > 0) {
+            int j = length - 2;
+            while (counts[j] == 0) {
+                --j;
+            }
+            counts[length] -= 2;
+            ++counts[length - 1];
+            counts[j + 1] += 2;
+            --counts[j];
+        }
+    }
+
+    int longest = maxCodeLength;
+    while (counts[longest] == 0) {
+        --longest;
+    }
+    --counts[longest];
+
+    HuffmanTable table;
+    for (int length = 1; length <= maxCodeLength; ++length) {
+        table.bits[length] = counts[length];
+    }
+
+    for (int length = 1; length <= 257; ++length) {
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            if (codeSize[symbol] == length) {
+                table.values.push_back(symbol);
+            }
+        }
+    }
+
+    table.buildCodes();
+    return table;
+}
+
+}
@@ -0,0 +1,54 @@
+#ifndef JPEG_COMMON_H
+#define JPEG_COMMON_H
+
+#include <cstdint>
+#include <vector>
+
+// Pieces of the bitstream format shared by JpegEncoder and JpegDecoder.
+// Streams with 8x8 blocks are baseline JFIF; other block sizes reuse the
+// same layout behind a private SOF marker plus a "JPGC" APP11 segment that
+// records the block size.
+namespace jpeg {
+
+enum Marker : std::uint8_t {
+    SOF0 = 0xC0,
+    SOF1 = 0xC1,
+    DHT = 0xC4,
+    SOF_PRIVATE = 0xC8,
+    RST0 = 0xD0,
+    SOI = 0xD8,
+    EOI = 0xD9,
+    SOS = 0xDA,
+    DQT = 0xDB,
+    DRI = 0xDD,
+    APP0 = 0xE0,
+    APP11 = 0xEB
+};
+
+const int baselineBlockSize = 8;
+const int maxCodeLength = 16;
+
+// Zigzag scan of an n x n block: entry k is the row-major index of the k-th
+// coefficient. Anti-diagonals are visited in order, so the triangle kept by
+// BlockManager's cut is always a prefix of the scan.
+std::vector<int> zigzagOrder(int n);
+
+// Number of bits needed for |value| (the JPEG "SSSS" category).
+int magnitudeCategory(int value);
+
+struct HuffmanTable {
+    std::uint8_t bits[maxCodeLength + 1] = {};
+    std::vector<std::uint8_t> values;
+
+    std::uint16_t codes[256] = {};
+    std::uint8_t lengths[256] = {};
+
+    void buildCodes();
+};
+
+// Optimal length-limited table for the given symbol frequencies (Annex K.2).
+HuffmanTable buildHuffmanTable(const std::uint64_t frequencies[256]);
+
+}
+
+#endif
@@ -0,0 +1,456 @@
+#include "jpegDecoder.h"
+#include "threadPool.h"
+#include "planCache.h"
+#include "dct2d.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// MSB-first reader over one restart interval. The interval never contains
+// a marker, so every 0xFF is a stuffed byte; reading past the end yields
+// zero bits.
+class BitReader {
+
+public:
+    BitReader(const uchar *position, const uchar *end): position(position), end(end), buffer(0), count(0) {
+    }
+
+    std::uint32_t peek(int length) {
+        while (count <= 56) {
+            std::uint64_t byte = 0;
+            if (position < end) {
+                byte = *position++;
+                if (byte == 0xFF && position < end && *position == 0x00) {
+                    ++position;
+                }
+            }
+            buffer |= byte << (56 - count);
+            count += 8;
+        }
+        return (std::uint32_t)(buffer >> (64 - length));
+    }
+
+    void skip(int length) {
+        buffer <<= length;
+        count -= length;
+    }
+
+    int receive(int length) {
+        if (length == 0) {
+            return 0;
+        }
+        int bits = peek(length);
+        skip(length);
+        return bits;
+    }
+
+private:
+    const uchar *position;
+    const uchar *end;
+    std::uint64_t buffer;
+    int count;
+};
+
+// Inverse of the encoder's magnitude bits.
+int extend(int bits, int size) {
+    return size > 0 && bits < (1 << (size - 1)) ? bits - (1 << size) + 1 : bits;
+}
+
+int readWord(const uchar *bytes) {
+    return (bytes[0] << 8) | bytes[1];
+}
+
+}
+
+void JpegDecoder::DecodingTable::build(const std::uint8_t bits[jpeg::maxCodeLength + 1], const std::vector<std::uint8_t> &symbols) {
+    values = symbols;
+    std::fill(lookupLength, lookupLength + 256, 0);
+
+    // Codes up to 8 bits resolve with one table lookup; longer ones fall
+    // back to the canonical maxCode walk.
+    int code = 0;
+    int k = 0;
+    for (int length = 1; length <= jpeg::maxCodeLength; ++length) {
+        valueOffset[length] = k - code;
+        for (int i = 0; i < bits[length]; ++i, ++k, ++code) {
+            if (code >= (1 << length)) {
+                return;
+            }
+            if (length <= 8) {
+                int shift = 8 - length;
+                for (int suffix = 0; suffix < (1 << shift); ++suffix) {
+                    lookupLength[(code << shift) | suffix] = length;
+                    lookupValue[(code << shift) | suffix] = values[k];
+                }
+            }
+        }
+        maxCode[length] = bits[length] > 0 ? code - 1 : -1;
+        code <<= 1;
+    }
+    maxCode[jpeg::maxCodeLength + 1] = INT_MAX;
+    defined = true;
+}
+
+namespace {
+
+template<typename Table>
+int decodeSymbol(BitReader &reader, const Table &table) {
+    std::uint32_t prefix = reader.peek(8);
+    if (table.lookupLength[prefix] > 0) {
+        reader.skip(table.lookupLength[prefix]);
+        return table.lookupValue[prefix];
+    }
+
+    std::uint32_t bits = reader.peek(jpeg::maxCodeLength);
+    for (int length = 9; length <= jpeg::maxCodeLength; ++length) {
+        int code = bits >> (jpeg::maxCodeLength - length);
+        if (code <= table.maxCode[length]) {
+            reader.skip(length);
+            return table.values[table.valueOffset[length] + code];
+        }
+    }
+    return -1;
+}
+
+}
+
+JpegDecoder::JpegDecoder(const QByteArray &data, ThreadPool *pool): data(data), pool(pool != nullptr ? pool : &ThreadPool::global()), valid(false), imgWidth(0), imgHeight(0), blockSize(jpeg::baselineBlockSize), rows(0), columns(0), restartInterval(0), quantizerIndex(0), dcIndex(0), acIndex(0), inversePlan(nullptr) {
+    valid = parse();
+}
+
+bool JpegDecoder::isValid() const {
+    return valid;
+}
+
+int JpegDecoder::getWidth() const {
+    return imgWidth;
+}
+
+int JpegDecoder::getHeight() const {
+    return imgHeight;
+}
+
+int JpegDecoder::getBlockSize() const {
+    return blockSize;
+}
+
+bool JpegDecoder::parse() {
+    const uchar *bytes = (const uchar*) data.constData();
+    int size = data.size();
+    if (size < 4 || bytes[0] != 0xFF || bytes[1] != jpeg::SOI) {
+        return false;
+    }
+
+    bool frame = false;
+    bool privateFrame = false;
+    int privateBlockSize = 0;
+    int position = 2;
+
+    while (position + 4 <= size) {
+        if (bytes[position] != 0xFF) {
+            return false;
+        }
+        std::uint8_t marker = bytes[position + 1];
+        if (marker == 0xFF) {
+            ++position;
+            continue;
+        }
+
+        int length = readWord(bytes + position + 2);
+        if (length < 2 || position + 2 + length > size) {
+            return false;
+        }
+        const uchar *segment = bytes + position + 4;
+        int payload = length - 2;
+
+        switch (marker) {
+        case jpeg::APP11:
+            if (payload >= 8 && std::memcmp(segment, "JPGC", 5) == 0) {
+                privateBlockSize = readWord(segment + 6);
+            }
+            break;
+
+        case jpeg::DQT:
+            for (int p = 0; p < payload;) {
+                int precision = segment[p] >> 4;
+                int table = segment[p] & 3;
+                int entrySize = precision == 0 ? 1 : 2;
+                if (p + 1 + 64 * entrySize > payload) {
+                    return false;
+                }
+                quantizers[table].resize(64);
+                for (int i = 0; i < 64; ++i) {
+                    const uchar *entry = segment + p + 1 + i * entrySize;
+                    quantizers[table][i] = entrySize == 1 ? entry[0] : readWord(entry);
+                }
+                p += 1 + 64 * entrySize;
+            }
+            break;
+
+        case jpeg::SOF0:
+        case jpeg::SOF1:
+        case jpeg::SOF_PRIVATE:
+            // Only single component 8 bit frames: that is all BlockManager produces.
+            if (payload < 9 || segment[0] != 8 || segment[5] != 1) {
+                return false;
+            }
+            imgHeight = readWord(segment + 1);
+            imgWidth = readWord(segment + 3);
+            quantizerIndex = segment[8] & 3;
+            privateFrame = marker == jpeg::SOF_PRIVATE;
+            frame = true;
+            break;
+
+        case jpeg::DHT:
+            for (int p = 0; p < payload;) {
+                if (p + 17 > payload) {
+                    return false;
+                }
+                int tableClass = segment[p] >> 4;
+                int table = segment[p] & 3;
+                std::uint8_t bits[jpeg::maxCodeLength + 1] = {};
+                int total = 0;
+                for (int i = 1; i <= jpeg::maxCodeLength; ++i) {
+                    bits[i] = segment[p + i];
+                    total += bits[i];
+                }
+                if (total > 256 || p + 17 + total > payload) {
+                    return false;
+                }
+                std::vector<std::uint8_t> symbols(segment + p + 17, segment + p + 17 + total);
+                (tableClass == 0 ? dcTables : acTables)[table].build(bits, symbols);
+                p += 17 + total;
+            }
+            break;
+
+        case jpeg::DRI:
+            if (payload < 2) {
+                return false;
+            }
+            restartInterval = readWord(segment);
+            break;
+
+        case jpeg::SOS:
+            if (!frame || payload < 6 || segment[0] != 1) {
+                return false;
+            }
+            dcIndex = (segment[2] >> 4) & 3;
+            acIndex = segment[2] & 3;
+            if (privateFrame) {
+                blockSize = privateBlockSize;
+            }
+            return parseScan(position + 2 + length);
+
+        default:
+            // Progressive, lossless and arithmetic coded frames.
+            if (marker >= 0xC2 && marker <= 0xCF && marker != jpeg::DHT && marker != 0xCC) {
+                return false;
+            }
+            break;
+        }
+
+        position += 2 + length;
+    }
+    return false;
+}
+
+bool JpegDecoder::parseScan(int position) {
+    if (blockSize < 2 || imgWidth <= 0 || imgHeight <= 0 || quantizers[quantizerIndex].empty() || !dcTables[dcIndex].defined || !acTables[acIndex].defined) {
+        return false;
+    }
+
+    rows = (imgHeight + blockSize - 1) / blockSize;
+    columns = (imgWidth + blockSize - 1) / blockSize;
+    int totalBlocks = rows * columns;
+    // Without DRI the whole scan is one interval.
+    if (restartInterval <= 0) {
+        restartInterval = totalBlocks;
+    }
+
+    const uchar *bytes = (const uchar*) data.constData();
+    int size = data.size();
+    int begin = position;
+    int firstBlock = 0;
+    bool closed = false;
+
+    for (int p = position; p + 1 < size && !closed; ++p) {
+        if (bytes[p] != 0xFF) {
+            continue;
+        }
+        std::uint8_t next = bytes[p + 1];
+        if (next == 0x00) {
+            ++p;
+            continue;
+        }
+        if (next == 0xFF) {
+            continue;
+        }
+
+        segments.push_back({begin, p, firstBlock});
+        firstBlock += restartInterval;
+        if (next >= jpeg::RST0 && next < jpeg::RST0 + 8) {
+            begin = p + 2;
+            ++p;
+        } else {
+            closed = true;
+        }
+    }
+    if (!closed) {
+        segments.push_back({begin, size, firstBlock});
+    }
+
+    while (!segments.empty() && segments.back().firstBlock >= totalBlocks) {
+        segments.pop_back();
+    }
+
+    zigzag = jpeg::zigzagOrder(blockSize);
+
+    // Undo the quantizer and the orthonormal scaling in one factor, so the
+    // coefficients land in the unnormalized layout the inverse plans expect.
+    // Table entries are in zigzag order; blocks larger than 8x8 reuse the last one.
+    const std::vector<int> &quantizer = quantizers[quantizerIndex];
+    dequantize.assign(blockSize * blockSize, 0);
+    for (int k = 0; k < blockSize * blockSize; ++k) {
+        int u = zigzag[k] / blockSize;
+        int v = zigzag[k] % blockSize;
+        double weight = (u == 0 ? std::sqrt(0.5) : 1.0) * (v == 0 ? std::sqrt(0.5) : 1.0);
+        dequantize[zigzag[k]] = quantizer[std::min(k, 63)] * 2.0 * blockSize / weight;
+    }
+
+    if (!hasFixedSizeDct(blockSize)) {
+        // The same cached plan BlockManager uses for its full blocks.
+        inversePlan = PlanCache::instance().getPlan(blockSize, blockSize, PlanCache::Kind::Inverse);
+    }
+    return !segments.empty();
+}
+
+void JpegDecoder::inverseBlock(double *block) const {
+    if (blockSize == 8) {
+        Dct2D<8>::inverse(block);
+    } else if (blockSize == 16) {
+        Dct2D<16>::inverse(block);
+    } else {
+        fftw_execute_r2r(inversePlan, block, block);
+    }
+}
+
+void JpegDecoder::decodeSegment(const Segment &segment, const QRect &blocks, const QRect &region, uchar *pixels, int stride) const {
+    const uchar *bytes = (const uchar*) data.constData();
+    BitReader reader(bytes + segment.begin, bytes + segment.end);
+
+    const DecodingTable &dc = dcTables[dcIndex];
+    const DecodingTable &ac = acTables[acIndex];
+    int area = blockSize * blockSize;
+    double scale = 1.0 / (4.0 * area);
+
+    // Blocks after the last one of the region are never needed.
+    int lastNeeded = blocks.bottom() * columns + blocks.right();
+    int stop = std::min(std::min(segment.firstBlock + restartInterval, rows * columns), lastNeeded + 1);
+
+    std::vector<int> coefficients(area);
+    double *block = fftw_alloc_real(area);
+    int predictor = 0;
+
+    for (int index = segment.firstBlock; index < stop; ++index) {
+        std::fill(coefficients.begin(), coefficients.end(), 0);
+
+        int category = decodeSymbol(reader, dc);
+        if (category < 0) {
+            break;
+        }
+        predictor += extend(reader.receive(category), category);
+        coefficients[0] = predictor;
+
+        bool corrupt = false;
+        for (int k = 1; k < area;) {
+            int symbol = decodeSymbol(reader, ac);
+            if (symbol < 0) {
+                corrupt = true;
+                break;
+            }
+            int run = symbol >> 4;
+            int size = symbol & 15;
+            if (size == 0) {
+                if (run != 15) {
+                    break;
+                }
+                k += 16;
+                continue;
+            }
+            k += run;
+            if (k >= area) {
+                corrupt = true;
+                break;
+            }
+            coefficients[zigzag[k]] = extend(reader.receive(size), size);
+            ++k;
+        }
+        if (corrupt) {
+            break;
+        }
+
+        int row = index / columns;
+        int column = index % columns;
+        if (row < blocks.top() || column < blocks.left() || column > blocks.right()) {
+            continue;
+        }
+
+        for (int i = 0; i < area; ++i) {
+            block[i] = coefficients[i] * dequantize[i];
+        }
+        // Level shift: +128 on every pixel is 128 * 4 * N * N on the unnormalized DC.
+        block[0] += 512.0 * area;
+        inverseBlock(block);
+
+        int top = std::max(row * blockSize, region.top());
+        int bottom = std::min((row + 1) * blockSize, region.bottom() + 1);
+        int left = std::max(column * blockSize, region.left());
+        int right = std::min((column + 1) * blockSize, region.right() + 1);
+        for (int y = top; y < bottom; ++y) {
+            uchar *line = pixels + (y - region.top()) * stride - region.left();
+            const double *source = block + (y - row * blockSize) * blockSize - column * blockSize;
+            for (int x = left; x < right; ++x) {
+                double value = std::round(source[x] * scale);
+                line[x] = (uchar) std::min(std::max(value, 0.0), 255.0);
+            }
+        }
+    }
+
+    fftw_free(block);
+}
+
+QImage JpegDecoder::decode() {
+    return decode(QRect(0, 0, imgWidth, imgHeight));
+}
+
+QImage JpegDecoder::decode(const QRect &region) {
+    QRect area = region.intersected(QRect(0, 0, imgWidth, imgHeight));
+    if (!valid || area.isEmpty()) {
+        return QImage();
+    }
+
+    QImage output(area.width(), area.height(), QImage::Format_Grayscale8);
+    output.fill(0);
+    int firstColumn = area.left() / blockSize;
+    int firstRow = area.top() / blockSize;
+    QRect blocks(firstColumn, firstRow, area.right() / blockSize - firstColumn + 1, area.bottom() / blockSize - firstRow + 1);
+
+    int firstNeeded = blocks.top() * columns + blocks.left();
+    int lastNeeded = blocks.bottom() * columns + blocks.right();
+    std::vector<const Segment*> needed;
+    for (const Segment &segment : segments) {
+        if (segment.firstBlock <= lastNeeded && segment.firstBlock + restartInterval > firstNeeded) {
+            needed.push_back(&segment);
+        }
+    }
+
+    uchar *pixels = output.bits();
+    int stride = output.bytesPerLine();
+    pool->parallelFor((int) needed.size(), [&](int i){
+        decodeSegment(*needed[i], blocks, area, pixels, stride);
+    });
+    return output;
+}
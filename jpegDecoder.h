@@ -0,0 +1,75 @@
+#ifndef JPEG_DECODER_H
+#define JPEG_DECODER_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QRect>
+#include <cstdint>
+#include <fftw3.h>
+#include <vector>
+#include "jpegCommon.h"
+
+class ThreadPool;
+
+// Reads back the single component streams written by JpegEncoder (and
+// other baseline grayscale JPEGs). The entropy-coded data is split at the
+// restart markers up front, so every restart interval is Huffman decoded
+// and inverse transformed on its own pool task. decode(region) only touches
+// the intervals overlapping the region and only transforms its blocks.
+class JpegDecoder {
+
+public:
+    explicit JpegDecoder(const QByteArray &data, ThreadPool *pool = nullptr);
+
+    bool isValid() const;
+    int getWidth() const;
+    int getHeight() const;
+    int getBlockSize() const;
+    QImage decode();
+    QImage decode(const QRect &region);
+
+private:
+    struct DecodingTable {
+        int maxCode[jpeg::maxCodeLength + 2];
+        int valueOffset[jpeg::maxCodeLength + 1];
+        std::uint8_t lookupLength[256];
+        std::uint8_t lookupValue[256];
+        std::vector<std::uint8_t> values;
+        bool defined = false;
+
+        void build(const std::uint8_t bits[jpeg::maxCodeLength + 1], const std::vector<std::uint8_t> &symbols);
+    };
+
+    struct Segment {
+        int begin;
+        int end;
+        int firstBlock;
+    };
+
+    bool parse();
+    bool parseScan(int position);
+    void decodeSegment(const Segment &segment, const QRect &blocks, const QRect &region, uchar *pixels, int stride) const;
+    void inverseBlock(double *block) const;
+
+    QByteArray data;
+    ThreadPool *pool;
+    bool valid;
+    int imgWidth;
+    int imgHeight;
+    int blockSize;
+    int rows;
+    int columns;
+    int restartInterval;
+    int quantizerIndex;
+    int dcIndex;
+    int acIndex;
+    std::vector<int> quantizers[4];
+    DecodingTable dcTables[4];
+    DecodingTable acTables[4];
+    std::vector<int> zigzag;
+    std::vector<double> dequantize;
+    std::vector<Segment> segments;
+    fftw_plan inversePlan;
+};
+
+#endif
@@ -0,0 +1,418 @@
+#include "jpegEncoder.h"
+#include "blockManager.h"
+#include "blockStore.h"
+#include "threadPool.h"
+#include "planCache.h"
+#include "dct2d.h"
+#include <fftw3.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+
+namespace {
+
+class BitWriter {
+
+public:
+    explicit BitWriter(std::vector<std::uint8_t> &bytes): bytes(bytes), buffer(0), count(0) {
+    }
+
+    void write(std::uint32_t bits, int length) {
+        buffer = (buffer << length) | (bits & ((1u << length) - 1));
+        count += length;
+        while (count >= 8) {
+            count -= 8;
+            std::uint8_t byte = (buffer >> count) & 0xFF;
+            bytes.push_back(byte);
+            if (byte == 0xFF) {
+                bytes.push_back(0x00);
+            }
+        }
+    }
+
+    // Pads the last byte with one bits, as required before a marker.
+    void flush() {
+        if (count > 0) {
+            write(0x7F, 8 - count);
+        }
+    }
+
+private:
+    std::vector<std::uint8_t> &bytes;
+    std::uint64_t buffer;
+    int count;
+};
+
+// Walks the DC difference and AC run/size symbols of every block in an
+// interval in bitstream order; the coefficients are already in zigzag order.
+template<typename DcVisitor, typename AcVisitor>
+void visitSymbols(const std::vector<std::int16_t> &coefficients, int blockArea, DcVisitor onDc, AcVisitor onAc) {
+    int predictor = 0;
+    for (size_t start = 0; start < coefficients.size(); start += blockArea) {
+        const std::int16_t *block = coefficients.data() + start;
+
+        int difference = block[0] - predictor;
+        predictor = block[0];
+        onDc(jpeg::magnitudeCategory(difference), difference);
+
+        int last = blockArea - 1;
+        while (last > 0 && block[last] == 0) {
+            --last;
+        }
+
+        int run = 0;
+        for (int k = 1; k <= last; ++k) {
+            if (block[k] == 0) {
+                ++run;
+                continue;
+            }
+            while (run > 15) {
+                onAc(0xF0, 0, 0);
+                run -= 16;
+            }
+            int size = jpeg::magnitudeCategory(block[k]);
+            onAc((run << 4) | size, size, block[k]);
+            run = 0;
+        }
+
+        if (last < blockArea - 1) {
+            onAc(0x00, 0, 0);
+        }
+    }
+}
+
+// Magnitude bits of a DC difference or AC value: negative values are sent
+// as value - 1 in size bits.
+std::uint32_t magnitudeBits(int value, int size) {
+    return value < 0 ? (std::uint32_t)(value - 1) & ((1u << size) - 1) : (std::uint32_t) value;
+}
+
+void appendMarker(QByteArray &out, std::uint8_t marker) {
+    out.append((char) 0xFF);
+    out.append((char) marker);
+}
+
+void appendWord(QByteArray &out, int value) {
+    out.append((char)((value >> 8) & 0xFF));
+    out.append((char)(value & 0xFF));
+}
+
+void appendHuffmanTable(QByteArray &out, int tableClass, const jpeg::HuffmanTable &table) {
+    appendMarker(out, jpeg::DHT);
+    appendWord(out, 2 + 1 + jpeg::maxCodeLength + (int) table.values.size());
+    out.append((char)(tableClass << 4));
+    for (int length = 1; length <= jpeg::maxCodeLength; ++length) {
+        out.append((char) table.bits[length]);
+    }
+    out.append((const char*) table.values.data(), (int) table.values.size());
+}
+
+}
+
+template<typename Sample>
+BasicJpegEncoder<Sample>::BasicJpegEncoder(BasicBlockManager<Sample> &manager): manager(manager), blockSize(manager.getBlockSize()) {
+    // Baseline limits AC magnitudes to 10 bits and DC to 11. The private
+    // format takes values up to category 15 (DC differences up to 16). By
+    // Parseval no orthonormal coefficient of a level shifted block exceeds
+    // 128 * N, so from 256 on the step must grow for the values to fit.
+    bool baseline = blockSize == jpeg::baselineBlockSize;
+    maxCoefficient = baseline ? 1023 : 32767;
+    maxDc = baseline ? 2047 : 32767;
+    minimumStep = baseline ? 1 : (128 * blockSize + maxCoefficient - 1) / maxCoefficient;
+    quantizerStep = std::min(minimumStep, 255);
+    zigzag = jpeg::zigzagOrder(blockSize);
+}
+
+template<typename Sample>
+void BasicJpegEncoder<Sample>::setQuantizerStep(int step) {
+    quantizerStep = std::min(std::max(step, minimumStep), 255);
+}
+
+template<typename Sample>
+int BasicJpegEncoder<Sample>::getQuantizerStep() const {
+    return quantizerStep;
+}
+
+template<typename Sample>
+void BasicJpegEncoder<Sample>::quantizeRow(int row, Interval &interval) {
+    const BasicBlockManager<Sample> &blocks = manager;
+    int area = blockSize * blockSize;
+    BlockStore<Sample> pixelStore(1, 1, blockSize);
+    Sample *pixels = pixelStore.block(0, 0);
+    double *padded = fftw_alloc_real(area);
+
+    // Stored coefficients and the re-transformed edge blocks have different
+    // scales; both are brought to the orthonormal DCT before quantizing.
+    std::vector<double> storedScale(area);
+    std::vector<double> paddedScale(area);
+    for (int i = 0; i < area; ++i) {
+        storedScale[i] = manager.getCoefficientScale(i / blockSize, i % blockSize);
+        paddedScale[i] = TransformBackend<double>::coefficientScale(i / blockSize, i % blockSize, blockSize);
+    }
+
+    interval.coefficients.assign((size_t) manager.columns * area, 0);
+
+    for (int column = 0; column < manager.columns; ++column) {
+        int blockWidth = manager.getBlockWidth(row, column);
+        int blockHeight = manager.getBlockHeight(row, column);
+        bool full = blockWidth == blockSize && blockHeight == blockSize;
+        const Sample *source = blocks.getCoefficients(row, column);
+        int limit;
+
+        if (full) {
+            limit = manager.getAdjustedCut(row, column);
+        } else {
+            // Streams only carry full blocks: edge blocks are reconstructed,
+            // padded by replicating their last row / column and re-transformed.
+            manager.reconstructBlock(row, column, pixels);
+            for (int u = 0; u < blockSize; ++u) {
+                for (int v = 0; v < blockSize; ++v) {
+                    padded[u * blockSize + v] = pixels[std::min(u, blockHeight - 1) * blockSize + std::min(v, blockWidth - 1)];
+                }
+            }
+
+            if (blockSize == 8) {
+                Dct2D<8>::forward(padded);
+            } else if (blockSize == 16) {
+                Dct2D<16>::forward(padded);
+            } else {
+                fftw_execute_r2r(PlanCache::instance().getPlan(blockSize, blockSize, PlanCache::Kind::Forward), padded, padded);
+            }
+            limit = manager.getCutDimension();
+        }
+
+        std::int16_t *out = interval.coefficients.data() + (size_t) column * area;
+        for (int k = 0; k < area; ++k) {
+            int u = zigzag[k] / blockSize;
+            int v = zigzag[k] % blockSize;
+            if (u + v >= limit) {
+                break;
+            }
+
+            int index = zigzag[k];
+            double value = full ? source[index] * storedScale[index] : padded[index] * paddedScale[index];
+            if (k == 0) {
+                value -= 128.0 * blockSize;
+            }
+
+            int bound = k == 0 ? maxDc : maxCoefficient;
+            int quantized = (int) std::lround(value / quantizerStep);
+            out[k] = (std::int16_t) std::min(std::max(quantized, -bound), bound);
+        }
+    }
+
+    fftw_free(padded);
+}
+
+template<typename Sample>
+void BasicJpegEncoder<Sample>::countSymbols(const Interval &interval, std::uint64_t dcFrequencies[256], std::uint64_t acFrequencies[256]) const {
+    visitSymbols(interval.coefficients, blockSize * blockSize,
+                 [&](int category, int){ ++dcFrequencies[category]; },
+                 [&](int symbol, int, int){ ++acFrequencies[symbol]; });
+}
+
+template<typename Sample>
+void BasicJpegEncoder<Sample>::encodeInterval(Interval &interval, const jpeg::HuffmanTable &dc, const jpeg::HuffmanTable &ac) const {
+    BitWriter writer(interval.bytes);
+    visitSymbols(interval.coefficients, blockSize * blockSize,
+                 [&](int category, int difference){
+                     writer.write(dc.codes[category], dc.lengths[category]);
+                     if (category > 0) {
+                         writer.write(magnitudeBits(difference, category), category);
+                     }
+                 },
+                 [&](int symbol, int size, int value){
+                     writer.write(ac.codes[symbol], ac.lengths[symbol]);
+                     if (size > 0) {
+                         writer.write(magnitudeBits(value, size), size);
+                     }
+                 });
+    writer.flush();
+
+    std::vector<std::int16_t>().swap(interval.coefficients);
+}
+
+template<typename Sample>
+void BasicJpegEncoder<Sample>::writeHeaders(QByteArray &out, const jpeg::HuffmanTable &dc, const jpeg::HuffmanTable &ac, int restartInterval) const {
+    bool baseline = blockSize == jpeg::baselineBlockSize;
+
+    appendMarker(out, jpeg::SOI);
+
+    appendMarker(out, jpeg::APP0);
+    appendWord(out, 16);
+    out.append("JFIF", 5);
+    out.append((char) 1);
+    out.append((char) 1);
+    out.append((char) 0);
+    appendWord(out, 1);
+    appendWord(out, 1);
+    out.append((char) 0);
+    out.append((char) 0);
+
+    if (!baseline) {
+        appendMarker(out, jpeg::APP11);
+        appendWord(out, 2 + 5 + 1 + 2);
+        out.append("JPGC", 5);
+        out.append((char) 1);
+        appendWord(out, blockSize);
+    }
+
+    // The cut is the real quantizer; the table only carries a flat step.
+    appendMarker(out, jpeg::DQT);
+    appendWord(out, 2 + 1 + 64);
+    out.append((char) 0);
+    for (int i = 0; i < 64; ++i) {
+        out.append((char) quantizerStep);
+    }
+
+    appendMarker(out, baseline ? jpeg::SOF0 : jpeg::SOF_PRIVATE);
+    appendWord(out, 2 + 6 + 3);
+    out.append((char) 8);
+    appendWord(out, manager.imgHeight);
+    appendWord(out, manager.imgWidth);
+    out.append((char) 1);
+    out.append((char) 1);
+    out.append((char) 0x11);
+    out.append((char) 0);
+
+    appendHuffmanTable(out, 0, dc);
+    appendHuffmanTable(out, 1, ac);
+
+    appendMarker(out, jpeg::DRI);
+    appendWord(out, 4);
+    appendWord(out, restartInterval);
+
+    appendMarker(out, jpeg::SOS);
+    appendWord(out, 2 + 1 + 2 + 3);
+    out.append((char) 1);
+    out.append((char) 1);
+    out.append((char) 0x00);
+    out.append((char) 0);
+    out.append((char) 63);
+    out.append((char) 0);
+}
+
+template<typename Sample>
+QByteArray BasicJpegEncoder<Sample>::encode(const std::function<bool()> &cancelled) {
+    if (manager.imgWidth > 0xFFFF || manager.imgHeight > 0xFFFF || quantizerStep < minimumStep) {
+        return QByteArray();
+    }
+
+    int rows = manager.rows;
+    std::vector<Interval> intervals(rows);
+    std::vector<std::array<std::uint64_t, 256>> dcCounts(rows);
+    std::vector<std::array<std::uint64_t, 256>> acCounts(rows);
+    ThreadPool *pool = manager.getThreadPool();
+    std::atomic<bool> aborted(false);
+
+    pool->parallelFor(rows, [&](int row){
+        dcCounts[row].fill(0);
+        acCounts[row].fill(0);
+        if (aborted.load(std::memory_order_relaxed) || (cancelled && cancelled())) {
+            aborted.store(true, std::memory_order_relaxed);
+            return;
+        }
+        quantizeRow(row, intervals[row]);
+        countSymbols(intervals[row], dcCounts[row].data(), acCounts[row].data());
+    });
+    if (aborted) {
+        return QByteArray();
+    }
+
+    std::uint64_t dcFrequencies[256] = {};
+    std::uint64_t acFrequencies[256] = {};
+    for (int row = 0; row < rows; ++row) {
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            dcFrequencies[symbol] += dcCounts[row][symbol];
+            acFrequencies[symbol] += acCounts[row][symbol];
+        }
+    }
+
+    jpeg::HuffmanTable dc = jpeg::buildHuffmanTable(dcFrequencies);
+    jpeg::HuffmanTable ac = jpeg::buildHuffmanTable(acFrequencies);
+
+    pool->parallelFor(rows, [&](int row){
+        if (aborted.load(std::memory_order_relaxed) || (cancelled && cancelled())) {
+            aborted.store(true, std::memory_order_relaxed);
+            return;
+        }
+        encodeInterval(intervals[row], dc, ac);
+    });
+    if (aborted) {
+        return QByteArray();
+    }
+
+    QByteArray out;
+    writeHeaders(out, dc, ac, manager.columns);
+    for (int row = 0; row < rows; ++row) {
+        if (row > 0) {
+            appendMarker(out, jpeg::RST0 + (row - 1) % 8);
+        }
+        out.append((const char*) intervals[row].bytes.data(), (int) intervals[row].bytes.size());
+        std::vector<std::uint8_t>().swap(intervals[row].bytes);
+    }
+    appendMarker(out, jpeg::EOI);
+
+    return out;
+}
+
+template<typename Sample>
+std::vector<int> BasicJpegEncoder<Sample>::sampleRows(int blocks) const {
+    int count = std::min(manager.rows, std::max(1, (blocks + manager.columns - 1) / manager.columns));
+    std::vector<int> rows(count);
+    for (int k = 0; k < count; ++k) {
+        rows[k] = (2 * k + 1) * manager.rows / (2 * count);
+    }
+    return rows;
+}
+
+template<typename Sample>
+double BasicJpegEncoder<Sample>::estimateSize(const std::vector<int> &rows) {
+    if (rows.empty()) {
+        return 0;
+    }
+
+    int count = (int) rows.size();
+    std::vector<Interval> intervals(count);
+    std::vector<std::array<std::uint64_t, 256>> dcCounts(count);
+    std::vector<std::array<std::uint64_t, 256>> acCounts(count);
+    std::vector<std::uint64_t> magnitudeBits(count, 0);
+
+    manager.getThreadPool()->parallelFor(count, [&](int index){
+        dcCounts[index].fill(0);
+        acCounts[index].fill(0);
+        quantizeRow(rows[index], intervals[index]);
+        visitSymbols(intervals[index].coefficients, blockSize * blockSize,
+                     [&](int category, int){ ++dcCounts[index][category]; magnitudeBits[index] += category; },
+                     [&](int symbol, int size, int){ ++acCounts[index][symbol]; magnitudeBits[index] += size; });
+        std::vector<std::int16_t>().swap(intervals[index].coefficients);
+    });
+
+    std::uint64_t dcFrequencies[256] = {};
+    std::uint64_t acFrequencies[256] = {};
+    double bits = 0;
+    for (int index = 0; index < count; ++index) {
+        for (int symbol = 0; symbol < 256; ++symbol) {
+            dcFrequencies[symbol] += dcCounts[index][symbol];
+            acFrequencies[symbol] += acCounts[index][symbol];
+        }
+        bits += magnitudeBits[index];
+    }
+
+    jpeg::HuffmanTable dc = jpeg::buildHuffmanTable(dcFrequencies);
+    jpeg::HuffmanTable ac = jpeg::buildHuffmanTable(acFrequencies);
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        bits += (double) dcFrequencies[symbol] * dc.lengths[symbol] + (double) acFrequencies[symbol] * ac.lengths[symbol];
+    }
+
+    // Every interval ends on a padded byte behind a restart marker.
+    QByteArray headers;
+    writeHeaders(headers, dc, ac, manager.columns);
+    double intervalBytes = bits / 8 / count + 0.5;
+    return headers.size() + intervalBytes * manager.rows + 2.0 * (manager.rows - 1) + 2;
+}
+
+template class BasicJpegEncoder<double>;
+template class BasicJpegEncoder<float>;
+template class BasicJpegEncoder<std::int32_t>;
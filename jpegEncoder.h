@@ -0,0 +1,58 @@
+#ifndef JPEG_ENCODER_H
+#define JPEG_ENCODER_H
+
+#include <QByteArray>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "jpegCommon.h"
+
+template<typename Sample> class BasicBlockManager;
+
+// Entropy codes the cut coefficients held by a BlockManager of any
+// precision. Every block row is its own restart interval, so rows are
+// quantized, counted and Huffman coded in parallel and only concatenated
+// at the end. Huffman tables are optimized per image.
+template<typename Sample>
+class BasicJpegEncoder {
+
+public:
+    explicit BasicJpegEncoder(BasicBlockManager<Sample> &manager);
+
+    // Steps below the smallest one whose coefficients the stream can hold
+    // (1 for blocks up to 255) are raised to it.
+    void setQuantizerStep(int step);
+    int getQuantizerStep() const;
+    // Empty when cancelled, which is checked before every block row.
+    QByteArray encode(const std::function<bool()> &cancelled = nullptr);
+    // Whole block rows spread evenly over the image, about blocks blocks in
+    // all, so estimateSize() sees real DC prediction and restart intervals.
+    std::vector<int> sampleRows(int blocks) const;
+    // Predicted size of encode() from only the given block rows, which are
+    // quantized and counted exactly as encode() would; their coded bits are
+    // scaled up to all rows.
+    double estimateSize(const std::vector<int> &rows);
+
+private:
+    struct Interval {
+        std::vector<std::int16_t> coefficients;
+        std::vector<std::uint8_t> bytes;
+    };
+
+    void quantizeRow(int row, Interval &interval);
+    void countSymbols(const Interval &interval, std::uint64_t dcFrequencies[256], std::uint64_t acFrequencies[256]) const;
+    void encodeInterval(Interval &interval, const jpeg::HuffmanTable &dc, const jpeg::HuffmanTable &ac) const;
+    void writeHeaders(QByteArray &out, const jpeg::HuffmanTable &dc, const jpeg::HuffmanTable &ac, int restartInterval) const;
+
+    BasicBlockManager<Sample> &manager;
+    int blockSize;
+    int quantizerStep;
+    int maxCoefficient;
+    int maxDc;
+    int minimumStep;
+    std::vector<int> zigzag;
+};
+
+typedef BasicJpegEncoder<double> JpegEncoder;
+
+#endif
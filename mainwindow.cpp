@@ -13,11 +13,26 @@
 #include <iostream>
 #include <assert.h>
 #include <algorithm>
+#include <cmath>
 #include <QScrollBar>
 #include "blockManager.h"
+#include "planCache.h"
+#include "jpegEncoder.h"
+#include "tileView.h"
+#include "pyramidView.h"
+#include "imagePyramid.h"
 #include <QColor>
+#include <QDir>
+#include <QStandardPaths>
+#include <QShortcut>
+#include <QTimer>
+#include "profiler.h"
 
 #define ZOOM_SCALE_INCREMENT  0.5
+#define ZOOM_MINIMUM_SCALE    (1.0 / 64)
+#define TILE_PREFETCH_MARGIN  256
+#define PROFILE_REFRESH_MS    500
+#define SIZE_SAMPLE_BLOCKS    1024
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -25,11 +40,26 @@ MainWindow::MainWindow(QWidget *parent)
     qualityFactor(2),
     buffer(new QBuffer()),
     image(nullptr),
-    imageCompressed(nullptr),
+    originalView(nullptr),
+    compressedView(nullptr),
     blockSize(10),
     blockManager(nullptr),
     scaleFactor(1),
-    currentPixmapSize(nullptr)
+    currentPixmapSize(nullptr),
+    profileOverlay(nullptr),
+    profileTimer(nullptr),
+    encodedSize(-1),
+    encodedSizeExact(false),
+    showHeatmap(false),
+    compressionGeneration(0),
+    queuedGeneration(0),
+    queuedCutDimension(0),
+    queuedLevel(0),
+    reportedGeneration(0),
+    encodedGeneration(0),
+    compressionQueued(false),
+    compressionRunning(false),
+    stopCompression(false)
 {
     ui->setupUi(this);
     findChild<QPushButton*>("zoomIn")->setIcon(QIcon(":/icons/zoomIn.png"));
@@ -37,6 +67,32 @@ MainWindow::MainWindow(QWidget *parent)
     findChild<QLabel*>("labelQualityValue")->setAlignment(Qt::AlignCenter);
     updateMaximalValues();
 
+    QString wisdomDirectory = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    if (qEnvironmentVariableIsEmpty("JPEGC_WISDOM") && !wisdomDirectory.isEmpty() && QDir().mkpath(wisdomDirectory)) {
+        PlanCache::instance().setWisdomFile(QDir(wisdomDirectory).filePath("fftw.wisdom").toStdString());
+    }
+
+    connect(this, &MainWindow::tileReady, this, &MainWindow::onTileReady, Qt::QueuedConnection);
+    connect(this, &MainWindow::compressionReady, this, &MainWindow::onCompressionFinished, Qt::QueuedConnection);
+    connect(this, &MainWindow::qualityReady, this, &MainWindow::onQualityReady, Qt::QueuedConnection);
+    compressionThread = std::thread(&MainWindow::compressionLoop, this);
+
+    // F3 shows the stage breakdown of the pipeline over the compressed pane,
+    // Shift+F3 saves it as JSON.
+    profileOverlay = new QLabel(findChild<QScrollArea*>("scrollCompressed"));
+    profileOverlay->setStyleSheet("background-color: rgba(0, 0, 0, 160); color: white; padding: 4px;");
+    profileOverlay->setFont(QFont("monospace"));
+    profileOverlay->setTextFormat(Qt::PlainText);
+    profileOverlay->setAttribute(Qt::WA_TransparentForMouseEvents);
+    profileOverlay->hide();
+    profileTimer = new QTimer(this);
+    profileTimer->setInterval(PROFILE_REFRESH_MS);
+    connect(profileTimer, &QTimer::timeout, this, &MainWindow::updateProfileOverlay);
+    connect(new QShortcut(QKeySequence(Qt::Key_F3), this), &QShortcut::activated, this, &MainWindow::toggleProfileOverlay);
+    connect(new QShortcut(QKeySequence(Qt::SHIFT | Qt::Key_F3), this), &QShortcut::activated, this, &MainWindow::saveProfile);
+    // F4 overlays the per-block error heatmap on the compressed pane.
+    connect(new QShortcut(QKeySequence(Qt::Key_F4), this), &QShortcut::activated, this, &MainWindow::toggleHeatmap);
+
     QScrollBar *horizontalScroll = findChild<QScrollBar*>("horizontalScrollBar");
     QScrollBar *verticalScroll = findChild<QScrollBar*>("verticalScrollBar");
 
@@ -59,11 +115,18 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    cancelCompression();
+    {
+        std::lock_guard<std::mutex> lock(compressionMutex);
+        stopCompression = true;
+    }
+    compressionCondition.notify_all();
+    compressionThread.join();
+
     delete ui;
     delete image;
     delete currentPixmapSize;
     delete blockManager;
-    delete imageCompressed;
 }
 
 void MainWindow::on_loadButton_clicked() {
@@ -73,60 +136,318 @@ void MainWindow::on_loadButton_clicked() {
         file.open(QIODevice::ReadOnly);
         double size = file.size();
         file.close();
-        auto *label = new QLabel();
-        auto *scroll = findChild<QScrollArea*>("scrollOriginal");
-        QPixmap bitmap(select);
-        label->setObjectName("originalImage");
-        label->setPixmap(bitmap);
-        label->setScaledContents(true);
-        label->setAlignment(Qt::AlignCenter);
-        scroll->setWidget(label);
+        QImage loaded(select);
+        if (loaded.isNull()) {
+            return;
+        }
 
         scaleFactor = 1;
 
         if (image == nullptr) {
-            image = new QImage(bitmap.toImage());
-            currentPixmapSize = new QSize(bitmap.size());
+            image = new QImage(loaded);
+            currentPixmapSize = new QSize(loaded.size());
         } else {
-            *image = bitmap.toImage();
-            *currentPixmapSize = bitmap.size();
+            *image = loaded;
+            *currentPixmapSize = loaded.size();
         }
 
+        originalView = new PyramidView(ImagePyramid(*image));
+        originalView->setObjectName("originalImage");
+        findChild<QScrollArea*>("scrollOriginal")->setWidget(originalView);
+
         findChild<QLabel*>("labelOriginalTitle")->setText("<h3>Original (" + QString::number(size / 1000.0) +  " KB)</h3>");
-        findChild<QLabel*>("labelCompressedTitle")->setText("<h3>Compressed</h3>");
+        encodedSize = -1;
+        qualityText.clear();
+        qualityHeatmap = QImage();
+        updateCompressedTitle();
         updateMaximalValues();
-        blockManager = new BlockManager(image, blockSize, qualityFactor);
+        replaceBlockManager();
+        tileCache.clear();
+
+        compressedView = new TileView(&tileCache);
+        compressedView->setObjectName("compressedImage");
+        compressedView->setAttribute(Qt::WA_TransparentForMouseEvents);
+        compressedView->setImageSize(image->size());
+        compressedView->setParameters(blockSize, qualityFactor);
+        connect(compressedView, &TileView::tilesMissing, this, &MainWindow::requestVisibleTiles, Qt::QueuedConnection);
+        findChild<QScrollArea*>("scrollCompressed")->setWidget(compressedView);
 
         startCompression();
+        updateImageSize(scaleFactor);
+    }
+}
+
+void MainWindow::onTileReady(int row, int column, int level, int cutDimension, quint64 generation) {
+    if (generation != compressionGeneration.load() || compressedView == nullptr) {
+        return;
+    }
+    compressedView->updateTile(row, column, level, cutDimension);
+}
+
+void MainWindow::onCompressionFinished(qint64 encodedSize, bool exact, quint64 generation) {
+    // A newer request was queued after this one started; its result is on the way.
+    if (generation != compressionGeneration.load()) {
+        return;
+    }
+
+    this->encodedSize = encodedSize;
+    this->encodedSizeExact = exact;
+    updateCompressedTitle();
+}
+
+void MainWindow::onQualityReady(double psnr, double ssim, double coverage, const QImage &heatmap, quint64 generation) {
+    if (generation != compressionGeneration.load()) {
+        return;
+    }
+
+    qualityText = coverage == 0 ? QString() : "PSNR " + QString::number(psnr, 'f', 2) + " dB, SSIM " + QString::number(ssim, 'f', 4);
+    if (coverage > 0 && coverage < 1) {
+        qualityText += " over " + QString::number(coverage * 100, 'f', 0) + "% of blocks";
+    }
+    qualityHeatmap = heatmap;
+    if (compressedView != nullptr) {
+        compressedView->setHeatmap(showHeatmap ? qualityHeatmap : QImage());
+    }
+    updateCompressedTitle();
+}
+
+void MainWindow::toggleHeatmap() {
+    showHeatmap = !showHeatmap;
+    if (compressedView != nullptr) {
+        compressedView->setHeatmap(showHeatmap ? qualityHeatmap : QImage());
+    }
+}
+
+void MainWindow::updateCompressedTitle() {
+    QString title = "Compressed";
+    if (encodedSize >= 0) {
+        title += QString(encodedSizeExact ? " (" : " (~") + QString::number(encodedSize / 1000.0) + " KB)";
     }
+    if (!qualityText.isEmpty()) {
+        title += "<br>" + qualityText;
+    }
+    findChild<QLabel*>("labelCompressedTitle")->setText("<h3>" + title + "</h3>");
+}
+
+// Quality is measured on every full-resolution block the tiles reconstruct,
+// so it covers what has been rendered of the current request so far.
+void MainWindow::reportQuality(quint64 generation) {
+    QualityMetrics quality = blockManager->getQualityMetrics();
+    emit qualityReady(quality.getPsnr(), quality.getSsim(), quality.getCoverage(), quality.heatmap(), generation);
 }
 
-void MainWindow::onCompressionFinished() {
-    int oldVertical = verticalScrollValue;
-    int oldHorizontal = horizontalScrollValue;
+void MainWindow::requestVisibleTiles() {
+    if (compressedView == nullptr) {
+        return;
+    }
 
-    QLabel *label = new QLabel();
-    label->setAlignment(Qt::AlignCenter);
     QScrollArea *scroll = findChild<QScrollArea*>("scrollCompressed");
-    QPixmap compressed;
-    compressed.convertFromImage(*imageCompressed);
-
-    label->setPixmap(compressed);
-    label->setObjectName("compressedImage");
-    label->setAttribute(Qt::WA_TransparentForMouseEvents);
-    label->setScaledContents(true);
-    scroll->setWidget(label);
-    updateImageSize(scaleFactor);
-    scroll->horizontalScrollBar()->setValue(oldHorizontal);
-    scroll->verticalScrollBar()->setValue(oldVertical);
+    QRect visible = QRect(-compressedView->pos(), scroll->viewport()->size()).intersected(compressedView->rect());
+    {
+        std::lock_guard<std::mutex> lock(compressionMutex);
+        queuedViewport = compressedView->mapToImage(visible);
+        queuedLevel = compressedView->getLevel();
+        // An idle worker goes over the current request again, picking up
+        // tiles that were scrolled into view or evicted since.
+        if (!compressionRunning && !compressionQueued && queuedGeneration == compressionGeneration.load()) {
+            compressionQueued = true;
+        }
+    }
+    compressionCondition.notify_all();
 }
 
 void MainWindow::startCompression(){
-    auto *oldImage = imageCompressed;
-    imageCompressed = blockManager->compress();
-    delete oldImage;
+    if (compressedView != nullptr) {
+        compressedView->setParameters(blockSize, qualityFactor);
+    }
+    {
+        std::lock_guard<std::mutex> lock(compressionMutex);
+        queuedGeneration = ++compressionGeneration;
+        queuedCutDimension = qualityFactor;
+        compressionQueued = true;
+    }
+    compressionCondition.notify_all();
+}
+
+void MainWindow::compressionLoop() {
+    while (true) {
+        quint64 generation;
+        int cutDimension;
+        {
+            std::unique_lock<std::mutex> lock(compressionMutex);
+            compressionCondition.wait(lock, [this](){ return stopCompression || compressionQueued; });
+            if (stopCompression) {
+                return;
+            }
+
+            generation = queuedGeneration;
+            cutDimension = queuedCutDimension;
+            compressionQueued = false;
+            compressionRunning = true;
+        }
+
+        compressTiles(generation, cutDimension);
+
+        {
+            std::lock_guard<std::mutex> lock(compressionMutex);
+            compressionRunning = false;
+        }
+        compressionCondition.notify_all();
+    }
+}
+
+// Produces the tiles of one request: the visible ones (plus a prefetch
+// margin) at the level the view draws from first, re-reading the viewport
+// after every tile, then an estimate of the encoded size from a sample of
+// block rows, then the rest of that level for as long as the cache has
+// room, and last the exact size, which a newer request cancels.
+void MainWindow::compressTiles(quint64 generation, int cutDimension) {
+    auto stale = [this, generation](){
+        return compressionGeneration.load(std::memory_order_relaxed) != generation;
+    };
+
+    int size = blockManager->getBlockSize();
+    int backgroundTile = 0;
+    int backgroundLevel = -1;
+    blockManager->setCutDimension(cutDimension);
+
+    while (!stale()) {
+        QRect viewport;
+        int level;
+        {
+            std::lock_guard<std::mutex> lock(compressionMutex);
+            viewport = queuedViewport;
+            level = queuedLevel;
+        }
+
+        int extent = (TileCache::tileBlocks(size) * size) << level;
+        int tileRows = (blockManager->imgHeight + extent - 1) / extent;
+        int tileColumns = (blockManager->imgWidth + extent - 1) / extent;
+
+        TileKey key{-1, -1, level, cutDimension, size};
+        if (!viewport.isEmpty()) {
+            int margin = TILE_PREFETCH_MARGIN << level;
+            QRect wanted = viewport.adjusted(-margin, -margin, margin, margin);
+            int firstRow = std::max(wanted.top(), 0) / extent;
+            int lastRow = std::min(wanted.bottom() / extent, tileRows - 1);
+            int firstColumn = std::max(wanted.left(), 0) / extent;
+            int lastColumn = std::min(wanted.right() / extent, tileColumns - 1);
+
+            for (int row = firstRow; row <= lastRow && key.row < 0; ++row) {
+                for (int column = firstColumn; column <= lastColumn; ++column) {
+                    if (!tileCache.contains(TileKey{row, column, level, cutDimension, size})) {
+                        key.row = row;
+                        key.column = column;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (key.row < 0) {
+            if (reportedGeneration != generation) {
+                JpegEncoder encoder(*blockManager);
+                qint64 estimate = std::llround(encoder.estimateSize(encoder.sampleRows(SIZE_SAMPLE_BLOCKS)));
+                emit compressionReady(estimate, false, generation);
+                reportQuality(generation);
+                reportedGeneration = generation;
+                continue;
+            }
+
+            if (backgroundLevel != level) {
+                backgroundLevel = level;
+                backgroundTile = 0;
+            }
+            while (backgroundTile < tileRows * tileColumns
+                   && tileCache.contains(TileKey{backgroundTile / tileColumns, backgroundTile % tileColumns, level, cutDimension, size})) {
+                ++backgroundTile;
+            }
+            if (backgroundTile == tileRows * tileColumns || tileCache.isFull()) {
+                reportQuality(generation);
+                if (encodedGeneration != generation) {
+                    // The size of the real entropy-coded stream. Scrolling
+                    // also interrupts it, so new tiles never wait behind it;
+                    // it is retried once they are done.
+                    auto interrupted = [&](){
+                        std::lock_guard<std::mutex> lock(compressionMutex);
+                        return stale() || queuedViewport != viewport || queuedLevel != level;
+                    };
+                    QByteArray stream = JpegEncoder(*blockManager).encode(interrupted);
+                    if (interrupted()) {
+                        continue;
+                    }
+                    if (!stream.isEmpty()) {
+                        emit compressionReady(stream.size(), true, generation);
+                    }
+                    encodedGeneration = generation;
+                }
+                return;
+            }
+            key.row = backgroundTile / tileColumns;
+            key.column = backgroundTile % tileColumns;
+        }
+
+        QImage tile = renderTile(key, stale);
+        if (tile.isNull()) {
+            return;
+        }
+        tileCache.insert(key, tile);
+        emit tileReady(key.row, key.column, key.level, cutDimension, generation);
+    }
+}
+
+// A coarser tile is the downsampled mosaic of its four finer tiles when
+// those are cached, otherwise its blocks are reconstructed at reduced size.
+QImage MainWindow::renderTile(const TileKey &key, const std::function<bool()> &stale) {
+    QSize imageSize(blockManager->imgWidth, blockManager->imgHeight);
+
+    if (key.level > 0) {
+        int extent = TileCache::tileBlocks(key.blockSize) * key.blockSize;
+        int shrink = 1 << (key.level - 1);
+        QRect pixels = TileCache::tilePixelRect(key.row, key.column, key.blockSize, imageSize, key.level);
+        QImage mosaic((pixels.width() + shrink - 1) / shrink, (pixels.height() + shrink - 1) / shrink, QImage::Format_Grayscale8);
+        bool complete = true;
+
+        for (int part = 0; part < 4 && complete; ++part) {
+            int row = 2 * key.row + part / 2;
+            int column = 2 * key.column + part % 2;
+            if (TileCache::tilePixelRect(row, column, key.blockSize, imageSize, key.level - 1).isEmpty()) {
+                continue;
+            }
+
+            QImage child;
+            complete = tileCache.lookup(TileKey{row, column, key.level - 1, key.cutDimension, key.blockSize}, child);
+            for (int y = 0; complete && y < child.height(); ++y) {
+                std::copy(child.constScanLine(y), child.constScanLine(y) + child.width(),
+                          mosaic.scanLine((part / 2) * extent + y) + (part % 2) * extent);
+            }
+        }
+        if (complete) {
+            return ImagePyramid::downsample(mosaic);
+        }
+    }
+
+    // Reduced inverse transforms go down to 1/8; coarser levels box filter the rest.
+    int denominator = std::min(1 << key.level, 8);
+    QImage tile = blockManager->compressReduced(denominator, TileCache::tileBlockRect(key.row, key.column, key.blockSize, key.level), stale);
+    for (int scale = denominator; scale < (1 << key.level) && !tile.isNull(); scale *= 2) {
+        tile = ImagePyramid::downsample(tile);
+    }
+    return tile;
+}
 
-    onCompressionFinished();
+void MainWindow::cancelCompression() {
+    std::unique_lock<std::mutex> lock(compressionMutex);
+    ++compressionGeneration;
+    compressionQueued = false;
+    compressionCondition.wait(lock, [this](){ return !compressionRunning; });
+}
+
+void MainWindow::replaceBlockManager() {
+    cancelCompression();
+    delete blockManager;
+    blockManager = new BlockManager(image, blockSize, qualityFactor);
+    blockManager->setQualityMetrics(true);
 }
 
 void MainWindow::updateScrollBar() {
@@ -138,14 +459,14 @@ void MainWindow::updateScrollBar() {
 
     scrollOriginal->verticalScrollBar()->setValue(verticalScrollValue);
     scrollOriginal->horizontalScrollBar()->setValue(horizontalScrollValue);
+
+    requestVisibleTiles();
 }
 
 void MainWindow::on_sliderQuality_valueChanged(int value) {
     findChild<QLabel*>("labelQualityValue")->setText(QString::number(value));
     qualityFactor = value;
     if(image != nullptr) {
-        blockManager->setCutDimension(qualityFactor);
-        blockManager->updateImage(*image);
         startCompression();
     }
 }
@@ -156,7 +477,7 @@ void MainWindow::on_blockSize_editingFinished() {
     updateMaximalValues();
 
     if(image != nullptr){
-        blockManager = new BlockManager(image, blockSize, qualityFactor);
+        replaceBlockManager();
         startCompression();
     }
 }
@@ -188,42 +509,69 @@ void MainWindow::updateMaximalValues() {
 }
 
 
+// Linear steps above 100%, halving below it so that large images can be
+// fitted into the window.
 void MainWindow::on_zoomIn_clicked()
 {
-    scaleFactor += ZOOM_SCALE_INCREMENT;
+    scaleFactor = scaleFactor < 1 ? scaleFactor * 2 : scaleFactor + ZOOM_SCALE_INCREMENT;
     updateImageSize(scaleFactor);
     updateMaximalValues();
 }
 
 void MainWindow::on_zoomOut_clicked()
 {
-    if(scaleFactor - ZOOM_SCALE_INCREMENT <= 0)
+    if(scaleFactor <= ZOOM_MINIMUM_SCALE)
         return;
 
-    scaleFactor -= ZOOM_SCALE_INCREMENT;
+    scaleFactor = scaleFactor <= 1 ? scaleFactor / 2 : scaleFactor - ZOOM_SCALE_INCREMENT;
     updateImageSize(scaleFactor);
     updateMaximalValues();
 }
 
 
 void MainWindow::updateImageSize(double scaleFactor){
-    QLabel *originalImageLabel = findChild<QLabel*>("originalImage");
-    QSize *scaledImageSize = nullptr;
-    if(originalImageLabel != nullptr){
-        scaledImageSize = new QSize(image->size() * scaleFactor);
-        originalImageLabel->setPixmap(QPixmap::fromImage(image->scaled(image->width() * scaleFactor, image->height() * scaleFactor)));
-        originalImageLabel->resize(*scaledImageSize);
+    if(originalView != nullptr){
+        originalView->setScaleFactor(scaleFactor);
     }
 
-    QLabel *compressedImageLabel = findChild<QLabel*>("compressedImage");
-    if(compressedImageLabel != nullptr && scaledImageSize != nullptr){
-        compressedImageLabel->setPixmap(QPixmap::fromImage(imageCompressed->scaled(imageCompressed->width() * scaleFactor, imageCompressed->height() * scaleFactor)));
-        compressedImageLabel->resize(*scaledImageSize);
+    if(compressedView != nullptr){
+        compressedView->setScaleFactor(scaleFactor);
     }
 
     updateMaximalValues();
 }
 
+void MainWindow::toggleProfileOverlay() {
+    bool visible = !profileOverlay->isVisible();
+    Profiler::instance().setEnabled(visible);
+    if (visible) {
+        Profiler::instance().reset();
+        updateProfileOverlay();
+        profileOverlay->show();
+        profileOverlay->raise();
+        profileTimer->start();
+    } else {
+        profileTimer->stop();
+        profileOverlay->hide();
+    }
+}
+
+void MainWindow::updateProfileOverlay() {
+    profileOverlay->setText(QString::fromStdString(Profiler::instance().toText()).trimmed());
+    profileOverlay->adjustSize();
+    profileOverlay->move(8, 8);
+}
+
+void MainWindow::saveProfile() {
+    QString select = QFileDialog::getSaveFileName(this, "Save profile:", "profile.json", "JSON (*.json)");
+    if (!select.isEmpty()) {
+        QFile file(select);
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(QByteArray::fromStdString(Profiler::instance().toJson()));
+        }
+    }
+}
+
 void MainWindow::resizeEvent(QResizeEvent *event) {
     QMainWindow::resizeEvent(event);
     updateMaximalValues();
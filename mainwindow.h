@@ -6,7 +6,17 @@
 #include <QBuffer>
 #include <QPixmap>
 #include <QAbstractScrollArea>
+#include <QImage>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include "blockManager.h"
+#include "tileCache.h"
+
+class TileView;
+class PyramidView;
+class QLabel;
+class QTimer;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -20,13 +30,32 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+signals:
+    void tileReady(int row, int column, int level, int cutDimension, quint64 generation);
+    void compressionReady(qint64 encodedSize, bool exact, quint64 generation);
+    void qualityReady(double psnr, double ssim, double coverage, const QImage &heatmap, quint64 generation);
+
 private slots:
 
     void on_loadButton_clicked();
 
     void on_sliderQuality_valueChanged(int value);
 
-    void onCompressionFinished();
+    void onTileReady(int row, int column, int level, int cutDimension, quint64 generation);
+
+    void onCompressionFinished(qint64 encodedSize, bool exact, quint64 generation);
+
+    void onQualityReady(double psnr, double ssim, double coverage, const QImage &heatmap, quint64 generation);
+
+    void toggleHeatmap();
+
+    void requestVisibleTiles();
+
+    void toggleProfileOverlay();
+
+    void updateProfileOverlay();
+
+    void saveProfile();
 
     void on_blockSize_editingFinished();
 
@@ -44,15 +73,45 @@ private:
     int blockSize;
     QBuffer *buffer;
     QImage *image;
-    QImage *imageCompressed;
+    PyramidView *originalView;
+    TileView *compressedView;
+    TileCache tileCache;
     BlockManager *blockManager;
     double scaleFactor;
     long int horizontalScrollValue;
     long int verticalScrollValue;
     QSize *currentPixmapSize;
+    QLabel *profileOverlay;
+    QTimer *profileTimer;
+    qint64 encodedSize;
+    bool encodedSizeExact;
+    QString qualityText;
+    QImage qualityHeatmap;
+    bool showHeatmap;
+
+    std::thread compressionThread;
+    std::mutex compressionMutex;
+    std::condition_variable compressionCondition;
+    std::atomic<quint64> compressionGeneration;
+    quint64 queuedGeneration;
+    int queuedCutDimension;
+    QRect queuedViewport;
+    int queuedLevel;
+    quint64 reportedGeneration;
+    quint64 encodedGeneration;
+    bool compressionQueued;
+    bool compressionRunning;
+    bool stopCompression;
 
     void resizeEvent(QResizeEvent *event);
     void startCompression();
+    void compressionLoop();
+    void compressTiles(quint64 generation, int cutDimension);
+    QImage renderTile(const TileKey &key, const std::function<bool()> &stale);
+    void cancelCompression();
+    void reportQuality(quint64 generation);
+    void updateCompressedTitle();
+    void replaceBlockManager();
     void updateMaximalValues();
     void updateImageSize(double scaleFactor);
     void updateScrollBar();
@@ -0,0 +1,87 @@
+#include "pixelPack.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+template<typename Sample>
+inline uchar packSample(Sample value, double scale) {
+    double scaled = std::min(std::max(value * scale, 0.0), 255.0);
+    return (uchar)(scaled + 0.5);
+}
+
+template<typename Sample>
+void packTail(const Sample *samples, int begin, int count, double scale, uchar *out) {
+    for (int x = begin; x < count; ++x) {
+        out[x] = packSample(samples[x], scale);
+    }
+}
+
+#if defined(__SSE2__)
+
+// Four rounded 32-bit lanes to four saturated bytes.
+inline void storeBytes(__m128i lanes, uchar *out) {
+    __m128i words = _mm_packs_epi32(lanes, lanes);
+    std::int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+    std::memcpy(out, &bytes, sizeof(bytes));
+}
+
+inline __m128i roundFloats(__m128 values, __m128 scale) {
+    __m128 scaled = _mm_min_ps(_mm_max_ps(_mm_mul_ps(values, scale), _mm_setzero_ps()), _mm_set1_ps(255.0f));
+    return _mm_cvttps_epi32(_mm_add_ps(scaled, _mm_set1_ps(0.5f)));
+}
+
+#endif
+
+}
+
+void packGrayLine(const double *samples, int count, double scale, uchar *out) {
+    int x = 0;
+#if defined(__SSE2__)
+    __m128d factor = _mm_set1_pd(scale);
+    __m128d low = _mm_setzero_pd();
+    __m128d high = _mm_set1_pd(255.0);
+    __m128d half = _mm_set1_pd(0.5);
+    for (; x + 4 <= count; x += 4) {
+        __m128d a = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(samples + x), factor), low), high);
+        __m128d b = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(samples + x + 2), factor), low), high);
+        __m128i lanes = _mm_unpacklo_epi64(_mm_cvttpd_epi32(_mm_add_pd(a, half)),
+                                           _mm_cvttpd_epi32(_mm_add_pd(b, half)));
+        storeBytes(lanes, out + x);
+    }
+#endif
+    packTail(samples, x, count, scale, out);
+}
+
+void packGrayLine(const float *samples, int count, double scale, uchar *out) {
+    int x = 0;
+#if defined(__SSE2__)
+    __m128 factor = _mm_set1_ps((float) scale);
+    for (; x + 4 <= count; x += 4) {
+        storeBytes(roundFloats(_mm_loadu_ps(samples + x), factor), out + x);
+    }
+#endif
+    packTail(samples, x, count, scale, out);
+}
+
+void packGrayLine(const std::int32_t *samples, int count, double scale, uchar *out) {
+    int x = 0;
+#if defined(__SSE2__)
+    __m128 factor = _mm_set1_ps((float) scale);
+    for (; x + 4 <= count; x += 4) {
+        __m128i values = _mm_loadu_si128((const __m128i*)(samples + x));
+        storeBytes(roundFloats(_mm_cvtepi32_ps(values), factor), out + x);
+    }
+#endif
+    packTail(samples, x, count, scale, out);
+}
+
+void expandGrayLine(const uchar *gray, int count, QRgb *out) {
+    for (int x = 0; x < count; ++x) {
+        out[x] = 0xff000000u | (gray[x] * 0x010101u);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef PIXEL_PACK_H
+#define PIXEL_PACK_H
+
+#include <QRgb>
+#include <cstdint>
+
+// Output stage of the pipeline: scales one line of reconstructed samples,
+// rounds, clamps to [0, 255] and stores 8-bit gray. Runs four samples per
+// step with SSE2 where available.
+void packGrayLine(const double *samples, int count, double scale, uchar *out);
+void packGrayLine(const float *samples, int count, double scale, uchar *out);
+void packGrayLine(const std::int32_t *samples, int count, double scale, uchar *out);
+
+// Widens a gray line to opaque RGB32 pixels.
+void expandGrayLine(const uchar *gray, int count, QRgb *out);
+
+#endif
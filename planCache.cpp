@@ -0,0 +1,186 @@
+#include "planCache.h"
+#include "profiler.h"
+#include <cstdlib>
+
+PlanCache::PlanCache(): wisdomLoaded(false), dirty(false) {
+    const char *env = std::getenv("JPEGC_WISDOM");
+    if (env != nullptr) {
+        wisdomFile = env;
+    }
+}
+
+PlanCache::~PlanCache() {
+    saveWisdom();
+    for (auto &entry : plans) {
+        fftw_destroy_plan(entry.second);
+    }
+    for (auto &entry : floatPlans) {
+        fftwf_destroy_plan(entry.second);
+    }
+}
+
+PlanCache &PlanCache::instance() {
+    static PlanCache cache;
+    return cache;
+}
+
+fftw_plan PlanCache::getPlan(int rows, int columns, Kind kind, unsigned flags) {
+    return getBatchPlan(rows, columns, columns, 1, rows * columns, kind, flags);
+}
+
+fftw_plan PlanCache::getBatchPlan(int rows, int columns, int rowStride, int howMany, int distance, Kind kind, unsigned flags) {
+    if (howMany == 1) {
+        distance = rows * rowStride;
+    }
+
+    Key key(rows, columns, rowStride, (int) kind, howMany, distance, flags);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = plans.find(key);
+    if (found != plans.end()) {
+        return found->second;
+    }
+
+    if (!wisdomLoaded) {
+        loadWisdom();
+    }
+
+    Profiler::Scope scope(Stage::Planning);
+
+    // FFTW_MEASURE overwrites its arrays, so plan on a buffer nobody else owns.
+    int size[2] = {rows, columns};
+    int embed[2] = {rows, rowStride};
+    fftw_r2r_kind type = kind == Kind::Forward ? FFTW_REDFT10 : FFTW_REDFT01;
+    fftw_r2r_kind kinds[2] = {type, type};
+    double *scratch = fftw_alloc_real((size_t) distance * (howMany - 1) + rows * rowStride);
+
+    fftw_plan plan = fftw_plan_many_r2r(2, size, howMany, scratch, embed, 1, distance, scratch, embed, 1, distance, kinds, flags);
+
+    fftw_free(scratch);
+    plans[key] = plan;
+    dirty = true;
+
+    return plan;
+}
+
+fftwf_plan PlanCache::getFloatBatchPlan(int rows, int columns, int rowStride, int howMany, int distance, Kind kind, unsigned flags) {
+    if (howMany == 1) {
+        distance = rows * rowStride;
+    }
+
+    Key key(rows, columns, rowStride, (int) kind, howMany, distance, flags);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = floatPlans.find(key);
+    if (found != floatPlans.end()) {
+        return found->second;
+    }
+
+    if (!wisdomLoaded) {
+        loadWisdom();
+    }
+
+    Profiler::Scope scope(Stage::Planning);
+    int size[2] = {rows, columns};
+    int embed[2] = {rows, rowStride};
+    fftwf_r2r_kind type = kind == Kind::Forward ? FFTW_REDFT10 : FFTW_REDFT01;
+    fftwf_r2r_kind kinds[2] = {type, type};
+    float *scratch = fftwf_alloc_real((size_t) distance * (howMany - 1) + rows * rowStride);
+
+    fftwf_plan plan = fftwf_plan_many_r2r(2, size, howMany, scratch, embed, 1, distance, scratch, embed, 1, distance, kinds, flags);
+
+    fftwf_free(scratch);
+    floatPlans[key] = plan;
+    dirty = true;
+
+    return plan;
+}
+
+// Keyed with 0 rows, which no block plan has.
+fftw_plan PlanCache::getLinePlan(int length, int stride, int howMany, int distance, Kind kind, unsigned flags) {
+    Key key(0, length, stride, (int) kind, howMany, distance, flags);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = plans.find(key);
+    if (found != plans.end()) {
+        return found->second;
+    }
+
+    if (!wisdomLoaded) {
+        loadWisdom();
+    }
+
+    Profiler::Scope scope(Stage::Planning);
+    fftw_r2r_kind type = kind == Kind::Forward ? FFTW_REDFT10 : FFTW_REDFT01;
+    std::size_t extent = (std::size_t) (length - 1) * stride + (std::size_t) (howMany - 1) * distance + 1;
+    double *scratch = fftw_alloc_real(extent);
+
+    fftw_plan plan = fftw_plan_many_r2r(1, &length, howMany, scratch, nullptr, stride, distance, scratch, nullptr, stride, distance, &type, flags);
+
+    fftw_free(scratch);
+    plans[key] = plan;
+    dirty = true;
+
+    return plan;
+}
+
+fftwf_plan PlanCache::getFloatLinePlan(int length, int stride, int howMany, int distance, Kind kind, unsigned flags) {
+    Key key(0, length, stride, (int) kind, howMany, distance, flags);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = floatPlans.find(key);
+    if (found != floatPlans.end()) {
+        return found->second;
+    }
+
+    if (!wisdomLoaded) {
+        loadWisdom();
+    }
+
+    Profiler::Scope scope(Stage::Planning);
+    fftwf_r2r_kind type = kind == Kind::Forward ? FFTW_REDFT10 : FFTW_REDFT01;
+    std::size_t extent = (std::size_t) (length - 1) * stride + (std::size_t) (howMany - 1) * distance + 1;
+    float *scratch = fftwf_alloc_real(extent);
+
+    fftwf_plan plan = fftwf_plan_many_r2r(1, &length, howMany, scratch, nullptr, stride, distance, scratch, nullptr, stride, distance, &type, flags);
+
+    fftwf_free(scratch);
+    floatPlans[key] = plan;
+    dirty = true;
+
+    return plan;
+}
+
+void PlanCache::setWisdomFile(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (path != wisdomFile) {
+        wisdomFile = path;
+        wisdomLoaded = false;
+    }
+}
+
+bool PlanCache::saveWisdom() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!dirty || wisdomFile.empty()) {
+        return false;
+    }
+
+    dirty = false;
+    if (!floatPlans.empty()) {
+        fftwf_export_wisdom_to_filename((wisdomFile + ".float").c_str());
+    }
+    return fftw_export_wisdom_to_filename(wisdomFile.c_str()) != 0;
+}
+
+int PlanCache::getPlanCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int) plans.size();
+}
+
+void PlanCache::loadWisdom() {
+    wisdomLoaded = true;
+    if (!wisdomFile.empty()) {
+        fftw_import_wisdom_from_filename(wisdomFile.c_str());
+        fftwf_import_wisdom_from_filename((wisdomFile + ".float").c_str());
+    }
+}
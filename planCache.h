@@ -0,0 +1,55 @@
+#ifndef PLAN_CACHE_H
+#define PLAN_CACHE_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <fftw3.h>
+
+// Process-wide owner of every FFTW plan. Plans are created once per
+// (rows, columns, row stride, kind) geometry on an aligned scratch buffer
+// and handed out for new-array execution; accumulated wisdom is persisted to a file so that a
+// later process can skip the measurements entirely. Single-precision
+// (fftwf) plans live next to the double ones, with their own wisdom file.
+class PlanCache {
+
+public:
+    enum class Kind {
+        Forward,
+        Inverse
+    };
+
+    static PlanCache &instance();
+
+    fftw_plan getPlan(int rows, int columns, Kind kind, unsigned flags = 0);
+    fftw_plan getBatchPlan(int rows, int columns, int rowStride, int howMany, int distance, Kind kind, unsigned flags = 0);
+    fftwf_plan getFloatBatchPlan(int rows, int columns, int rowStride, int howMany, int distance, Kind kind, unsigned flags = 0);
+    // One-dimensional transforms of howMany lines, stride apart within a
+    // line and distance apart from line to line.
+    fftw_plan getLinePlan(int length, int stride, int howMany, int distance, Kind kind, unsigned flags = 0);
+    fftwf_plan getFloatLinePlan(int length, int stride, int howMany, int distance, Kind kind, unsigned flags = 0);
+
+    void setWisdomFile(const std::string &path);
+    bool saveWisdom();
+    int getPlanCount();
+
+private:
+    PlanCache();
+    ~PlanCache();
+    PlanCache(const PlanCache &) = delete;
+    PlanCache &operator=(const PlanCache &) = delete;
+
+    typedef std::tuple<int, int, int, int, int, int, unsigned> Key;
+
+    void loadWisdom();
+
+    std::map<Key, fftw_plan> plans;
+    std::map<Key, fftwf_plan> floatPlans;
+    std::mutex mutex;
+    std::string wisdomFile;
+    bool wisdomLoaded;
+    bool dirty;
+};
+
+#endif
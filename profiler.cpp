@@ -0,0 +1,237 @@
+#include "profiler.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+enum Counter {
+    Nanoseconds,
+    Calls,
+    Blocks,
+    Bytes
+};
+
+std::uint64_t elapsedNanoseconds(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+}
+
+bool isWorkStage(int stage) {
+    return stage <= (int) Stage::Quality;
+}
+
+void writeStages(std::ostream &out, const Profiler::StageTotals *stages) {
+    out << "{";
+    for (int stage = 0; stage < Profiler::stageCount; ++stage) {
+        const Profiler::StageTotals &totals = stages[stage];
+        out << (stage > 0 ? ", " : "") << "\"" << stageName((Stage) stage) << "\": {"
+            << "\"ms\": " << totals.milliseconds()
+            << ", \"calls\": " << totals.calls
+            << ", \"blocks\": " << totals.blocks
+            << ", \"bytes\": " << totals.bytes
+            << ", \"blocksPerSecond\": " << totals.blocksPerSecond() << "}";
+    }
+    out << "}";
+}
+
+}
+
+const char *stageName(Stage stage) {
+    switch (stage) {
+        case Stage::Load:
+            return "load";
+        case Stage::ForwardDct:
+            return "forwardDct";
+        case Stage::Cut:
+            return "cut";
+        case Stage::InverseDct:
+            return "inverseDct";
+        case Stage::Pack:
+            return "pack";
+        case Stage::Quality:
+            return "quality";
+        case Stage::Scheduling:
+            return "scheduling";
+        case Stage::Planning:
+            return "planning";
+        case Stage::Compress:
+            return "compress";
+        case Stage::Update:
+            return "update";
+        default:
+            return "unknown";
+    }
+}
+
+double Profiler::StageTotals::milliseconds() const {
+    return nanoseconds / 1e6;
+}
+
+double Profiler::StageTotals::blocksPerSecond() const {
+    return nanoseconds == 0 ? 0.0 : blocks / (nanoseconds / 1e9);
+}
+
+Profiler::Scope::Scope(Stage stage, std::uint64_t blocks, std::uint64_t bytes): stage(stage), blocks(blocks), bytes(bytes), active(Profiler::instance().isEnabled()) {
+    if (active) {
+        begin = std::chrono::steady_clock::now();
+    }
+}
+
+Profiler::Scope::~Scope() {
+    if (active) {
+        Profiler::instance().record(stage, elapsedNanoseconds(begin), blocks, bytes);
+    }
+}
+
+Profiler::Section::Section(int participants): participants(participants), active(Profiler::instance().isEnabled()), work(0) {
+    if (active) {
+        work = Profiler::instance().workNanoseconds();
+        begin = std::chrono::steady_clock::now();
+    }
+}
+
+Profiler::Section::~Section() {
+    if (active) {
+        std::uint64_t wall = elapsedNanoseconds(begin) * participants;
+        std::uint64_t spent = Profiler::instance().workNanoseconds() - work;
+        Profiler::instance().record(Stage::Scheduling, wall > spent ? wall - spent : 0);
+    }
+}
+
+Profiler &Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler(): enabled(false) {
+}
+
+void Profiler::setEnabled(bool enabled) {
+    this->enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Profiler::isEnabled() const {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+Profiler::Slot &Profiler::localSlot() {
+    thread_local Slot *slot = nullptr;
+    if (slot == nullptr) {
+        std::unique_ptr<Slot> created(new Slot());
+        for (auto &stage : created->counters) {
+            for (auto &counter : stage) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        created->thread = (int) slots.size();
+        slot = created.get();
+        slots.push_back(std::move(created));
+    }
+    return *slot;
+}
+
+void Profiler::record(Stage stage, std::uint64_t nanoseconds, std::uint64_t blocks, std::uint64_t bytes) {
+    std::atomic<std::uint64_t> *counters = localSlot().counters[(int) stage];
+    counters[Nanoseconds].fetch_add(nanoseconds, std::memory_order_relaxed);
+    counters[Calls].fetch_add(1, std::memory_order_relaxed);
+    counters[Blocks].fetch_add(blocks, std::memory_order_relaxed);
+    counters[Bytes].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Profiler::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &slot : slots) {
+        for (auto &stage : slot->counters) {
+            for (auto &counter : stage) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+std::uint64_t Profiler::workNanoseconds() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::uint64_t total = 0;
+    for (const auto &slot : slots) {
+        for (int stage = 0; stage < stageCount; ++stage) {
+            if (isWorkStage(stage)) {
+                total += slot->counters[stage][Nanoseconds].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    return total;
+}
+
+std::vector<Profiler::ThreadTotals> Profiler::getThreadTotals() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ThreadTotals> threads(slots.size());
+    for (std::size_t i = 0; i < slots.size(); ++i) {
+        threads[i].thread = slots[i]->thread;
+        for (int stage = 0; stage < stageCount; ++stage) {
+            const std::atomic<std::uint64_t> *counters = slots[i]->counters[stage];
+            StageTotals &totals = threads[i].stages[stage];
+            totals.nanoseconds = counters[Nanoseconds].load(std::memory_order_relaxed);
+            totals.calls = counters[Calls].load(std::memory_order_relaxed);
+            totals.blocks = counters[Blocks].load(std::memory_order_relaxed);
+            totals.bytes = counters[Bytes].load(std::memory_order_relaxed);
+        }
+    }
+    return threads;
+}
+
+Profiler::StageTotals Profiler::getTotals(Stage stage) const {
+    StageTotals sum;
+    for (const ThreadTotals &thread : getThreadTotals()) {
+        const StageTotals &totals = thread.stages[(int) stage];
+        sum.nanoseconds += totals.nanoseconds;
+        sum.calls += totals.calls;
+        sum.blocks += totals.blocks;
+        sum.bytes += totals.bytes;
+    }
+    return sum;
+}
+
+std::string Profiler::toJson() const {
+    StageTotals totals[stageCount];
+    for (int stage = 0; stage < stageCount; ++stage) {
+        totals[stage] = getTotals((Stage) stage);
+    }
+
+    std::ostringstream out;
+    out << "{\"enabled\": " << (isEnabled() ? "true" : "false") << ", \"stages\": ";
+    writeStages(out, totals);
+    out << ", \"threads\": [";
+    std::vector<ThreadTotals> threads = getThreadTotals();
+    for (std::size_t i = 0; i < threads.size(); ++i) {
+        out << (i > 0 ? ", " : "") << "{\"thread\": " << threads[i].thread << ", \"stages\": ";
+        writeStages(out, threads[i].stages);
+        out << "}";
+    }
+    out << "]}";
+    return out.str();
+}
+
+// One line per stage that has been hit, for overlays and logs.
+std::string Profiler::toText() const {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    for (int stage = 0; stage < stageCount; ++stage) {
+        StageTotals totals = getTotals((Stage) stage);
+        if (totals.calls == 0) {
+            continue;
+        }
+        out << std::left << std::setw(11) << stageName((Stage) stage) << std::right
+            << std::setw(10) << totals.milliseconds() << " ms"
+            << std::setw(10) << totals.calls << " calls";
+        if (totals.blocks > 0) {
+            out << std::setw(12) << totals.blocksPerSecond() / 1e6 << " Mblocks/s";
+        }
+        if (totals.bytes > 0) {
+            out << std::setw(10) << totals.bytes / 1e6 << " MB";
+        }
+        out << "\n";
+    }
+    return out.str();
+}
@@ -0,0 +1,119 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Hot-path stages of the pipeline. Compress and Update are the wall time of
+// whole compress() / updateImage() calls on the calling thread; Scheduling
+// is the participant time of their parallel sections not spent in a stage.
+enum class Stage {
+    Load,
+    ForwardDct,
+    Cut,
+    InverseDct,
+    Pack,
+    Quality,
+    Scheduling,
+    Planning,
+    Compress,
+    Update,
+    Count
+};
+
+const char *stageName(Stage stage);
+
+// Process-wide stage timings and counters. Every thread accumulates into
+// its own slot with relaxed atomics, so recording never contends and a
+// snapshot can be taken while the pipeline runs. Disabled by default; a
+// disabled Scope costs one relaxed load.
+class Profiler {
+
+public:
+    static const int stageCount = (int) Stage::Count;
+
+    struct StageTotals {
+        std::uint64_t nanoseconds = 0;
+        std::uint64_t calls = 0;
+        std::uint64_t blocks = 0;
+        std::uint64_t bytes = 0;
+
+        double milliseconds() const;
+        double blocksPerSecond() const;
+    };
+
+    struct ThreadTotals {
+        int thread = 0;
+        StageTotals stages[stageCount];
+    };
+
+    // Times the enclosing block as one call of the stage.
+    class Scope {
+
+    public:
+        Scope(Stage stage, std::uint64_t blocks = 0, std::uint64_t bytes = 0);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Stage stage;
+        std::uint64_t blocks;
+        std::uint64_t bytes;
+        bool active;
+        std::chrono::steady_clock::time_point begin;
+    };
+
+    // Wraps a parallel section: participants x wall time minus the stage
+    // time recorded meanwhile is booked as Scheduling.
+    class Section {
+
+    public:
+        explicit Section(int participants);
+        ~Section();
+        Section(const Section &) = delete;
+        Section &operator=(const Section &) = delete;
+
+    private:
+        int participants;
+        bool active;
+        std::uint64_t work;
+        std::chrono::steady_clock::time_point begin;
+    };
+
+    static Profiler &instance();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+    void record(Stage stage, std::uint64_t nanoseconds, std::uint64_t blocks = 0, std::uint64_t bytes = 0);
+    void reset();
+
+    StageTotals getTotals(Stage stage) const;
+    std::vector<ThreadTotals> getThreadTotals() const;
+    std::string toJson() const;
+    std::string toText() const;
+
+private:
+    struct Slot {
+        int thread;
+        std::atomic<std::uint64_t> counters[stageCount][4];
+    };
+
+    Profiler();
+    Profiler(const Profiler &) = delete;
+    Profiler &operator=(const Profiler &) = delete;
+
+    Slot &localSlot();
+    std::uint64_t workNanoseconds() const;
+
+    std::atomic<bool> enabled;
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Slot>> slots;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "prunedIdct.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+namespace {
+
+template<typename Sample>
+inline Sample toSample(double value) {
+    return (Sample) value;
+}
+
+template<>
+inline std::int32_t toSample<std::int32_t>(double value) {
+    return (std::int32_t) std::lround(value);
+}
+
+}
+
+const PrunedIdct &PrunedIdct::get(int rows, int columns, Scale scale) {
+    // Every block of a row asks for the same geometry; skip the shared map then.
+    thread_local const PrunedIdct *last = nullptr;
+    thread_local Scale lastScale = Scale::Unnormalized;
+    if (last != nullptr && last->rows == rows && last->columns == columns && lastScale == scale) {
+        return *last;
+    }
+
+    static std::mutex mutex;
+    static std::map<std::tuple<int, int, Scale>, std::unique_ptr<PrunedIdct>> transforms;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<PrunedIdct> &transform = transforms[std::make_tuple(rows, columns, scale)];
+    if (transform == nullptr) {
+        transform.reset(new PrunedIdct(rows, columns, scale));
+    }
+    last = transform.get();
+    lastScale = scale;
+    return *transform;
+}
+
+double PrunedIdct::nonzeroFraction(int rows, int columns, int cut) {
+    int nonzero = 0;
+    for (int u = 0; u < std::min(cut, rows); ++u) {
+        nonzero += std::min(cut - u, columns);
+    }
+    return (double) nonzero / (rows * columns);
+}
+
+PrunedIdct::PrunedIdct(int rows, int columns, Scale scale): rows(rows), columns(columns), rowBasis(basisTable(columns, scale)), columnBasis(basisTable(rows, scale)) {
+}
+
+// table[k * n + i] is the weight of coefficient k in output sample i.
+std::vector<double> PrunedIdct::basisTable(int n, Scale scale) {
+    const double pi = 3.14159265358979323846;
+    std::vector<double> table(n * n);
+    for (int k = 0; k < n; ++k) {
+        double weight = scale == Scale::Unnormalized ? (k == 0 ? 1.0 : 2.0) : std::sqrt((k == 0 ? 1.0 : 2.0) / n);
+        for (int i = 0; i < n; ++i) {
+            table[k * n + i] = weight * std::cos(pi * (2 * i + 1) * k / (2.0 * n));
+        }
+    }
+    return table;
+}
+
+template<typename Sample>
+void PrunedIdct::inverse(Sample *block, int rowStride, int cut) const {
+    thread_local std::vector<double> partial;
+    int activeRows = std::max(std::min(cut, rows), 0);
+    partial.resize(activeRows * columns);
+    rowPass(block, rowStride, cut, partial.data(), 0, activeRows);
+    columnPass(partial.data(), cut, block, rowStride, 0, rows);
+}
+
+// Rows: coefficient row u only has its first cut - u entries.
+template<typename Sample>
+void PrunedIdct::rowPass(const Sample *block, int rowStride, int cut, double *partial, int first, int count) const {
+    for (int u = first; u < first + count; ++u) {
+        const Sample *coefficients = block + u * rowStride;
+        double *out = partial + u * columns;
+        std::fill(out, out + columns, 0.0);
+        for (int v = 0; v < std::min(cut - u, columns); ++v) {
+            double value = coefficients[v];
+            const double *basis = rowBasis.data() + v * columns;
+            for (int x = 0; x < columns; ++x) {
+                out[x] += value * basis[x];
+            }
+        }
+    }
+}
+
+// Columns: every output row only sums the active coefficient rows.
+template<typename Sample>
+void PrunedIdct::columnPass(const double *partial, int cut, Sample *block, int rowStride, int first, int count) const {
+    thread_local std::vector<double> line;
+    int activeRows = std::max(std::min(cut, rows), 0);
+    line.resize(columns);
+
+    for (int y = first; y < first + count; ++y) {
+        std::fill(line.begin(), line.end(), 0.0);
+        for (int u = 0; u < activeRows; ++u) {
+            double weight = columnBasis[u * rows + y];
+            const double *in = partial + u * columns;
+            for (int x = 0; x < columns; ++x) {
+                line[x] += weight * in[x];
+            }
+        }
+
+        Sample *pixels = block + y * rowStride;
+        for (int x = 0; x < columns; ++x) {
+            pixels[x] = toSample<Sample>(line[x]);
+        }
+    }
+}
+
+template void PrunedIdct::inverse<double>(double *block, int rowStride, int cut) const;
+template void PrunedIdct::inverse<float>(float *block, int rowStride, int cut) const;
+template void PrunedIdct::inverse<std::int32_t>(std::int32_t *block, int rowStride, int cut) const;
+template void PrunedIdct::rowPass<double>(const double *block, int rowStride, int cut, double *partial, int first, int count) const;
+template void PrunedIdct::rowPass<float>(const float *block, int rowStride, int cut, double *partial, int first, int count) const;
+template void PrunedIdct::rowPass<std::int32_t>(const std::int32_t *block, int rowStride, int cut, double *partial, int first, int count) const;
+template void PrunedIdct::columnPass<double>(const double *partial, int cut, double *block, int rowStride, int first, int count) const;
+template void PrunedIdct::columnPass<float>(const double *partial, int cut, float *block, int rowStride, int first, int count) const;
+template void PrunedIdct::columnPass<std::int32_t>(const double *partial, int cut, std::int32_t *block, int rowStride, int first, int count) const;
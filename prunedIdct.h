@@ -0,0 +1,45 @@
+#ifndef PRUNED_IDCT_H
+#define PRUNED_IDCT_H
+
+#include <vector>
+
+// Separable 2D inverse DCT for blocks whose coefficients are zero outside
+// the triangle u + v < cut, as left by cutting a block. The row pass only
+// runs over the min(cut, rows) coefficient rows that can be nonzero, each
+// over its own prefix, and the column pass only sums those rows, so the
+// work falls with the cut instead of staying that of a full transform.
+// Unnormalized matches FFTW's REDFT01 scale, Orthonormal that of FixedDct.
+class PrunedIdct {
+
+public:
+    enum class Scale {
+        Unnormalized,
+        Orthonormal
+    };
+
+    static const PrunedIdct &get(int rows, int columns, Scale scale);
+    static double nonzeroFraction(int rows, int columns, int cut);
+
+    template<typename Sample>
+    void inverse(Sample *block, int rowStride, int cut) const;
+    // The two passes of inverse() over count lines from first, so the
+    // lines of one block can be split across workers. rowPass() transforms
+    // coefficient rows into partial, which holds min(cut, rows) rows of
+    // columns values; columnPass() sums them into pixel rows.
+    template<typename Sample>
+    void rowPass(const Sample *block, int rowStride, int cut, double *partial, int first, int count) const;
+    template<typename Sample>
+    void columnPass(const double *partial, int cut, Sample *block, int rowStride, int first, int count) const;
+
+private:
+    PrunedIdct(int rows, int columns, Scale scale);
+
+    static std::vector<double> basisTable(int n, Scale scale);
+
+    int rows;
+    int columns;
+    std::vector<double> rowBasis;
+    std::vector<double> columnBasis;
+};
+
+#endif
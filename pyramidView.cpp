@@ -0,0 +1,30 @@
+#include "pyramidView.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <algorithm>
+
+PyramidView::PyramidView(const ImagePyramid &pyramid, QWidget *parent): QWidget(parent), pyramid(pyramid), scaleFactor(1) {
+    resize(pyramid.getLevel(0).size());
+}
+
+void PyramidView::setScaleFactor(double scaleFactor) {
+    this->scaleFactor = scaleFactor;
+    resize(pyramid.getLevel(0).size() * scaleFactor);
+    update();
+}
+
+void PyramidView::paintEvent(QPaintEvent *event) {
+    int level = std::min(ImagePyramid::levelForScale(scaleFactor), pyramid.getLevelCount() - 1);
+    const QImage &source = pyramid.getLevel(level);
+    if (source.isNull()) {
+        return;
+    }
+
+    // Screen pixels per pixel of the chosen level.
+    double levelScale = scaleFactor * (1 << level);
+    QRect exposed = event->rect();
+    QRectF sourceRect(exposed.x() / levelScale, exposed.y() / levelScale, exposed.width() / levelScale, exposed.height() / levelScale);
+
+    QPainter painter(this);
+    painter.drawImage(QRectF(exposed), source, sourceRect);
+}
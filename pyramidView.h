@@ -0,0 +1,26 @@
+#ifndef PYRAMID_VIEW_H
+#define PYRAMID_VIEW_H
+
+#include <QWidget>
+#include "imagePyramid.h"
+
+// Original image pane. Every repaint resamples only the exposed rectangle,
+// from the pyramid level that matches the zoom.
+class PyramidView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit PyramidView(const ImagePyramid &pyramid, QWidget *parent = nullptr);
+
+    void setScaleFactor(double scaleFactor);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    ImagePyramid pyramid;
+    double scaleFactor;
+};
+
+#endif
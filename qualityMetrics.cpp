@@ -0,0 +1,142 @@
+#include "qualityMetrics.h"
+#include <algorithm>
+#include <cmath>
+
+void BlockQuality::addLine(const uchar *source, const uchar *output, int count) {
+    // Squares are below 2^16, so 32 bit sums over at most 2^16 pixels cannot
+    // overflow; longer lines are summed in such chunks.
+    for (int start = 0; start < count; start += chunkPixels) {
+        int end = std::min(start + chunkPixels, count);
+        std::uint32_t lineSource = 0;
+        std::uint32_t lineOutput = 0;
+        std::uint32_t lineSourceSquared = 0;
+        std::uint32_t lineOutputSquared = 0;
+        std::uint32_t lineProduct = 0;
+        std::uint32_t lineError = 0;
+        for (int i = start; i < end; ++i) {
+            std::uint32_t x = source[i];
+            std::uint32_t y = output[i];
+            std::int32_t difference = (std::int32_t) x - (std::int32_t) y;
+            lineSource += x;
+            lineOutput += y;
+            lineSourceSquared += x * x;
+            lineOutputSquared += y * y;
+            lineProduct += x * y;
+            lineError += difference * difference;
+        }
+        sumSource += lineSource;
+        sumOutput += lineOutput;
+        sumSourceSquared += lineSourceSquared;
+        sumOutputSquared += lineOutputSquared;
+        sumProduct += lineProduct;
+        squaredError += lineError;
+    }
+    pixels += count;
+}
+
+double BlockQuality::mse() const {
+    return pixels == 0 ? 0.0 : (double) squaredError / pixels;
+}
+
+double BlockQuality::ssim() const {
+    if (pixels == 0) {
+        return 1.0;
+    }
+
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    double meanSource = (double) sumSource / pixels;
+    double meanOutput = (double) sumOutput / pixels;
+    double varianceSource = (double) sumSourceSquared / pixels - meanSource * meanSource;
+    double varianceOutput = (double) sumOutputSquared / pixels - meanOutput * meanOutput;
+    double covariance = (double) sumProduct / pixels - meanSource * meanOutput;
+
+    return ((2 * meanSource * meanOutput + c1) * (2 * covariance + c2))
+           / ((meanSource * meanSource + meanOutput * meanOutput + c1) * (varianceSource + varianceOutput + c2));
+}
+
+QualityMetrics::QualityMetrics(): rows(0), columns(0), mse(0), ssim(1), coverage(0) {
+}
+
+QualityMetrics::QualityMetrics(int rows, int columns, const std::vector<BlockQuality> &blocks): rows(rows), columns(columns), mse(0), ssim(1), coverage(0), blockMse(blocks.size(), -1.0f), blockSsim(blocks.size(), -1.0f) {
+    std::uint64_t squaredError = 0;
+    std::uint64_t pixels = 0;
+    double ssimSum = 0;
+    int measured = 0;
+
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].pixels == 0) {
+            continue;
+        }
+        blockMse[i] = (float) blocks[i].mse();
+        blockSsim[i] = (float) blocks[i].ssim();
+        squaredError += blocks[i].squaredError;
+        pixels += blocks[i].pixels;
+        ssimSum += blockSsim[i];
+        ++measured;
+    }
+
+    if (measured > 0) {
+        mse = (double) squaredError / pixels;
+        ssim = ssimSum / measured;
+        coverage = (double) measured / blocks.size();
+    }
+}
+
+bool QualityMetrics::isEmpty() const {
+    return coverage == 0;
+}
+
+double QualityMetrics::getMse() const {
+    return mse;
+}
+
+double QualityMetrics::getPsnr() const {
+    return psnr(mse);
+}
+
+double QualityMetrics::getSsim() const {
+    return ssim;
+}
+
+double QualityMetrics::getCoverage() const {
+    return coverage;
+}
+
+int QualityMetrics::getRows() const {
+    return rows;
+}
+
+int QualityMetrics::getColumns() const {
+    return columns;
+}
+
+double QualityMetrics::getBlockMse(int row, int column) const {
+    return blockMse[row * columns + column];
+}
+
+double QualityMetrics::getBlockSsim(int row, int column) const {
+    return blockSsim[row * columns + column];
+}
+
+QImage QualityMetrics::heatmap() const {
+    QImage image(columns, rows, QImage::Format_ARGB32);
+    for (int i = 0; i < rows; ++i) {
+        QRgb *line = (QRgb*) image.scanLine(i);
+        for (int j = 0; j < columns; ++j) {
+            float error = blockMse[i * columns + j];
+            if (error < 0) {
+                line[j] = qRgba(0, 0, 0, 0);
+                continue;
+            }
+            double t = std::min(std::max((psnr(error) - 20.0) / 30.0, 0.0), 1.0);
+            line[j] = qRgb(t < 0.5 ? 255 : (int) (255 * 2 * (1 - t)), t < 0.5 ? (int) (255 * 2 * t) : 255, 0);
+        }
+    }
+    return image;
+}
+
+// Lossless blocks report 99 dB, like the CLI always has.
+double QualityMetrics::psnr(double mse) {
+    return mse == 0 ? 99.0 : 10 * std::log10(255.0 * 255.0 / mse);
+}
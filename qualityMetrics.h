@@ -0,0 +1,64 @@
+#ifndef QUALITY_METRICS_H
+#define QUALITY_METRICS_H
+
+#include <QImage>
+#include <cstdint>
+#include <vector>
+
+// Pixel statistics of one reconstructed block against its source. They are
+// gathered while the block is packed, so both are still in cache.
+struct BlockQuality {
+    std::uint64_t sumSource = 0;
+    std::uint64_t sumOutput = 0;
+    std::uint64_t sumSourceSquared = 0;
+    std::uint64_t sumOutputSquared = 0;
+    std::uint64_t sumProduct = 0;
+    std::uint64_t squaredError = 0;
+    std::uint64_t pixels = 0;
+
+    static constexpr int chunkPixels = 1 << 16;
+
+    void addLine(const uchar *source, const uchar *output, int count);
+    double mse() const;
+    // Single-window SSIM over the block with the usual K1 = 0.01, K2 = 0.03.
+    double ssim() const;
+};
+
+// Global quality of a reconstruction, reduced from its per-block
+// statistics. SSIM is the mean of the block SSIMs, i.e. SSIM with
+// non-overlapping block-sized windows. Blocks that were never measured are
+// left out; getCoverage() is the measured fraction.
+class QualityMetrics {
+
+public:
+    QualityMetrics();
+    QualityMetrics(int rows, int columns, const std::vector<BlockQuality> &blocks);
+
+    bool isEmpty() const;
+    double getMse() const;
+    double getPsnr() const;
+    double getSsim() const;
+    double getCoverage() const;
+    int getRows() const;
+    int getColumns() const;
+    // -1 for blocks that were not measured.
+    double getBlockMse(int row, int column) const;
+    double getBlockSsim(int row, int column) const;
+
+    // One pixel per block, from red (PSNR <= 20 dB) over yellow to green
+    // (>= 50 dB); unmeasured blocks are transparent.
+    QImage heatmap() const;
+
+    static double psnr(double mse);
+
+private:
+    int rows;
+    int columns;
+    double mse;
+    double ssim;
+    double coverage;
+    std::vector<float> blockMse;
+    std::vector<float> blockSsim;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "rateSearch.h"
+#include "blockManager.h"
+#include "jpegEncoder.h"
+#include "qualityMetrics.h"
+#include <algorithm>
+#include <memory>
+
+RateTarget RateTarget::psnr(double decibels) {
+    return RateTarget{Kind::Psnr, decibels};
+}
+
+RateTarget RateTarget::bytes(qint64 budget) {
+    return RateTarget{Kind::Bytes, (double) budget};
+}
+
+template<typename Sample>
+BasicRateSearch<Sample>::BasicRateSearch(RateTarget target): target(target), sampleBlocks(1024), maxFullPasses(4) {
+}
+
+template<typename Sample>
+void BasicRateSearch<Sample>::setSampleBlocks(int blocks) {
+    sampleBlocks = std::max(blocks, 1);
+}
+
+template<typename Sample>
+void BasicRateSearch<Sample>::setMaxFullPasses(int passes) {
+    maxFullPasses = std::max(passes, 1);
+}
+
+// Orthonormal coefficient energy of the sampled full blocks per
+// anti-diagonal u + v. A cut D drops the diagonals from D on, and by
+// Parseval their energy is the squared error it adds.
+template<typename Sample>
+std::vector<double> BasicRateSearch<Sample>::energyProfile(const BasicBlockManager<Sample> &manager, const std::vector<int> &rows, double &pixels) const {
+    int blockSize = manager.getBlockSize();
+    int stride = manager.getRowStride();
+    std::vector<double> scale(blockSize * blockSize);
+    for (int i = 0; i < blockSize * blockSize; ++i) {
+        scale[i] = manager.getCoefficientScale(i / blockSize, i % blockSize);
+    }
+
+    std::vector<double> energy(2 * blockSize - 1, 0.0);
+    pixels = 0;
+    for (int row : rows) {
+        for (int column = 0; column < manager.columns; ++column) {
+            if (manager.getBlockWidth(row, column) != blockSize || manager.getBlockHeight(row, column) != blockSize) {
+                continue;
+            }
+
+            const Sample *block = manager.getCoefficients(row, column);
+            for (int u = 0; u < blockSize; ++u) {
+                for (int v = 0; v < blockSize; ++v) {
+                    double value = block[u * stride + v] * scale[u * blockSize + v];
+                    energy[u + v] += value * value;
+                }
+            }
+            pixels += blockSize * blockSize;
+        }
+    }
+    return energy;
+}
+
+template<typename Sample>
+RateSearchResult BasicRateSearch<Sample>::confirm(BasicBlockManager<Sample> &manager, int cutDimension, std::map<int, RateSearchResult> &confirmed) const {
+    manager.setCutDimension(cutDimension);
+    manager.setQualityMetrics(true);
+    std::unique_ptr<QImage> output(manager.compress());
+
+    RateSearchResult result;
+    result.blockSize = manager.getBlockSize();
+    result.cutDimension = cutDimension;
+    result.psnr = manager.getQualityMetrics().getPsnr();
+    result.encodedSize = BasicJpegEncoder<Sample>(manager).encode().size();
+    result.met = meets(result);
+    confirmed[cutDimension] = result;
+    return result;
+}
+
+template<typename Sample>
+bool BasicRateSearch<Sample>::meets(const RateSearchResult &result) const {
+    return target.kind == RateTarget::Kind::Psnr ? result.psnr >= target.value : result.encodedSize <= target.value;
+}
+
+// Among results that meet the target the cheaper (PSNR target) or sharper
+// (byte budget) one wins; otherwise the one closest to the target.
+template<typename Sample>
+bool BasicRateSearch<Sample>::better(const RateSearchResult &candidate, const RateSearchResult &best) const {
+    if (candidate.met != best.met) {
+        return candidate.met;
+    }
+    bool smaller = candidate.encodedSize < best.encodedSize || (candidate.encodedSize == best.encodedSize && candidate.psnr > best.psnr);
+    bool sharper = candidate.psnr > best.psnr || (candidate.psnr == best.psnr && candidate.encodedSize < best.encodedSize);
+    if (candidate.met) {
+        return target.kind == RateTarget::Kind::Psnr ? smaller : sharper;
+    }
+    return target.kind == RateTarget::Kind::Psnr ? sharper : smaller;
+}
+
+template<typename Sample>
+RateSearchResult BasicRateSearch<Sample>::searchCut(BasicBlockManager<Sample> &manager) {
+    bool psnrTarget = target.kind == RateTarget::Kind::Psnr;
+    bool measured = manager.hasQualityMetrics();
+    int maxCut = 2 * manager.getBlockSize() - 1;
+    BasicJpegEncoder<Sample> encoder(manager);
+    std::vector<int> rows = encoder.sampleRows(sampleBlocks);
+    int sampled = 0;
+
+    double pixels;
+    std::vector<double> energy = energyProfile(manager, rows, pixels);
+
+    // Both estimates grow with the cut, so bisection finds the boundary:
+    // the smallest cut reaching the PSNR or the largest within the budget.
+    auto estimateMeets = [&](int cut){
+        ++sampled;
+        if (!psnrTarget) {
+            manager.setCutDimension(cut);
+            return encoder.estimateSize(rows) <= target.value;
+        }
+        double error = 0;
+        for (int k = cut; k < maxCut; ++k) {
+            error += energy[k];
+        }
+        // Rounding the reconstruction to integers adds about 1/12 per pixel.
+        double mse = (pixels > 0 ? error / pixels : 0) + (cut < maxCut ? 1.0 / 12 : 0);
+        return QualityMetrics::psnr(mse) >= target.value;
+    };
+
+    int low = 1;
+    int high = maxCut;
+    while (low < high) {
+        int middle = psnrTarget ? (low + high) / 2 : (low + high + 1) / 2;
+        bool fits = estimateMeets(middle);
+        if (psnrTarget) {
+            fits ? high = middle : low = middle + 1;
+        } else {
+            fits ? low = middle : high = middle - 1;
+        }
+    }
+
+    // Walk from the estimate with full passes: towards cheaper cuts while
+    // the target holds, towards better ones until it does.
+    std::map<int, RateSearchResult> confirmed;
+    RateSearchResult best;
+    bool found = false;
+    int cut = low;
+    while ((int) confirmed.size() < maxFullPasses && cut >= 1 && cut <= maxCut && confirmed.count(cut) == 0) {
+        RateSearchResult result = confirm(manager, cut, confirmed);
+        if (confirmed.size() == 1 || better(result, best)) {
+            best = result;
+        }
+        if (result.met) {
+            found = true;
+            cut += psnrTarget ? -1 : 1;
+        } else if (found) {
+            break;
+        } else {
+            cut += psnrTarget ? 1 : -1;
+        }
+    }
+
+    manager.setCutDimension(best.cutDimension);
+    manager.setQualityMetrics(measured);
+    best.fullPasses = (int) confirmed.size();
+    best.sampledCandidates = sampled;
+    return best;
+}
+
+template<typename Sample>
+RateSearchResult BasicRateSearch<Sample>::search(const QImage &image, const std::vector<int> &blockSizes, ThreadPool *pool) {
+    RateSearchResult best;
+    int fullPasses = 0;
+    int sampledCandidates = 0;
+
+    for (int blockSize : blockSizes) {
+        if (blockSize < 2 || blockSize > std::min(image.width(), image.height())) {
+            continue;
+        }
+
+        BasicBlockManager<Sample> manager(&image, blockSize, 1, pool);
+        RateSearchResult result = searchCut(manager);
+        fullPasses += result.fullPasses;
+        sampledCandidates += result.sampledCandidates;
+        if (best.blockSize == 0 || better(result, best)) {
+            best = result;
+        }
+    }
+
+    best.fullPasses = fullPasses;
+    best.sampledCandidates = sampledCandidates;
+    return best;
+}
+
+template class BasicRateSearch<double>;
+template class BasicRateSearch<float>;
+template class BasicRateSearch<std::int32_t>;
@@ -0,0 +1,71 @@
+#ifndef RATE_SEARCH_H
+#define RATE_SEARCH_H
+
+#include <QImage>
+#include <map>
+#include <vector>
+
+class ThreadPool;
+template<typename Sample> class BasicBlockManager;
+
+// What a rate search aims for: the smallest stream with at least value dB
+// of PSNR, or the best PSNR within value encoded bytes.
+struct RateTarget {
+    enum class Kind {
+        Psnr,
+        Bytes
+    };
+
+    Kind kind;
+    double value;
+
+    static RateTarget psnr(double decibels);
+    static RateTarget bytes(qint64 budget);
+};
+
+struct RateSearchResult {
+    int blockSize = 0;
+    int cutDimension = 0;
+    double psnr = 0;
+    qint64 encodedSize = 0;
+    bool met = false;
+    int fullPasses = 0;
+    int sampledCandidates = 0;
+};
+
+// Picks the cut dimension (and optionally the block size) that meets a
+// RateTarget. Candidates are first ranked on a sample of block rows: the
+// PSNR from the energy of the coefficients each cut discards, the size
+// from quantizing and Huffman counting the sampled rows. Only the best
+// candidate and its neighbours are then confirmed with full passes
+// (compress() with quality metrics plus encode()), at most maxFullPasses
+// of them per block size. The forward coefficients of a manager are
+// computed once and reused for every cut.
+template<typename Sample>
+class BasicRateSearch {
+
+public:
+    explicit BasicRateSearch(RateTarget target);
+
+    void setSampleBlocks(int blocks);
+    void setMaxFullPasses(int passes);
+
+    // Leaves the manager at the chosen cut.
+    RateSearchResult searchCut(BasicBlockManager<Sample> &manager);
+    // One forward transform per block size; sizes larger than the image are skipped.
+    RateSearchResult search(const QImage &image, const std::vector<int> &blockSizes, ThreadPool *pool = nullptr);
+
+private:
+    std::vector<double> energyProfile(const BasicBlockManager<Sample> &manager, const std::vector<int> &rows, double &pixels) const;
+    RateSearchResult confirm(BasicBlockManager<Sample> &manager, int cutDimension, std::map<int, RateSearchResult> &confirmed) const;
+    bool meets(const RateSearchResult &result) const;
+    bool better(const RateSearchResult &candidate, const RateSearchResult &best) const;
+
+    RateTarget target;
+    int sampleBlocks;
+    int maxFullPasses;
+};
+
+typedef BasicRateSearch<double> RateSearch;
+
+#endif
@@ -0,0 +1,139 @@
+#include "sequenceCompressor.h"
+#include "frameDiff.h"
+#include "threadPool.h"
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+
+template<typename Sample>
+BasicSequenceCompressor<Sample>::BasicSequenceCompressor(int blockSize, int cutDimension, ThreadPool *pool): blockSize(blockSize), cutDimension(cutDimension), pool(pool != nullptr ? pool : &ThreadPool::global()), outputFormat(QImage::Format_Grayscale8), cacheBudget(0), changedBlocks(0), keyFrame(false) {
+}
+
+template<typename Sample>
+void BasicSequenceCompressor<Sample>::setCutDimension(int dimension) {
+    if (dimension != cutDimension) {
+        reset();
+    }
+    cutDimension = dimension;
+}
+
+template<typename Sample>
+void BasicSequenceCompressor<Sample>::setOutputFormat(QImage::Format format) {
+    if (format != outputFormat) {
+        reset();
+    }
+    outputFormat = format;
+}
+
+// Repeated content across frames (scrolling, moving windows) then also
+// hits among the changed blocks.
+template<typename Sample>
+void BasicSequenceCompressor<Sample>::setResultCacheBudget(std::size_t bytes) {
+    cacheBudget = bytes;
+    if (manager) {
+        manager->setResultCacheBudget(bytes);
+    }
+}
+
+template<typename Sample>
+void BasicSequenceCompressor<Sample>::reset() {
+    previous = QImage();
+    reconstruction = QImage();
+}
+
+template<typename Sample>
+QImage BasicSequenceCompressor<Sample>::compressFrame(const QImage &frame, const std::function<bool()> &cancelled) {
+    QImage image = frame;
+    switch (frame.format()) {
+        case QImage::Format_Grayscale8:
+        case QImage::Format_RGB32:
+        case QImage::Format_ARGB32:
+        case QImage::Format_ARGB32_Premultiplied:
+            break;
+        default:
+            image = frame.convertToFormat(QImage::Format_RGB32);
+            break;
+    }
+
+    keyFrame = previous.isNull() || image.size() != previous.size() || image.format() != previous.format();
+    if (keyFrame) {
+        if (!manager || manager->imgWidth != image.width() || manager->imgHeight != image.height()) {
+            manager.reset(new BasicBlockManager<Sample>(&image, blockSize, cutDimension, pool));
+            manager->setResultCacheBudget(cacheBudget);
+            changed.assign((std::size_t) manager->rows * manager->columns, 1);
+        } else {
+            manager->updateImage(image);
+        }
+        manager->setCutDimension(cutDimension);
+        manager->setOutputFormat(outputFormat);
+        changedBlocks = getBlockCount();
+
+        std::unique_ptr<QImage> output(manager->compress(cancelled));
+        if (!output) {
+            reset();
+            return QImage();
+        }
+        reconstruction = *output;
+        previous = image;
+        return reconstruction;
+    }
+
+    changedBlocks = diffFrame(image);
+    if (changedBlocks > 0) {
+        manager->updateBlocks(image, changed);
+        if (!manager->compressBlocks(reconstruction, changed, cancelled)) {
+            reset();
+            return QImage();
+        }
+    }
+    previous = image;
+    return reconstruction;
+}
+
+// Flags the blocks that differ from the previous frame, one block row per
+// task. Returns how many are flagged.
+template<typename Sample>
+int BasicSequenceCompressor<Sample>::diffFrame(const QImage &frame) {
+    int rows = manager->rows;
+    int columns = manager->columns;
+    int pixelBytes = frame.depth() / 8;
+    int lineBytes = frame.width() * pixelBytes;
+    std::fill(changed.begin(), changed.end(), 0);
+    std::atomic<int> total(0);
+
+    Profiler::Section section(std::min(pool->getWorkerCount(), rows));
+    pool->parallelFor(rows, [&](int i){
+        Profiler::Scope load(Stage::Load, 0, (std::uint64_t) std::min(blockSize, frame.height() - i * blockSize) * lineBytes);
+        char *flags = changed.data() + (std::size_t) i * columns;
+        int flagged = 0;
+        for (int y = i * blockSize; y < std::min((i + 1) * blockSize, frame.height()) && flagged < columns; ++y) {
+            flagged = markChangedSpans(previous.constScanLine(y), frame.constScanLine(y), lineBytes, blockSize * pixelBytes, flags);
+        }
+        total += flagged;
+    });
+    return total;
+}
+
+template<typename Sample>
+BasicBlockManager<Sample> *BasicSequenceCompressor<Sample>::getManager() const {
+    return manager.get();
+}
+
+template<typename Sample>
+bool BasicSequenceCompressor<Sample>::wasKeyFrame() const {
+    return keyFrame;
+}
+
+template<typename Sample>
+int BasicSequenceCompressor<Sample>::getChangedBlocks() const {
+    return changedBlocks;
+}
+
+template<typename Sample>
+int BasicSequenceCompressor<Sample>::getBlockCount() const {
+    return manager ? manager->rows * manager->columns : 0;
+}
+
+template class BasicSequenceCompressor<double>;
+template class BasicSequenceCompressor<float>;
+template class BasicSequenceCompressor<std::int32_t>;
@@ -0,0 +1,57 @@
+#ifndef SEQUENCE_COMPRESSOR_H
+#define SEQUENCE_COMPRESSOR_H
+
+#include <QImage>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "blockManager.h"
+
+class ThreadPool;
+
+// Compresses the frames of a sequence (screen captures, time lapses)
+// against the previous frame. Blocks whose pixels did not change keep their
+// coefficients and their part of the reconstruction, so only the changed
+// blocks are loaded, transformed and packed again and the cost of a frame
+// follows the changed area. Finding them is one vectorized compare of the
+// two frames. A frame of another size or pixel format, a new cut or
+// reset() starts over with a full key frame.
+template<typename Sample>
+class BasicSequenceCompressor {
+
+public:
+    BasicSequenceCompressor(int blockSize, int cutDimension, ThreadPool *pool = nullptr);
+
+    void setCutDimension(int dimension);
+    void setOutputFormat(QImage::Format format);
+    void setResultCacheBudget(std::size_t bytes);
+    void reset();
+    // Reconstruction of the frame, or a null image when cancelled. It shares
+    // its pixels with the compressor, so holding on to it costs one copy of
+    // the image on the next frame.
+    QImage compressFrame(const QImage &frame, const std::function<bool()> &cancelled = nullptr);
+    // Null before the first frame.
+    BasicBlockManager<Sample> *getManager() const;
+    bool wasKeyFrame() const;
+    int getChangedBlocks() const;
+    int getBlockCount() const;
+
+private:
+    int diffFrame(const QImage &frame);
+
+    int blockSize;
+    int cutDimension;
+    ThreadPool *pool;
+    QImage::Format outputFormat;
+    std::size_t cacheBudget;
+    std::unique_ptr<BasicBlockManager<Sample>> manager;
+    QImage previous;
+    QImage reconstruction;
+    std::vector<char> changed;
+    int changedBlocks;
+    bool keyFrame;
+};
+
+typedef BasicSequenceCompressor<double> SequenceCompressor;
+
+#endif
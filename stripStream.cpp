@@ -0,0 +1,203 @@
+#include "stripStream.h"
+#include "blockManager.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace {
+
+std::uint32_t readLittleEndian(const uchar *bytes, int size) {
+    std::uint32_t value = 0;
+    for (int i = size - 1; i >= 0; --i) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+}
+
+BmpStripReader::BmpStripReader(const std::string &path): file(path, std::ios::binary), imgWidth(0), imgHeight(0), bitCount(0), rowStride(0), dataOffset(0), bottomUp(true), valid(false) {
+    uchar header[54];
+    if (!file.read((char*)header, sizeof(header)) || header[0] != 'B' || header[1] != 'M') {
+        return;
+    }
+
+    dataOffset = readLittleEndian(header + 10, 4);
+    int infoSize = readLittleEndian(header + 14, 4);
+    imgWidth = (std::int32_t) readLittleEndian(header + 18, 4);
+    int rawHeight = (std::int32_t) readLittleEndian(header + 22, 4);
+    bitCount = readLittleEndian(header + 28, 2);
+    int compression = readLittleEndian(header + 30, 4);
+    int paletteSize = readLittleEndian(header + 46, 4);
+
+    bottomUp = rawHeight > 0;
+    imgHeight = std::abs(rawHeight);
+    rowStride = ((imgWidth * bitCount + 31) / 32) * 4;
+
+    // BI_RGB, or BI_BITFIELDS with the usual 32 bit BGRA masks.
+    bool supportedCompression = compression == 0 || (compression == 3 && bitCount == 32);
+    if (imgWidth <= 0 || imgHeight == 0 || !supportedCompression || (bitCount != 8 && bitCount != 24 && bitCount != 32)) {
+        return;
+    }
+
+    if (bitCount == 8) {
+        int entries = paletteSize == 0 ? 256 : std::min(paletteSize, 256);
+        std::vector<uchar> colors(entries * 4);
+        file.seekg(14 + infoSize);
+        if (!file.read((char*)colors.data(), colors.size())) {
+            return;
+        }
+
+        palette.assign(256, 0);
+        for (int i = 0; i < entries; ++i) {
+            palette[i] = qGray(colors[i * 4 + 2], colors[i * 4 + 1], colors[i * 4]);
+        }
+    }
+
+    row.resize(rowStride);
+    valid = true;
+}
+
+bool BmpStripReader::isOpen() const {
+    return valid;
+}
+
+int BmpStripReader::width() const {
+    return imgWidth;
+}
+
+int BmpStripReader::height() const {
+    return imgHeight;
+}
+
+bool BmpStripReader::readRows(int y, int count, uchar *buffer, int stride) {
+    if (!valid || y < 0 || y + count > imgHeight) {
+        return false;
+    }
+
+    int bytesPerPixel = bitCount / 8;
+    for (int line = 0; line < count; ++line) {
+        int fileRow = bottomUp ? imgHeight - 1 - (y + line) : y + line;
+        file.seekg(dataOffset + (std::streamoff) fileRow * rowStride);
+        if (!file.read((char*)row.data(), rowStride)) {
+            return false;
+        }
+
+        uchar *out = buffer + line * stride;
+        if (bitCount == 8) {
+            for (int x = 0; x < imgWidth; ++x) {
+                out[x] = palette[row[x]];
+            }
+        } else {
+            for (int x = 0; x < imgWidth; ++x) {
+                const uchar *pixel = row.data() + x * bytesPerPixel;
+                out[x] = qGray(pixel[2], pixel[1], pixel[0]);
+            }
+        }
+    }
+    return true;
+}
+
+ImageStripReader::ImageStripReader(const QImage &image): image(image) {
+    if (image.format() != QImage::Format_Grayscale8 && image.depth() != 32) {
+        this->image = image.convertToFormat(QImage::Format_RGB32);
+    }
+}
+
+int ImageStripReader::width() const {
+    return image.width();
+}
+
+int ImageStripReader::height() const {
+    return image.height();
+}
+
+bool ImageStripReader::readRows(int y, int count, uchar *buffer, int stride) {
+    if (y < 0 || y + count > image.height()) {
+        return false;
+    }
+
+    bool grayscale = image.format() == QImage::Format_Grayscale8;
+    for (int line = 0; line < count; ++line) {
+        uchar *out = buffer + line * stride;
+        if (grayscale) {
+            std::memcpy(out, image.constScanLine(y + line), image.width());
+            continue;
+        }
+
+        const QRgb *source = (const QRgb*)image.constScanLine(y + line);
+        for (int x = 0; x < image.width(); ++x) {
+            out[x] = qGray(source[x]);
+        }
+    }
+    return true;
+}
+
+PgmStripWriter::PgmStripWriter(const std::string &path, int width, int height): file(path, std::ios::binary), line(width), rowsWritten(0) {
+    file << "P5\n" << width << " " << height << "\n255\n";
+}
+
+bool PgmStripWriter::isOpen() const {
+    return file.good();
+}
+
+bool PgmStripWriter::operator()(int y, const QImage &strip) {
+    // The file is written sequentially, so strips must arrive top to bottom.
+    if (y != rowsWritten) {
+        return false;
+    }
+
+    for (int row = 0; row < strip.height(); ++row) {
+        const uchar *source = strip.constScanLine(row);
+        if (strip.format() == QImage::Format_Grayscale8) {
+            file.write((const char*)source, strip.width());
+            continue;
+        }
+
+        const QRgb *pixels = (const QRgb*)source;
+        for (int x = 0; x < strip.width(); ++x) {
+            line[x] = (char) qGray(pixels[x]);
+        }
+        file.write(line.data(), strip.width());
+    }
+    rowsWritten += strip.height();
+    return file.good();
+}
+
+bool compressStream(StripReader &reader, int blockSize, int cutDimension, const StripSink &sink, ThreadPool *pool) {
+    int width = reader.width();
+    int height = reader.height();
+    if (width <= 0 || height <= 0 || blockSize <= 0) {
+        return false;
+    }
+
+    // Only one block row of input, coefficients and output is alive at a
+    // time; the manager is rebuilt once for a shorter final strip.
+    QImage strip;
+    std::unique_ptr<BlockManager> manager;
+
+    for (int y = 0; y < height; y += blockSize) {
+        int stripHeight = std::min(blockSize, height - y);
+        if (strip.height() != stripHeight) {
+            strip = QImage(width, stripHeight, QImage::Format_Grayscale8);
+        }
+
+        if (!reader.readRows(y, stripHeight, strip.bits(), strip.bytesPerLine())) {
+            return false;
+        }
+
+        if (manager == nullptr || manager->imgHeight != stripHeight) {
+            manager.reset(new BlockManager(&strip, blockSize, cutDimension, pool));
+        } else {
+            manager->updateImage(strip);
+        }
+
+        std::unique_ptr<QImage> output(manager->compress());
+        if (!sink(y, *output)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef STRIP_STREAM_H
+#define STRIP_STREAM_H
+
+#include <QImage>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// Source of 8-bit grayscale rows, read top to bottom in horizontal strips.
+class StripReader {
+
+public:
+    virtual ~StripReader() = default;
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+    virtual bool readRows(int y, int count, uchar *buffer, int stride) = 0;
+};
+
+// Reads uncompressed 8, 24 and 32 bit BMP files row by row, so only the
+// requested strip is ever resident.
+class BmpStripReader : public StripReader {
+
+public:
+    explicit BmpStripReader(const std::string &path);
+    bool isOpen() const;
+    int width() const override;
+    int height() const override;
+    bool readRows(int y, int count, uchar *buffer, int stride) override;
+
+private:
+    std::ifstream file;
+    std::vector<uchar> palette;
+    std::vector<uchar> row;
+    int imgWidth;
+    int imgHeight;
+    int bitCount;
+    int rowStride;
+    std::streamoff dataOffset;
+    bool bottomUp;
+    bool valid;
+};
+
+class ImageStripReader : public StripReader {
+
+public:
+    explicit ImageStripReader(const QImage &image);
+    int width() const override;
+    int height() const override;
+    bool readRows(int y, int count, uchar *buffer, int stride) override;
+
+private:
+    QImage image;
+};
+
+// Receives each finished strip together with the image row it starts at.
+typedef std::function<bool(int y, const QImage &strip)> StripSink;
+
+// Writes strips straight into a binary PGM file.
+class PgmStripWriter {
+
+public:
+    PgmStripWriter(const std::string &path, int width, int height);
+    bool isOpen() const;
+    bool operator()(int y, const QImage &strip);
+
+private:
+    std::ofstream file;
+    std::vector<char> line;
+    int rowsWritten;
+};
+
+bool compressStream(StripReader &reader, int blockSize, int cutDimension, const StripSink &sink, ThreadPool *pool = nullptr);
+
+#endif
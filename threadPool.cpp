@@ -0,0 +1,141 @@
+#include "threadPool.h"
+#include <algorithm>
+#include <cstdlib>
+
+ThreadPool::ThreadPool(int workerCount): workerCount(workerCount > 0 ? workerCount : defaultWorkerCount()), task(nullptr), generation(0), pendingWorkers(0), stopping(false) {
+    // The thread calling parallelFor() is participant 0, so only workerCount - 1 threads are spawned.
+    queues.reset(new Queue[this->workerCount]);
+    for (int id = 1; id < this->workerCount; ++id) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, id);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+ThreadPool &ThreadPool::global() {
+    static ThreadPool pool;
+    return pool;
+}
+
+int ThreadPool::defaultWorkerCount() {
+    const char *env = std::getenv("JPEGC_THREADS");
+    if (env != nullptr && std::atoi(env) > 0) {
+        return std::atoi(env);
+    }
+    return std::max(1, (int) std::thread::hardware_concurrency());
+}
+
+int ThreadPool::getWorkerCount() const {
+    return workerCount;
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)> &function) {
+    if (count <= 0) {
+        return;
+    }
+
+    if (workerCount == 1 || count == 1) {
+        for (int i = 0; i < count; ++i) {
+            function(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> submitLock(submitMutex);
+
+    int chunk = count / workerCount;
+    int extra = count % workerCount;
+    int begin = 0;
+    for (int id = 0; id < workerCount; ++id) {
+        std::lock_guard<std::mutex> lock(queues[id].mutex);
+        queues[id].begin = begin;
+        begin += chunk + (id < extra ? 1 : 0);
+        queues[id].end = begin;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        task = &function;
+        pendingWorkers = workerCount - 1;
+        ++generation;
+    }
+    wakeCondition.notify_all();
+
+    runTasks(0);
+
+    std::unique_lock<std::mutex> lock(stateMutex);
+    doneCondition.wait(lock, [this](){ return pendingWorkers == 0; });
+    task = nullptr;
+}
+
+void ThreadPool::workerLoop(int id) {
+    std::uint64_t seenGeneration = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            wakeCondition.wait(lock, [&](){ return stopping || generation != seenGeneration; });
+            if (stopping) {
+                return;
+            }
+            seenGeneration = generation;
+        }
+
+        runTasks(id);
+
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (--pendingWorkers == 0) {
+            doneCondition.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runTasks(int id) {
+    int index;
+    while (popTask(id, index) || stealTask(id, index)) {
+        (*task)(index);
+    }
+}
+
+bool ThreadPool::popTask(int id, int &index) {
+    std::lock_guard<std::mutex> lock(queues[id].mutex);
+    if (queues[id].begin >= queues[id].end) {
+        return false;
+    }
+    index = queues[id].begin++;
+    return true;
+}
+
+bool ThreadPool::stealTask(int id, int &index) {
+    for (int offset = 1; offset < workerCount; ++offset) {
+        Queue &victim = queues[(id + offset) % workerCount];
+        int begin, end;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            int remaining = victim.end - victim.begin;
+            if (remaining <= 0) {
+                continue;
+            }
+            end = victim.end;
+            begin = end - (remaining + 1) / 2;
+            victim.end = begin;
+        }
+
+        index = begin;
+        std::lock_guard<std::mutex> lock(queues[id].mutex);
+        queues[id].begin = begin + 1;
+        queues[id].end = end;
+        return true;
+    }
+    return false;
+}
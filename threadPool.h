@@ -0,0 +1,52 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <cstdint>
+
+// Long-lived pool of workers. parallelFor() hands every participant a
+// contiguous range of indices; participants that run dry steal the upper half
+// of another participant's remaining range, one index at a time.
+class ThreadPool {
+
+public:
+    explicit ThreadPool(int workerCount = 0);
+    ~ThreadPool();
+
+    static ThreadPool &global();
+    static int defaultWorkerCount();
+
+    int getWorkerCount() const;
+    void parallelFor(int count, const std::function<void(int)> &function);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        int begin = 0;
+        int end = 0;
+    };
+
+    void workerLoop(int id);
+    void runTasks(int id);
+    bool popTask(int id, int &index);
+    bool stealTask(int id, int &index);
+
+    int workerCount;
+    std::vector<std::thread> workers;
+    std::unique_ptr<Queue[]> queues;
+    const std::function<void(int)> *task;
+    std::mutex submitMutex;
+    std::mutex stateMutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    std::uint64_t generation;
+    int pendingWorkers;
+    bool stopping;
+};
+
+#endif
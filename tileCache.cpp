@@ -0,0 +1,74 @@
+#include "tileCache.h"
+#include <algorithm>
+#include <iterator>
+
+TileCache::TileCache(std::size_t byteBudget): byteBudget(byteBudget), byteSize(0) {
+}
+
+int TileCache::tileBlocks(int blockSize) {
+    return std::max(1, tileTargetSize / std::max(1, blockSize));
+}
+
+QRect TileCache::tileBlockRect(int row, int column, int blockSize, int level) {
+    int blocks = tileBlocks(blockSize) << level;
+    return QRect(column * blocks, row * blocks, blocks, blocks);
+}
+
+QRect TileCache::tilePixelRect(int row, int column, int blockSize, const QSize &imageSize, int level) {
+    int extent = (tileBlocks(blockSize) * blockSize) << level;
+    return QRect(column * extent, row * extent, extent, extent).intersected(QRect(QPoint(0, 0), imageSize));
+}
+
+bool TileCache::lookup(const TileKey &key, QImage &tile) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = tiles.find(key);
+    if (found == tiles.end()) {
+        return false;
+    }
+    recent.splice(recent.end(), recent, found->second.position);
+    tile = found->second.tile;
+    return true;
+}
+
+bool TileCache::contains(const TileKey &key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return tiles.count(key) > 0;
+}
+
+void TileCache::insert(const TileKey &key, const QImage &tile) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = tiles.find(key);
+    if (found != tiles.end()) {
+        byteSize -= found->second.tile.sizeInBytes();
+        recent.erase(found->second.position);
+        tiles.erase(found);
+    }
+
+    while (!recent.empty() && byteSize + tile.sizeInBytes() > byteBudget) {
+        auto oldest = tiles.find(recent.front());
+        byteSize -= oldest->second.tile.sizeInBytes();
+        tiles.erase(oldest);
+        recent.pop_front();
+    }
+
+    recent.push_back(key);
+    tiles[key] = Entry{tile, std::prev(recent.end())};
+    byteSize += tile.sizeInBytes();
+}
+
+void TileCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    tiles.clear();
+    recent.clear();
+    byteSize = 0;
+}
+
+bool TileCache::isFull() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return byteSize >= byteBudget;
+}
+
+std::size_t TileCache::getByteSize() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return byteSize;
+}
@@ -0,0 +1,63 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include <QImage>
+#include <QRect>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+// Position and pyramid level of a preview tile plus the parameters it was
+// compressed with.
+struct TileKey {
+    int row;
+    int column;
+    int level;
+    int cutDimension;
+    int blockSize;
+
+    bool operator<(const TileKey &other) const {
+        return std::tie(row, column, level, cutDimension, blockSize) < std::tie(other.row, other.column, other.level, other.cutDimension, other.blockSize);
+    }
+};
+
+// Reconstructed preview tiles of the current image, least recently used
+// first out once the byte budget is reached. A tile is roughly
+// tileTargetSize pixels square at its own level; at level L it spans a
+// square of whole blocks 2^L times that size in the full-size image. Thread
+// safe: the worker inserts while the view looks tiles up.
+class TileCache {
+
+public:
+    static constexpr int tileTargetSize = 256;
+    static constexpr std::size_t defaultBudget = std::size_t(256) << 20;
+
+    explicit TileCache(std::size_t byteBudget = defaultBudget);
+
+    static int tileBlocks(int blockSize);
+    static QRect tileBlockRect(int row, int column, int blockSize, int level = 0);
+    static QRect tilePixelRect(int row, int column, int blockSize, const QSize &imageSize, int level = 0);
+
+    bool lookup(const TileKey &key, QImage &tile);
+    bool contains(const TileKey &key);
+    void insert(const TileKey &key, const QImage &tile);
+    void clear();
+    bool isFull();
+    std::size_t getByteSize();
+
+private:
+    struct Entry {
+        QImage tile;
+        std::list<TileKey>::iterator position;
+    };
+
+    std::map<TileKey, Entry> tiles;
+    std::list<TileKey> recent;
+    std::mutex mutex;
+    std::size_t byteBudget;
+    std::size_t byteSize;
+};
+
+#endif
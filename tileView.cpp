@@ -0,0 +1,116 @@
+#include "tileView.h"
+#include "imagePyramid.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <QPalette>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+QRectF scaledRect(const QRect &rect, double scaleFactor) {
+    return QRectF(rect.x() * scaleFactor, rect.y() * scaleFactor, rect.width() * scaleFactor, rect.height() * scaleFactor);
+}
+
+}
+
+TileView::TileView(TileCache *cache, QWidget *parent): QWidget(parent), cache(cache), blockSize(1), cutDimension(0), fallbackCut(-1), level(0), scaleFactor(1) {
+}
+
+void TileView::setImageSize(const QSize &size) {
+    imageSize = size;
+    resize(imageSize * scaleFactor);
+    update();
+}
+
+void TileView::setParameters(int blockSize, int cutDimension) {
+    if (blockSize == this->blockSize && cutDimension == this->cutDimension) {
+        return;
+    }
+
+    // Tiles of another block size cover different pixels, so only a quality
+    // change can keep showing the old tiles until the new ones arrive.
+    fallbackCut = blockSize == this->blockSize ? this->cutDimension : -1;
+    this->blockSize = blockSize;
+    this->cutDimension = cutDimension;
+    update();
+}
+
+void TileView::setScaleFactor(double scaleFactor) {
+    this->scaleFactor = scaleFactor;
+    level = ImagePyramid::levelForScale(scaleFactor);
+    resize(imageSize * scaleFactor);
+    update();
+}
+
+int TileView::getLevel() const {
+    return level;
+}
+
+QRect TileView::mapToImage(const QRect &rect) const {
+    int left = (int) std::floor(rect.left() / scaleFactor);
+    int top = (int) std::floor(rect.top() / scaleFactor);
+    int right = (int) std::ceil((rect.right() + 1) / scaleFactor);
+    int bottom = (int) std::ceil((rect.bottom() + 1) / scaleFactor);
+    return QRect(left, top, right - left, bottom - top).intersected(QRect(QPoint(0, 0), imageSize));
+}
+
+void TileView::updateTile(int row, int column, int level, int cutDimension) {
+    if (level != this->level || cutDimension != this->cutDimension) {
+        return;
+    }
+    update(scaledRect(TileCache::tilePixelRect(row, column, blockSize, imageSize, level), scaleFactor).toAlignedRect());
+}
+
+void TileView::paintEvent(QPaintEvent *event) {
+    QRect exposed = mapToImage(event->rect());
+    if (exposed.isEmpty()) {
+        return;
+    }
+
+    QPainter painter(this);
+    int extent = (TileCache::tileBlocks(blockSize) * blockSize) << level;
+    bool missing = false;
+
+    for (int row = exposed.top() / extent; row <= exposed.bottom() / extent; ++row) {
+        for (int column = exposed.left() / extent; column <= exposed.right() / extent; ++column) {
+            QRectF target = scaledRect(TileCache::tilePixelRect(row, column, blockSize, imageSize, level), scaleFactor);
+            QImage tile;
+
+            if (cache->lookup(TileKey{row, column, level, cutDimension, blockSize}, tile)) {
+                painter.drawImage(target, tile);
+                continue;
+            }
+
+            missing = true;
+            if (fallbackCut >= 0 && cache->lookup(TileKey{row, column, level, fallbackCut, blockSize}, tile)) {
+                painter.drawImage(target, tile);
+            } else if (cache->lookup(TileKey{row / 2, column / 2, level + 1, cutDimension, blockSize}, tile)) {
+                // Right after zooming in, stretch the matching quarter of the coarser tile.
+                QRect pixels = TileCache::tilePixelRect(row, column, blockSize, imageSize, level);
+                QRect parent = TileCache::tilePixelRect(row / 2, column / 2, blockSize, imageSize, level + 1);
+                double shrink = 1.0 / (1 << (level + 1));
+                QRectF source((pixels.x() - parent.x()) * shrink, (pixels.y() - parent.y()) * shrink, pixels.width() * shrink, pixels.height() * shrink);
+                painter.drawImage(target, tile, source);
+            } else {
+                painter.fillRect(target, palette().color(QPalette::Window));
+            }
+        }
+    }
+
+    if (!heatmap.isNull()) {
+        // One heatmap pixel per block, blended over the tiles.
+        double extent = blockSize * scaleFactor;
+        painter.setOpacity(0.4);
+        painter.drawImage(QRectF(0, 0, heatmap.width() * extent, heatmap.height() * extent), heatmap);
+    }
+
+    if (missing) {
+        emit tilesMissing();
+    }
+}
+
+void TileView::setHeatmap(const QImage &heatmap) {
+    this->heatmap = heatmap;
+    update();
+}
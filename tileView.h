@@ -0,0 +1,46 @@
+#ifndef TILE_VIEW_H
+#define TILE_VIEW_H
+
+#include <QWidget>
+#include <QSize>
+#include <QRect>
+#include <QImage>
+#include "tileCache.h"
+
+// Compressed preview pane. Paints whatever tiles of the current quality and
+// pyramid level are in the cache, falls back to the previous quality while
+// new tiles are being produced and reports exposed tiles that are still
+// missing.
+class TileView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit TileView(TileCache *cache, QWidget *parent = nullptr);
+
+    void setImageSize(const QSize &size);
+    void setParameters(int blockSize, int cutDimension);
+    void setScaleFactor(double scaleFactor);
+    int getLevel() const;
+    QRect mapToImage(const QRect &rect) const;
+    void updateTile(int row, int column, int level, int cutDimension);
+    void setHeatmap(const QImage &heatmap);
+
+signals:
+    void tilesMissing();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    TileCache *cache;
+    QSize imageSize;
+    int blockSize;
+    int cutDimension;
+    int fallbackCut;
+    int level;
+    double scaleFactor;
+    QImage heatmap;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "transformBackend.h"
+#include "dct2d.h"
+#include "prunedIdct.h"
+#include <cmath>
+
+namespace {
+
+// FFTW's REDFT10 is 2N times the orthonormal DCT-II, times sqrt(2) on the DC term.
+double unnormalizedScale(int u, int v, int blockSize) {
+    double weight = (u == 0 ? std::sqrt(0.5) : 1.0) * (v == 0 ? std::sqrt(0.5) : 1.0);
+    return weight / (2 * blockSize);
+}
+
+}
+
+TransformBackend<double>::Plan TransformBackend<double>::createPlan(int rows, int columns, int rowStride, int howMany, int distance, PlanCache::Kind kind) {
+    return PlanCache::instance().getBatchPlan(rows, columns, rowStride, howMany, distance, kind);
+}
+
+TransformBackend<double>::Plan TransformBackend<double>::createLinePlan(int length, int stride, int howMany, int distance, PlanCache::Kind kind) {
+    return PlanCache::instance().getLinePlan(length, stride, howMany, distance, kind);
+}
+
+void TransformBackend<double>::execute(Plan plan, double *data) {
+    fftw_execute_r2r(plan, data, data);
+}
+
+bool TransformBackend<double>::hasKernel(int blockSize) {
+    return hasFixedSizeDct(blockSize);
+}
+
+void TransformBackend<double>::kernelForward(int blockSize, double *block) {
+    blockSize == 8 ? Dct2D<8>::forward(block) : Dct2D<16>::forward(block);
+}
+
+void TransformBackend<double>::kernelInverse(int blockSize, double *block) {
+    blockSize == 8 ? Dct2D<8>::inverse(block) : Dct2D<16>::inverse(block);
+}
+
+void TransformBackend<double>::prunedInverse(int rows, int columns, int cut, double *block, int rowStride) {
+    prunedTransform(rows, columns).inverse(block, rowStride, cut);
+}
+
+const PrunedIdct &TransformBackend<double>::prunedTransform(int rows, int columns) {
+    return PrunedIdct::get(rows, columns, PrunedIdct::Scale::Unnormalized);
+}
+
+double TransformBackend<double>::pixelDivisor(int width, int height) {
+    return 4 * width * height;
+}
+
+// The unnormalized DC term already carries the full block size.
+double TransformBackend<double>::reducedDivisor(int width, int height, int, int) {
+    return 4 * width * height;
+}
+
+double TransformBackend<double>::coefficientScale(int u, int v, int blockSize) {
+    return unnormalizedScale(u, v, blockSize);
+}
+
+TransformBackend<float>::Plan TransformBackend<float>::createPlan(int rows, int columns, int rowStride, int howMany, int distance, PlanCache::Kind kind) {
+    return PlanCache::instance().getFloatBatchPlan(rows, columns, rowStride, howMany, distance, kind);
+}
+
+TransformBackend<float>::Plan TransformBackend<float>::createLinePlan(int length, int stride, int howMany, int distance, PlanCache::Kind kind) {
+    return PlanCache::instance().getFloatLinePlan(length, stride, howMany, distance, kind);
+}
+
+void TransformBackend<float>::execute(Plan plan, float *data) {
+    fftwf_execute_r2r(plan, data, data);
+}
+
+bool TransformBackend<float>::hasKernel(int) {
+    return false;
+}
+
+void TransformBackend<float>::kernelForward(int, float *) {
+}
+
+void TransformBackend<float>::kernelInverse(int, float *) {
+}
+
+void TransformBackend<float>::prunedInverse(int rows, int columns, int cut, float *block, int rowStride) {
+    prunedTransform(rows, columns).inverse(block, rowStride, cut);
+}
+
+const PrunedIdct &TransformBackend<float>::prunedTransform(int rows, int columns) {
+    return PrunedIdct::get(rows, columns, PrunedIdct::Scale::Unnormalized);
+}
+
+double TransformBackend<float>::pixelDivisor(int width, int height) {
+    return 4 * width * height;
+}
+
+double TransformBackend<float>::reducedDivisor(int width, int height, int, int) {
+    return 4 * width * height;
+}
+
+double TransformBackend<float>::coefficientScale(int u, int v, int blockSize) {
+    return unnormalizedScale(u, v, blockSize);
+}
+
+TransformBackend<std::int32_t>::Plan TransformBackend<std::int32_t>::createPlan(int rows, int columns, int rowStride, int howMany, int distance, PlanCache::Kind kind) {
+    FixedPlan plan;
+    plan.dct = &FixedDct::get(rows, columns);
+    plan.inverse = kind == PlanCache::Kind::Inverse;
+    plan.rowStride = rowStride;
+    plan.howMany = howMany;
+    plan.distance = distance;
+    return plan;
+}
+
+// The pass that does not run leaves the other dimension of the table unused.
+TransformBackend<std::int32_t>::Plan TransformBackend<std::int32_t>::createLinePlan(int length, int stride, int howMany, int distance, PlanCache::Kind kind) {
+    FixedPlan plan;
+    plan.pass = stride == 1 ? FixedPlan::Pass::Rows : FixedPlan::Pass::Columns;
+    plan.dct = stride == 1 ? &FixedDct::get(1, length) : &FixedDct::get(length, 1);
+    plan.inverse = kind == PlanCache::Kind::Inverse;
+    plan.rowStride = stride == 1 ? distance : stride;
+    plan.howMany = howMany;
+    plan.distance = distance;
+    return plan;
+}
+
+void TransformBackend<std::int32_t>::execute(const Plan &plan, std::int32_t *data) {
+    if (plan.pass == FixedPlan::Pass::Rows) {
+        plan.inverse ? plan.dct->inverseRows(data, plan.rowStride, 0, plan.howMany) : plan.dct->forwardRows(data, plan.rowStride, 0, plan.howMany);
+        return;
+    }
+    if (plan.pass == FixedPlan::Pass::Columns) {
+        plan.inverse ? plan.dct->inverseColumns(data, plan.rowStride, 0, plan.howMany) : plan.dct->forwardColumns(data, plan.rowStride, 0, plan.howMany);
+        return;
+    }
+    for (int i = 0; i < plan.howMany; ++i) {
+        std::int32_t *block = data + (std::size_t) i * plan.distance;
+        plan.inverse ? plan.dct->inverse(block, plan.rowStride) : plan.dct->forward(block, plan.rowStride);
+    }
+}
+
+bool TransformBackend<std::int32_t>::hasKernel(int) {
+    return false;
+}
+
+void TransformBackend<std::int32_t>::kernelForward(int, std::int32_t *) {
+}
+
+void TransformBackend<std::int32_t>::kernelInverse(int, std::int32_t *) {
+}
+
+void TransformBackend<std::int32_t>::prunedInverse(int rows, int columns, int cut, std::int32_t *block, int rowStride) {
+    prunedTransform(rows, columns).inverse(block, rowStride, cut);
+}
+
+const PrunedIdct &TransformBackend<std::int32_t>::prunedTransform(int rows, int columns) {
+    return PrunedIdct::get(rows, columns, PrunedIdct::Scale::Orthonormal);
+}
+
+double TransformBackend<std::int32_t>::pixelDivisor(int, int) {
+    return 1 << FixedDct::fractionBits;
+}
+
+// An orthonormal inverse of M points over the first M of N coefficients
+// comes out sqrt(N / M) too large per dimension.
+double TransformBackend<std::int32_t>::reducedDivisor(int width, int height, int reducedWidth, int reducedHeight) {
+    return (1 << FixedDct::fractionBits) * std::sqrt((double) (width * height) / (reducedWidth * reducedHeight));
+}
+
+double TransformBackend<std::int32_t>::coefficientScale(int, int, int) {
+    return 1.0 / (1 << FixedDct::fractionBits);
+}
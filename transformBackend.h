@@ -0,0 +1,95 @@
+#ifndef TRANSFORM_BACKEND_H
+#define TRANSFORM_BACKEND_H
+
+#include <cstdint>
+#include <fftw3.h>
+#include "planCache.h"
+#include "fixedDct.h"
+#include "prunedIdct.h"
+
+// Geometry of a fixed-point "plan", mirroring FFTW's advanced interface.
+// Line plans run one pass of FixedDct over howMany rows or columns.
+struct FixedPlan {
+    enum class Pass {
+        Block,
+        Rows,
+        Columns
+    };
+
+    const FixedDct *dct = nullptr;
+    Pass pass = Pass::Block;
+    bool inverse = false;
+    int rowStride = 0;
+    int howMany = 0;
+    int distance = 0;
+};
+
+// The sample type dependent half of BasicBlockManager. Every backend plans
+// transforms over the BlockStore layout (rows x columns values with a row
+// stride, howMany blocks distance samples apart) and says how transformed
+// values map back to pixels and to orthonormal DCT coefficients.
+//
+// double and float run FFTW / FFTWf plans in FFTW's unnormalized scale;
+// int32 runs FixedDct, whose coefficients are orthonormal in Q4.
+// createLinePlan() gives one-dimensional transforms over the lines of a
+// block (stride 1 for rows, the row stride for columns); a forward
+// transform is the row pass followed by the column pass, an inverse one the
+// reverse, which is also the order FixedDct rounds in.
+// reducedDivisor() applies when only the top-left reducedHeight x
+// reducedWidth coefficients of a block are inverse transformed at that
+// smaller size, which yields a downscaled block.
+template<typename Sample>
+struct TransformBackend;
+
+template<>
+struct TransformBackend<double> {
+    typedef fftw_plan Plan;
+
+    static Plan createPlan(int rows, int columns, int rowStride, int howMany, int distance, PlanCache::Kind kind);
+    static Plan createLinePlan(int length, int stride, int howMany, int distance, PlanCache::Kind kind);
+    static void execute(Plan plan, double *data);
+    static bool hasKernel(int blockSize);
+    static void kernelForward(int blockSize, double *block);
+    static void kernelInverse(int blockSize, double *block);
+    static void prunedInverse(int rows, int columns, int cut, double *block, int rowStride);
+    static const PrunedIdct &prunedTransform(int rows, int columns);
+    static double pixelDivisor(int width, int height);
+    static double reducedDivisor(int width, int height, int reducedWidth, int reducedHeight);
+    static double coefficientScale(int u, int v, int blockSize);
+};
+
+template<>
+struct TransformBackend<float> {
+    typedef fftwf_plan Plan;
+
+    static Plan createPlan(int rows, int columns, int rowStride, int howMany, int distance, PlanCache::Kind kind);
+    static Plan createLinePlan(int length, int stride, int howMany, int distance, PlanCache::Kind kind);
+    static void execute(Plan plan, float *data);
+    static bool hasKernel(int blockSize);
+    static void kernelForward(int blockSize, float *block);
+    static void kernelInverse(int blockSize, float *block);
+    static void prunedInverse(int rows, int columns, int cut, float *block, int rowStride);
+    static const PrunedIdct &prunedTransform(int rows, int columns);
+    static double pixelDivisor(int width, int height);
+    static double reducedDivisor(int width, int height, int reducedWidth, int reducedHeight);
+    static double coefficientScale(int u, int v, int blockSize);
+};
+
+template<>
+struct TransformBackend<std::int32_t> {
+    typedef FixedPlan Plan;
+
+    static Plan createPlan(int rows, int columns, int rowStride, int howMany, int distance, PlanCache::Kind kind);
+    static Plan createLinePlan(int length, int stride, int howMany, int distance, PlanCache::Kind kind);
+    static void execute(const Plan &plan, std::int32_t *data);
+    static bool hasKernel(int blockSize);
+    static void kernelForward(int blockSize, std::int32_t *block);
+    static void kernelInverse(int blockSize, std::int32_t *block);
+    static void prunedInverse(int rows, int columns, int cut, std::int32_t *block, int rowStride);
+    static const PrunedIdct &prunedTransform(int rows, int columns);
+    static double pixelDivisor(int width, int height);
+    static double reducedDivisor(int width, int height, int reducedWidth, int reducedHeight);
+    static double coefficientScale(int u, int v, int blockSize);
+};
+
+#endif